@@ -75,16 +75,16 @@ int main() {
     for (int j = 0; j < amount; j++)
       for (int k = 0; k < amount; k++) {
         Instance &teddy_obj = scene.instantiate(teddy);
-        teddy_obj.transform.scale = vec3(0.2f);
-        teddy_obj.transform.position = vec3(i, j, k) * offset;
-        teddy_obj.transform.scale = vec3(0.2f, 0.2f, 0.2f);
+        teddy_obj.transform.setScale(vec3(0.2f));
+        teddy_obj.transform.setPosition(vec3(i, j, k) * offset);
+        teddy_obj.transform.setScale(vec3(0.2f, 0.2f, 0.2f));
         velocities[i * amount * amount + j * amount + k] = glm::normalize(
             vec3(std::rand() - RAND_MAX / 2, std::rand() - RAND_MAX / 2,
                  std::rand() - RAND_MAX / 2));
       }
 
   scene.camera.speed = 30;
-  scene.camera.transform.position = vec3(0, 0, 0);
+  scene.camera.transform.setPosition(vec3(0, 0, 0));
   scene.camera.sensivity = 8;
 
   float timeSpeed = 0.0f;
@@ -109,8 +109,9 @@ int main() {
 
     for (int i = 0; i < amount * amount * amount; i++) {
       vec3 &vel = velocities[i];
-      vec3 &pos = teddy.instances[i].transform.position;
-      pos += velocities[i] * deltaTime * timeSpeed;
+      Transform &transform = teddy.instances[i].transform;
+      vec3 pos = transform.getPosition() + velocities[i] * deltaTime * timeSpeed;
+      transform.setPosition(pos);
       if (pos.x < 0 || pos.x > bounds) {
         vel.x *= -1;
       }
@@ -127,11 +127,11 @@ int main() {
     for (int j = 0; j < nbPerAxis.y(); j++)
       for (int k = 0; k < nbPerAxis.z(); k++) {
         Instance &istc = scene.instantiate(particle);
-        istc.transform.scale = Vector3f(0.2f, 0.2f, 0.2f);
+        istc.transform.setScale(Vector3f(0.2f, 0.2f, 0.2f));
         auto pos = Vector3f(i, j, k);
-        istc.transform.position =
+        istc.transform.setPosition(
             pos * offset -
-            Vector3f(cmpParam.bounds, cmpParam.bounds, cmpParam.bounds);
+            Vector3f(cmpParam.bounds, cmpParam.bounds, cmpParam.bounds));
       }
 
   Instance &cubeIstc = scene.instantiate(cube);
@@ -139,7 +139,7 @@ int main() {
   /* scene.camera.is2D = true; */
   scene.camera.controls = true;
   scene.camera.speed = 100;
-  scene.camera.transform.position = Vector3f(0, 0, 0);
+  scene.camera.transform.setPosition(Vector3f(0, 0, 0));
   scene.camera.sensivity = 5;
 
   float timeSpeed = 0.0f;
@@ -176,8 +176,8 @@ int main() {
     ImGui::SliderFloat("Bounds", &cmpParam.bounds, 0.1f * originalBounds,
                        2.0f * originalBounds);
 
-    cubeIstc.transform.scale =
-        2.0f * Vector3f(cmpParam.bounds, cmpParam.bounds, cmpParam.bounds);
+    cubeIstc.transform.setScale(
+        2.0f * Vector3f(cmpParam.bounds, cmpParam.bounds, cmpParam.bounds));
   });
   return ret;
 }
@@ -0,0 +1,38 @@
+#version 450
+
+// Default vertex shader for PackedVertex, see src/api/render/vertex_packing.hh
+
+layout(binding = 0) uniform UniformLocationObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ulo;
+
+layout(binding = 2) uniform UniformQuantization {
+    vec3 offset;
+    vec3 scale;
+} uq;
+
+layout(location = 0) in vec3 inPosition; // in [-1, 1] over the mesh bounds
+layout(location = 1) in vec2 inNormal;   // octahedral
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 3) in mat4 inInstanceMat;
+
+layout(location = 0) out vec3 fragNormal;
+layout(location = 1) out vec2 fragTexCoord;
+
+vec3 octahedralDecode(vec2 p) {
+    vec3 n = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+
+void main() {
+    mat4 transform = ulo.model * inInstanceMat;
+    vec3 position = uq.offset + uq.scale * inPosition;
+    gl_Position = ulo.proj * ulo.view * transform * vec4(position, 1.0);
+    fragNormal = mat3(transform) * octahedralDecode(inNormal);
+    fragTexCoord = inTexCoord;
+}
@@ -1,4 +1,4 @@
-#include "api/bvh/bvh.hh"
+#include "api/bvh/scene_bvh.hh"
 #include "api/flim_api.hh"
 #include "api/parameters/render_params.hh"
 #include "api/render/mesh.hh"
@@ -53,7 +53,7 @@ int main() {
     scene.registerMesh(cube, params2);
 
     Instance &instance = scene.instantiate(mesh);
-    instance.transform.scale = Vector3f(0.05, 0.05, 0.05);
+    instance.transform.setScale(Vector3f(0.05, 0.05, 0.05));
 
     Instance &c = scene.instantiate(cube);
 
@@ -82,7 +82,7 @@ int main() {
         });
     Kokkos::fence("Wait for init");
 
-    BVH<5> bvh(cube);
+    SceneBVH bvh(scene);
 
     // main loop
     static float speed = 0.5;
@@ -108,18 +108,24 @@ int main() {
       ImGui::SliderFloat("Max Dist Move", &maxDistMove, 0.3, 1);
       static float time = 0;
       time += deltaTime * speed;
-      instance.transform.position = radius * Vector3f(cos(time), 0, sin(time));
+      instance.transform.setPosition(radius *
+                                     Vector3f(cos(time), 0, sin(time)));
       instance.transform.lookAt(pointing);
-      auto p = instance.transform.position;
+      auto p = instance.transform.getPosition();
       ImGui::Text("COORD IS %f %f %f", p.x(), p.y(), p.z());
 
       Ray ray = {
-          .origin = scene.camera.transform.position,
+          .origin = scene.camera.transform.getPosition(),
           .direction = scene.camera.getMouseDir(),
           .cull = false,
       };
       ImGui::SliderFloat("Dist", &dist, 0, 100);
-      if (!bvh.castRay(ray, &outlined_obj))
+      // Only the instances moved, the mesh BVHs are kept
+      bvh.update();
+      SceneHit hit;
+      if (bvh.castRay(ray, &hit) && &hit.instance->mesh == &cube)
+        outlined_obj = hit.triangle;
+      else
         outlined_obj = UINT32_MAX;
 
       // Kokkos::fence("Wait for move");
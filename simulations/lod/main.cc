@@ -5,9 +5,11 @@
 #include "api/transform.hh"
 #include "api/tree/instance.hh"
 #include "kokkos/renderer_accesser.hh"
+#include "kokkos/simplifier.hh"
 #include <Eigen/src/Core/Matrix.h>
 #include <Kokkos_Core.hpp>
 #include <Kokkos_Random.hpp>
+#include <chrono>
 #include <decl/Kokkos_Declare_OPENMP.hpp>
 #include <imgui.h>
 #include <impl/Kokkos_Profiling.hpp>
@@ -42,7 +44,7 @@ int main() {
   const Renderer &rd = scene.registerMesh(mesh, params);
 
   Instance &instance = scene.instantiate(mesh);
-  instance.transform.scale = Vector3f(3, 3, 3);
+  instance.transform.setScale(Vector3f(3, 3, 3));
 
   scene.camera.controls = true;
   scene.camera.speed = 20;
@@ -50,15 +52,33 @@ int main() {
 
   static int ecol = 1;
   api.setupGraphics();
-  Kokkos::View<Vertex *> vertices =
-      getAttributeBufferView<Vertex>(
+  Kokkos::View<VertexW *> vertices =
+      getAttributeBufferView<VertexW>(
           rd, BINDING_DEFAULT_VERTICES_ATTRIBUTES);
-  Kokkos::View<Vector3<uint32_t> *> indices = getIndexBufferView(rd);
+  Kokkos::View<Vector3uW *> indices = getIndexBufferView(rd);
+  Simplifier<> simplifier(vertices, indices);
 
-  api.run([&](float deltaTime) {
+  api.run([&](float) {
     ImGui::InputInt("Amount of ecol", &ecol);
-    if (ImGui::Button("Apply ecol")) {
-      std::cout << "OK " + std::to_string(deltaTime) << std::endl;
+    if (ImGui::Button("Apply ecol") && ecol > 0) {
+      // Each edge collapse removes two triangles
+      uint32_t removed = 2 * ecol;
+      auto start = std::chrono::steady_clock::now();
+      uint32_t left = simplifier.simplify(
+          simplifier.size() > removed ? simplifier.size() - removed : 0);
+      Kokkos::fence("Simplified");
+      std::chrono::duration<float, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      // The simplified triangles are drawn in place of the first ones, the
+      // amount drawn being the one of the mesh
+      Kokkos::deep_copy(Kokkos::subview(indices, Kokkos::make_pair(0u, left)),
+                        simplifier.getTriangles());
+      auto triangles = Kokkos::create_mirror_view_and_copy(
+          Kokkos::HostSpace(), simplifier.getTriangles());
+      mesh.triangles.assign((Triangle *)triangles.data(),
+                            (Triangle *)triangles.data() + left);
+      std::cout << left << " triangles left, error " << simplifier.getError()
+                << ", in " << elapsed.count() << " ms" << std::endl;
     }
 
     Kokkos::fence("Wait for move");
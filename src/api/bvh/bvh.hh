@@ -1,20 +1,71 @@
 #pragma once
 
 #include "api/render/mesh.hh"
+#include "utils/backend.hh"
+#include "utils/checks.hh"
+#include "utils/mapped_file.hh"
+#include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
-#include <queue>
+#include <memory>
+#include <optional>
+#include <span>
 #include <stack>
+#include <utility>
 #include <vector>
 
 namespace Flim {
 
-template <int nbElems> struct AABB {
-  Vector3f min;
-  Vector3f max;
-  uint32_t elems[nbElems]; // indices of the element
+struct AABB {
+  Vector3f min = Vector3f::Constant(INFINITY);
+  Vector3f max = Vector3f::Constant(-INFINITY);
+
+  FLIM_INLINE_FUNCTION void grow(const Vector3f &p) {
+    min = min.cwiseMin(p);
+    max = max.cwiseMax(p);
+  }
+
+  FLIM_INLINE_FUNCTION void grow(const AABB &box) {
+    min = min.cwiseMin(box.min);
+    max = max.cwiseMax(box.max);
+  }
+
+  // Squared distance from p to the box, 0 if p is inside
+  FLIM_INLINE_FUNCTION float distanceSquared(const Vector3f &p) const {
+    return (min - p).cwiseMax(p - max).cwiseMax(0.0f).squaredNorm();
+  }
+
+  FLIM_INLINE_FUNCTION bool overlaps(const AABB &box) const {
+    return (min.array() <= box.max.array()).all() &&
+           (box.min.array() <= max.array()).all();
+  }
+
+  // Half of the surface area, which is all the SAH needs to compare boxes
+  FLIM_INLINE_FUNCTION float area() const {
+    Vector3f e = max - min;
+    if (e.x() < 0 || e.y() < 0 || e.z() < 0)
+      return 0.0f;
+    return e.x() * e.y() + e.y() * e.z() + e.z() * e.x();
+  }
+};
+
+// A node of the flattened tree. An internal node has a count of 0 and its two
+// children are stored next to each other at leftFirst and leftFirst + 1. A
+// leaf references count primitives starting at leftFirst in the primitive
+// index array.
+struct BVHNode {
+  AABB box;
+  uint32_t leftFirst;
+  uint32_t count;
+
+  FLIM_INLINE_FUNCTION bool isLeaf() const { return count != 0; }
 };
 
 struct Ray {
@@ -22,8 +73,8 @@ struct Ray {
   Vector3f direction;
   bool cull;
 
-  bool intersects(const Vector3f &v0, const Vector3f &v1, const Vector3f &v2,
-                  float &dist) const {
+  FLIM_INLINE_FUNCTION bool intersects(const Vector3f &v0, const Vector3f &v1,
+                                       const Vector3f &v2, float &dist) const {
     const float EPSILON = 0.0000001f;
 
     // Edges sharing v0
@@ -38,14 +89,11 @@ struct Ray {
     float det = edge1.dot(pvec);
 
     // Culling version (only hits front-facing triangles)
-    if (det < EPSILON)
-      return false;
-
     if (cull) {
       if (det < EPSILON)
         return false;
     } else {
-      if (std::abs(det) < EPSILON)
+      if (fabsf(det) < EPSILON)
         return false;
     }
     float invDet = 1.0f / det;
@@ -76,129 +124,840 @@ struct Ray {
 
     return false;
   }
-  template <int nbElems> bool intersects(const AABB<nbElems> &box) const {
-    Vector3f invDir = {1.0f / direction.x(), 1.0f / direction.y(),
-                       1.0f / direction.z()};
+  FLIM_INLINE_FUNCTION bool intersects(const AABB &box) const {
+    return entry(box, direction.cwiseInverse()) != INFINITY;
+  }
 
-    float tmin = -INFINITY;
-    float tmax = INFINITY;
+  // Distance at which the ray enters the box (0 if the origin is inside), or
+  // INFINITY if it misses it or only reaches it past maxDist. invDir is the
+  // component-wise inverse of the direction, computed once per ray.
+  FLIM_INLINE_FUNCTION float entry(const AABB &box, const Vector3f &invDir,
+                                   float maxDist = INFINITY) const {
+    Vector3f t1 = (box.min - origin).cwiseProduct(invDir);
+    Vector3f t2 = (box.max - origin).cwiseProduct(invDir);
+    float tmin = fmaxf(0.0f, t1.cwiseMin(t2).maxCoeff());
+    float tmax = t1.cwiseMax(t2).minCoeff();
 
-    // X-axis slab
-    float tx1 = (box.min.x() - origin.x()) * invDir.x();
-    float tx2 = (box.max.x() - origin.x()) * invDir.x();
-    tmin = std::max(tmin, std::min(tx1, tx2));
-    tmax = std::min(tmax, std::max(tx1, tx2));
+    // Valid if the exit point is not behind the ray and entry precedes exit
+    if (tmax < tmin || tmin >= maxDist)
+      return INFINITY;
+    return tmin;
+  }
+};
 
-    // Y-axis slab
-    float ty1 = (box.min.y() - origin.y()) * invDir.y();
-    float ty2 = (box.max.y() - origin.y()) * invDir.y();
-    tmin = std::max(tmin, std::min(ty1, ty2));
-    tmax = std::min(tmax, std::max(ty1, ty2));
+// Point of the triangle abc closest to p, from Ericson's Real-Time Collision
+// Detection (5.1.5)
+FLIM_INLINE_FUNCTION Vector3f closestPointOnTriangle(const Vector3f &p,
+                                                     const Vector3f &a,
+                                                     const Vector3f &b,
+                                                     const Vector3f &c) {
+  Vector3f ab = b - a;
+  Vector3f ac = c - a;
+  // Vertex regions, then edge regions, then the inside of the face
+  Vector3f ap = p - a;
+  float d1 = ab.dot(ap);
+  float d2 = ac.dot(ap);
+  if (d1 <= 0.0f && d2 <= 0.0f)
+    return a;
+  Vector3f bp = p - b;
+  float d3 = ab.dot(bp);
+  float d4 = ac.dot(bp);
+  if (d3 >= 0.0f && d4 <= d3)
+    return b;
+  float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    return a + ab * (d1 / (d1 - d3));
+  Vector3f cp = p - c;
+  float d5 = ab.dot(cp);
+  float d6 = ac.dot(cp);
+  if (d6 >= 0.0f && d5 <= d6)
+    return c;
+  float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    return a + ac * (d2 / (d2 - d6));
+  float va = d3 * d6 - d5 * d4;
+  if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  float denom = 1.0f / (va + vb + vc);
+  return a + ab * (vb * denom) + ac * (vc * denom);
+}
 
-    // Z-axis slab
-    float tz1 = (box.min.z() - origin.z()) * invDir.z();
-    float tz2 = (box.max.z() - origin.z()) * invDir.z();
-    tmin = std::max(tmin, std::min(tz1, tz2));
-    tmax = std::min(tmax, std::max(tz1, tz2));
+// Result of a closest point query, triangle is UINT32_MAX if no triangle was
+// found within the search distance
+struct ClosestPoint {
+  uint32_t triangle = UINT32_MAX;
+  float distance = INFINITY;
+  Vector3f point = Vector3f::Zero();
 
-    // Valid if the exit point is not behind the ray and entry precedes exit
-    return tmax >= std::max(0.0f, tmin);
+  FLIM_INLINE_FUNCTION bool valid() const { return triangle != UINT32_MAX; }
+};
+
+// Result of a batched ray query, triangle is UINT32_MAX on a miss
+struct Hit {
+  uint32_t triangle = UINT32_MAX;
+  float distance = INFINITY;
+
+  bool valid() const { return triangle != UINT32_MAX; }
+};
+
+// Read-only access to triangles and vertex positions laid out with a stride in
+// memory owned by someone else: the vectors of a Mesh, the pointer of a mapped
+// Buffer...
+// Nothing is copied so the memory must outlive whatever reads through it.
+struct StridedSource {
+  const uint8_t *trianglesBase;
+  uint32_t trianglesAmount;
+  uint32_t trianglesStride;
+  const uint8_t *verticesBase;
+  uint32_t verticesAmount;
+  uint32_t verticesStride;
+
+  StridedSource(uint32_t triangles_amount, const void *triangles_ptr,
+                uint32_t triangles_offset, uint32_t triangles_stride,
+                uint32_t vertices_amount, const void *vertice_ptr,
+                uint32_t vertices_offset, uint32_t vertices_stride)
+      : trianglesBase((const uint8_t *)triangles_ptr + triangles_offset),
+        trianglesAmount(triangles_amount), trianglesStride(triangles_stride),
+        verticesBase((const uint8_t *)vertice_ptr + vertices_offset),
+        verticesAmount(vertices_amount), verticesStride(vertices_stride) {}
+
+  StridedSource(const Mesh &m)
+      : StridedSource(m.getTriangles().size(), m.getTriangles().data(), 0,
+                      sizeof(Triangle), m.getVertices().size(),
+                      m.getVertices().data(), offsetof(Vertex, pos),
+                      sizeof(Vertex)) {}
+
+  uint32_t size() const { return trianglesAmount; }
+  Triangle triangle(uint32_t i) const {
+    assert(i < trianglesAmount);
+    return *(const Triangle *)(trianglesBase + i * trianglesStride);
+  }
+  Vector3f vertex(uint32_t i) const {
+    assert(i < verticesAmount);
+    return *(const Vector3f *)(verticesBase + i * verticesStride);
   }
 };
 
-// This class is subobtimal but does the job. Do not use for intensive
-// computations
-template <int nbElems> class BVH {
+// Source whose primitives are boxes, to build a BVH over other BVHs
+struct BoxSource {
+  std::span<const AABB> boxes;
+
+  uint32_t size() const { return boxes.size(); }
+  AABB box(uint32_t i) const { return boxes[i]; }
+};
+
+// Header of the files written by BVH::save, followed by the nodes and the
+// reordered triangle indices
+struct BVHCacheHeader {
+  // To bump whenever the layout of the file or of BVHNode changes
+  static constexpr uint32_t currentVersion = 2;
+
+  char magic[4];
+  uint32_t version;
+  uint32_t nbElems;
+  uint32_t nodeCount;
+  uint32_t indexCount;
+  float builtArea;
+  // Identity of the geometry given to save
+  uint64_t sourceKey;
+};
+
+// Bounding volume hierarchy over the triangles of a mesh, built top-down with
+// a binned surface area heuristic. nbElems is the maximum amount of triangles
+// a leaf can hold.
+//
+// Triangles and vertices are read through Source, which only needs size(),
+// triangle(i) and vertex(i) (or box(i) for primitives other than triangles,
+// traversed with traverse), and are never copied: the BVH
+// only owns its nodes and the reordered triangle indices. The memory behind
+// the source must stay valid as long as the BVH is queried.
+template <int nbElems, typename Source = StridedSource> class BVH {
+  static_assert(nbElems > 0, "A BVH leaf must hold at least one element");
+
 public:
+  // Amount of bins the centroids are sorted into when looking for a split
+  static constexpr int nbBins = 16;
+  // Cost of traversing a node relative to intersecting a triangle
+  static constexpr float traversalCost = 1.0f;
+  // Amount of rays traced together by castRays, 8 fills an AVX register
+  static constexpr int packetSize = 8;
+  // Bound on the depth of the tree, which sizes the traversal stack. Past half
+  // of it nodes are split at the object median, halving them at each level.
+  static constexpr int maxDepth = 64;
+
+  BVH(const Source &source) : source(source), indices(source.size()) {
+    build();
+  }
+
   BVH(uint32_t triangles_amount, const void *triangles_ptr,
       uint32_t triangles_offset, uint32_t triangles_stride,
       uint32_t vertices_amount, const void *vertice_ptr,
       uint32_t vertices_offset, uint32_t vertices_stride)
-      : boxes((triangles_amount + nbElems - 1) / nbElems),
-        triangles(triangles_amount), vertices(vertices_amount) {
-    const uint8_t *triangle_base = (const uint8_t *)triangles_ptr;
-    for (size_t i = 0; i < triangles_amount; i++)
-      triangles[i] = *(const Triangle *)(triangle_base + triangles_offset +
-                                         (i * triangles_stride));
-    const uint8_t *vertices_base = (const uint8_t *)vertice_ptr;
-    for (size_t i = 0; i < vertices_amount; i++)
-      vertices[i] = *(const Vector3f *)(vertices_base + vertices_offset +
-                                        (i * vertices_stride));
-    for (size_t i = 0; i < triangles.size(); i++) {
-      AABB<nbElems> &box = boxes[i / nbElems];
-      box.elems[i % nbElems] = i;
-    }
-    // Make sure coherent values for last aabb elems
-    if (triangles.size() % nbElems) {
-      for (size_t i = triangles.size() % nbElems; i < nbElems; i++)
-        boxes.back().elems[i] = boxes.back().elems[0];
-    }
-    const float inf = INFINITY;
-    for (size_t cur = boxes.size(); cur > 0; cur--) {
-      size_t boxi = cur - 1;
-      AABB<nbElems> &box = boxes[boxi];
-
-      Vector3f min = {inf, inf, inf};
-      Vector3f max = -min;
-      for (uint32_t tid : box.elems) {
-        const Triangle &t = triangles[tid];
-        for (uint32_t vid : t) {
-          min = min.cwiseMin(vertices[vid]);
-          max = max.cwiseMax(vertices[vid]);
+      : BVH(Source(triangles_amount, triangles_ptr, triangles_offset,
+                   triangles_stride, vertices_amount, vertice_ptr,
+                   vertices_offset, vertices_stride)) {}
+
+  BVH(const Mesh &m) : BVH(Source(m)) {}
+
+  // Closest hit query. The nearest child is visited first and any box entered
+  // further than the closest triangle found so far is skipped.
+  bool castRay(const Ray &ray, uint32_t *result,
+               float *distance = nullptr) const {
+    float dist = INFINITY;
+    traverse(ray, dist, [&](uint32_t tid, float &d) {
+      const Triangle t = source.triangle(tid);
+      if (!ray.intersects(source.vertex(t.x()), source.vertex(t.y()),
+                          source.vertex(t.z()), d))
+        return false;
+      *result = tid;
+      return true;
+    });
+    if (distance != nullptr)
+      *distance = dist;
+    return dist != INFINITY;
+  }
+
+  // Visit, nearest first, the primitives whose leaf the ray enters before
+  // dist. intersect(primitive, dist) tests one of them, lowering dist if it is
+  // hit closer. Returns true if dist was lowered.
+  template <typename Intersect>
+  bool traverse(const Ray &ray, float &dist, Intersect &&intersect) const {
+    std::span<const BVHNode> treeNodes = getNodes();
+    std::span<const uint32_t> treeIndices = getIndices();
+    if (treeNodes.empty())
+      return false;
+    const Vector3f invDir = ray.direction.cwiseInverse();
+    const float maxDist = dist;
+
+    struct Candidate {
+      uint32_t node;
+      float entry;
+    };
+    Candidate stack[maxDepth];
+    int top = 0;
+    float rootEntry = ray.entry(treeNodes[0].box, invDir, dist);
+    if (rootEntry != INFINITY)
+      stack[top++] = {0, rootEntry};
+
+    while (top > 0) {
+      Candidate cur = stack[--top];
+      if (cur.entry >= dist)
+        continue;
+      const BVHNode &node = treeNodes[cur.node];
+      if (node.isLeaf()) {
+        for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count;
+             i++)
+          intersect(treeIndices[i], dist);
+        continue;
+      }
+      Candidate near = {node.leftFirst,
+                        ray.entry(treeNodes[node.leftFirst].box, invDir, dist)};
+      Candidate far = {node.leftFirst + 1,
+                       ray.entry(treeNodes[node.leftFirst + 1].box, invDir, dist)};
+      if (far.entry < near.entry)
+        std::swap(near, far);
+      // Push the far child first so that the near one is popped next
+      if (far.entry != INFINITY)
+        stack[top++] = far;
+      if (near.entry != INFINITY)
+        stack[top++] = near;
+    }
+    return dist < maxDist;
+  }
+
+  // Trace a batch of rays, hits[i] receiving the closest hit of rays[i]. Rays
+  // are traced packetSize at a time with SIMD slab and triangle tests, which
+  // pays off when rays of a packet are coherent (neighbouring pixels, rays
+  // sharing an origin...). To spread a batch across cores, see
+  // kokkos/bvh_queries.hh.
+  void castRays(std::span<const Ray> rays, std::span<Hit> hits) const {
+    assert(hits.size() >= rays.size());
+    for (size_t first = 0; first < rays.size(); first += packetSize) {
+      size_t amount = std::min<size_t>(packetSize, rays.size() - first);
+      castPacket(rays.subspan(first, amount), hits.subspan(first, amount));
+    }
+  }
+
+  // Point of the surface closest to p, searched up to maxDist. Boxes are
+  // visited nearest first and skipped once further than the best point.
+  ClosestPoint closestPoint(const Vector3f &p,
+                            float maxDist = INFINITY) const {
+    ClosestPoint best;
+    float bestSq = maxDist * maxDist;
+    std::span<const BVHNode> treeNodes = getNodes();
+    std::span<const uint32_t> treeIndices = getIndices();
+    if (treeNodes.empty())
+      return best;
+
+    struct Candidate {
+      uint32_t node;
+      float distSq;
+    };
+    Candidate stack[maxDepth];
+    int top = 0;
+    float rootSq = treeNodes[0].box.distanceSquared(p);
+    if (rootSq < bestSq)
+      stack[top++] = {0, rootSq};
+
+    while (top > 0) {
+      Candidate cur = stack[--top];
+      if (cur.distSq >= bestSq)
+        continue;
+      const BVHNode &node = treeNodes[cur.node];
+      if (node.isLeaf()) {
+        for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count;
+             i++) {
+          const Triangle t = source.triangle(treeIndices[i]);
+          Vector3f q =
+              closestPointOnTriangle(p, source.vertex(t.x()),
+                                     source.vertex(t.y()), source.vertex(t.z()));
+          float distSq = (q - p).squaredNorm();
+          if (distSq < bestSq) {
+            bestSq = distSq;
+            best.triangle = treeIndices[i];
+            best.point = q;
+          }
         }
+        continue;
+      }
+      Candidate near = {node.leftFirst,
+                        treeNodes[node.leftFirst].box.distanceSquared(p)};
+      Candidate far = {node.leftFirst + 1,
+                       treeNodes[node.leftFirst + 1].box.distanceSquared(p)};
+      if (far.distSq < near.distSq)
+        std::swap(near, far);
+      if (far.distSq < bestSq)
+        stack[top++] = far;
+      if (near.distSq < bestSq)
+        stack[top++] = near;
+    }
+    if (best.valid())
+      best.distance = sqrtf(bestSq);
+    return best;
+  }
+
+  // Unsigned distance from p to the surface, INFINITY past maxDist
+  float distance(const Vector3f &p, float maxDist = INFINITY) const {
+    return closestPoint(p, maxDist).distance;
+  }
+
+  // Call f(triangle) for every triangle closer than radius to center
+  template <typename F>
+  void forEachInSphere(const Vector3f &center, float radius, F &&f) const {
+    float radiusSq = radius * radius;
+    visitOverlaps(
+        [&](const AABB &box) {
+          return box.distanceSquared(center) <= radiusSq;
+        },
+        [&](uint32_t tid) {
+          const Triangle t = source.triangle(tid);
+          Vector3f q = closestPointOnTriangle(center, source.vertex(t.x()),
+                                              source.vertex(t.y()),
+                                              source.vertex(t.z()));
+          if ((q - center).squaredNorm() <= radiusSq)
+            f(tid);
+        });
+  }
+
+  // Call f(triangle) for every triangle whose bounds overlap box. This is a
+  // broad phase: a triangle only passing near a corner of the box can be
+  // reported without touching it.
+  template <typename F> void forEachInBox(const AABB &box, F &&f) const {
+    visitOverlaps([&](const AABB &b) { return b.overlaps(box); },
+                  [&](uint32_t tid) {
+                    if (primitiveBox(tid).overlaps(box))
+                      f(tid);
+                  });
+  }
+
+  // Update the bounds for moved vertices without changing the tree: the
+  // leaves are refitted from the vertices currently behind the source, then
+  // the internal nodes in a single bottom-up pass. The topology must be the
+  // same as the one the BVH was built with. Since the tree degrades as
+  // vertices move away from where they were at build time, it is rebuilt
+  // instead once the total surface area of its nodes grows over maxAreaGrowth
+  // times the one of the last build.
+  // Returns true if the tree was rebuilt.
+  bool refit(float maxAreaGrowth = INFINITY) {
+    return refitWith(maxAreaGrowth, [](size_t n, const auto &f) {
+      for (size_t i = 0; i < n; i++)
+        f(i);
+    });
+  }
+
+  // Same, reading the vertices from a new place (the next frame's buffer...)
+  bool refit(const Source &source, float maxAreaGrowth = INFINITY) {
+    assert(source.size() == this->source.size());
+    this->source = source;
+    return refit(maxAreaGrowth);
+  }
+
+  // refit, the leaves being refitted by forEach(n, f), which calls f(i) for
+  // every i in [0, n) in any order and may do so in parallel (see the Kokkos
+  // refit in kokkos/bvh_queries.hh)
+  template <typename ForEach>
+  bool refitWith(const Source &source, float maxAreaGrowth,
+                 const ForEach &forEach) {
+    assert(source.size() == this->source.size());
+    this->source = source;
+    return refitWith(maxAreaGrowth, forEach);
+  }
+  template <typename ForEach>
+  bool refitWith(float maxAreaGrowth, const ForEach &forEach) {
+    detach();
+    if (nodes.empty())
+      return false;
+    forEach(nodes.size(), [this](size_t i) {
+      if (nodes[i].isLeaf())
+        updateBounds(i);
+    });
+    // Children are always stored after their parent
+    for (size_t i = nodes.size(); i-- > 0;) {
+      BVHNode &node = nodes[i];
+      if (!node.isLeaf()) {
+        node.box = nodes[node.leftFirst].box;
+        node.box.grow(nodes[node.leftFirst + 1].box);
       }
-      auto left_i = boxi * 2 + 1;
-      auto right_i = boxi * 2 + 2;
-      if (left_i < boxes.size()) {
-        min = min.cwiseMin(boxes[left_i].min);
-        max = max.cwiseMax(boxes[left_i].max);
+    }
+    if (maxAreaGrowth == INFINITY || totalArea() <= builtArea * maxAreaGrowth)
+      return false;
+    build();
+    return true;
+  }
+
+  // Sum of the surface area of every node, the SAH cost of the tree up to a
+  // constant factor
+  float totalArea() const {
+    float area = 0;
+    for (const BVHNode &node : getNodes())
+      area += node.box.area();
+    return area;
+  }
+
+  // Write the tree to path, tagged with sourceKey so that it is only loaded
+  // back for the same geometry. The key is anything cheap that changes with
+  // the geometry, such as MeshUtils::importKey of the file it was read from:
+  // hashing the triangles themselves would cost about as much as a build.
+  //   uint64_t key = MeshUtils::importKey(path);
+  //   Mesh m = MeshUtils::loadCached(path);
+  //   std::optional<BVH<4>> bvh = BVH<4>::load(bvhPath, StridedSource(m), key);
+  //   if (!bvh)
+  //     BVH<4>(m).save(bvhPath, key);
+  void save(const std::string &path, uint64_t sourceKey) const {
+    std::span<const BVHNode> treeNodes = getNodes();
+    std::span<const uint32_t> treeIndices = getIndices();
+    BVHCacheHeader header = {{'F', 'B', 'V', 'H'},
+                             BVHCacheHeader::currentVersion,
+                             nbElems,
+                             (uint32_t)treeNodes.size(),
+                             (uint32_t)treeIndices.size(),
+                             builtArea,
+                             sourceKey};
+    // Written aside and renamed so that a reader never maps a partial file
+    std::string tmpPath = path + ".tmp";
+    {
+      std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+      CHECK(file.good(), "Could not write the BVH cache " + tmpPath);
+      file.write((const char *)&header, sizeof(header));
+      file.write((const char *)treeNodes.data(), treeNodes.size_bytes());
+      file.write((const char *)treeIndices.data(), treeIndices.size_bytes());
+      CHECK(file.good(), "Could not write the BVH cache " + tmpPath);
+    }
+    std::filesystem::rename(tmpPath, path);
+  }
+
+  // Map a tree written by save. The nodes and indices are used in place from
+  // the mapping, nothing is parsed or copied. Returns nothing if the file is
+  // missing, from another version, or was saved for another sourceKey.
+  static std::optional<BVH> load(const std::string &path, const Source &source,
+                                 uint64_t sourceKey) {
+    if (!std::filesystem::exists(path))
+      return std::nullopt;
+    auto file = std::make_shared<const MappedFile>(path);
+    if (file->size() < sizeof(BVHCacheHeader))
+      return std::nullopt;
+    const BVHCacheHeader &header = *(const BVHCacheHeader *)file->data();
+    size_t expectedSize = sizeof(BVHCacheHeader) +
+                          header.nodeCount * sizeof(BVHNode) +
+                          header.indexCount * sizeof(uint32_t);
+    if (memcmp(header.magic, "FBVH", 4) != 0 ||
+        header.version != BVHCacheHeader::currentVersion ||
+        header.nbElems != nbElems || header.indexCount != source.size() ||
+        file->size() != expectedSize || header.sourceKey != sourceKey)
+      return std::nullopt;
+    return BVH(source, file);
+  }
+
+  std::span<const BVHNode> getNodes() const {
+    return mapping ? mappedNodes : std::span<const BVHNode>(nodes);
+  }
+  std::span<const uint32_t> getIndices() const {
+    return mapping ? mappedIndices : std::span<const uint32_t>(indices);
+  }
+  const Source &getSource() const { return source; }
+
+private:
+  struct Bin {
+    AABB box;
+    uint32_t count = 0;
+  };
+
+  struct Split {
+    int axis = -1;
+    int bin = 0;
+    float cost = INFINITY;
+  };
+
+  Source source;
+  std::vector<BVHNode> nodes;
+  // Triangle indices reordered so that every leaf covers a contiguous range
+  std::vector<uint32_t> indices;
+  std::vector<Vector3f> centroids;
+  // Total node area right after the last build, the reference for refits
+  float builtArea = 0;
+  // File the tree was loaded from, if any. The vectors above are then empty
+  // and the tree lives in the mapping.
+  std::shared_ptr<const MappedFile> mapping;
+  std::span<const BVHNode> mappedNodes;
+  std::span<const uint32_t> mappedIndices;
+
+  BVH(const Source &source, std::shared_ptr<const MappedFile> file)
+      : source(source), mapping(file) {
+    const BVHCacheHeader &header = *(const BVHCacheHeader *)file->data();
+    const uint8_t *data = file->data() + sizeof(BVHCacheHeader);
+    mappedNodes = {(const BVHNode *)data, header.nodeCount};
+    data += header.nodeCount * sizeof(BVHNode);
+    mappedIndices = {(const uint32_t *)data, header.indexCount};
+    builtArea = header.builtArea;
+  }
+
+  // Copy a mapped tree out of its file before modifying it
+  void detach() {
+    if (!mapping)
+      return;
+    nodes.assign(mappedNodes.begin(), mappedNodes.end());
+    indices.assign(mappedIndices.begin(), mappedIndices.end());
+    mapping.reset();
+    mappedNodes = {};
+    mappedIndices = {};
+  }
+
+  using Lanes = Eigen::Array<float, packetSize, 1>;
+  using Mask = Eigen::Array<bool, packetSize, 1>;
+
+  // Rays of a packet stored as structure of arrays, one lane per ray
+  struct Packet {
+    Lanes origin[3];
+    Lanes direction[3];
+    Lanes invDir[3];
+    Mask cull;
+  };
+
+  // Distance at which each ray enters the box, or INFINITY for those missing
+  // it or reaching it past their current closest hit
+  static Lanes packetEntry(const AABB &box, const Packet &p,
+                           const Lanes &dist) {
+    Lanes tmin = Lanes::Zero();
+    Lanes tmax = dist;
+    for (int axis = 0; axis < 3; axis++) {
+      Lanes t1 = (box.min[axis] - p.origin[axis]) * p.invDir[axis];
+      Lanes t2 = (box.max[axis] - p.origin[axis]) * p.invDir[axis];
+      tmin = tmin.max(t1.min(t2));
+      tmax = tmax.min(t1.max(t2));
+    }
+    return (tmin <= tmax && tmin < dist).select(tmin, Lanes::Constant(INFINITY));
+  }
+
+  // Möller–Trumbore test of one triangle against every ray of the packet
+  void intersectPacket(uint32_t tid, const Packet &p, Lanes &dist,
+                       std::span<Hit> hits) const {
+    const float EPSILON = 0.0000001f;
+    const Triangle t = source.triangle(tid);
+    const Vector3f v0 = source.vertex(t.x());
+    const Vector3f edge1 = source.vertex(t.y()) - v0;
+    const Vector3f edge2 = source.vertex(t.z()) - v0;
+    const Lanes *d = p.direction;
+
+    Lanes pvec[3] = {d[1] * edge2.z() - d[2] * edge2.y(),
+                     d[2] * edge2.x() - d[0] * edge2.z(),
+                     d[0] * edge2.y() - d[1] * edge2.x()};
+    Lanes det = edge1.x() * pvec[0] + edge1.y() * pvec[1] + edge1.z() * pvec[2];
+    Mask valid = p.cull.select(det >= EPSILON, det.abs() >= EPSILON);
+    if (!valid.any())
+      return;
+    Lanes invDet = det.inverse();
+
+    Lanes tvec[3] = {p.origin[0] - v0.x(), p.origin[1] - v0.y(),
+                     p.origin[2] - v0.z()};
+    Lanes u = (tvec[0] * pvec[0] + tvec[1] * pvec[1] + tvec[2] * pvec[2]) *
+              invDet;
+    Lanes qvec[3] = {tvec[1] * edge1.z() - tvec[2] * edge1.y(),
+                     tvec[2] * edge1.x() - tvec[0] * edge1.z(),
+                     tvec[0] * edge1.y() - tvec[1] * edge1.x()};
+    Lanes v = (d[0] * qvec[0] + d[1] * qvec[1] + d[2] * qvec[2]) * invDet;
+    Lanes dst =
+        (edge2.x() * qvec[0] + edge2.y() * qvec[1] + edge2.z() * qvec[2]) *
+        invDet;
+    valid = valid && u >= 0.0f && u <= 1.0f && v >= 0.0f && u + v <= 1.0f &&
+            dst > EPSILON && dst < dist;
+    dist = valid.select(dst, dist);
+    for (size_t i = 0; i < hits.size(); i++)
+      if (valid[i])
+        hits[i].triangle = tid;
+  }
+
+  // The packet goes down the tree as a whole, visiting every node entered by
+  // at least one of its rays
+  void castPacket(std::span<const Ray> rays, std::span<Hit> hits) const {
+    // Unused lanes start with a closest hit at 0 so they never enter a box
+    Packet p;
+    Lanes dist = Lanes::Zero();
+    for (int axis = 0; axis < 3; axis++) {
+      p.origin[axis].setZero();
+      p.direction[axis].setOnes();
+    }
+    p.cull.setConstant(false);
+    for (size_t i = 0; i < rays.size(); i++) {
+      for (int axis = 0; axis < 3; axis++) {
+        p.origin[axis][i] = rays[i].origin[axis];
+        p.direction[axis][i] = rays[i].direction[axis];
       }
-      if (right_i < boxes.size()) {
-        min = min.cwiseMin(boxes[right_i].min);
-        max = max.cwiseMax(boxes[right_i].max);
+      p.cull[i] = rays[i].cull;
+      dist[i] = INFINITY;
+      hits[i] = Hit();
+    }
+    for (int axis = 0; axis < 3; axis++)
+      p.invDir[axis] = p.direction[axis].inverse();
+    std::span<const BVHNode> treeNodes = getNodes();
+    std::span<const uint32_t> treeIndices = getIndices();
+    if (treeNodes.empty())
+      return;
+
+    struct Candidate {
+      uint32_t node;
+      float entry; // closest entry among the rays of the packet
+    };
+    Candidate stack[maxDepth];
+    int top = 0;
+    float rootEntry = packetEntry(treeNodes[0].box, p, dist).minCoeff();
+    if (rootEntry != INFINITY)
+      stack[top++] = {0, rootEntry};
+
+    while (top > 0) {
+      Candidate cur = stack[--top];
+      if (cur.entry >= dist.maxCoeff())
+        continue;
+      const BVHNode &node = treeNodes[cur.node];
+      if (node.isLeaf()) {
+        for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+          intersectPacket(treeIndices[i], p, dist, hits);
+        continue;
       }
-      box.min = min;
-      box.max = max;
+      Candidate near = {
+          node.leftFirst,
+          packetEntry(treeNodes[node.leftFirst].box, p, dist).minCoeff()};
+      Candidate far = {
+          node.leftFirst + 1,
+          packetEntry(treeNodes[node.leftFirst + 1].box, p, dist).minCoeff()};
+      if (far.entry < near.entry)
+        std::swap(near, far);
+      if (far.entry != INFINITY)
+        stack[top++] = far;
+      if (near.entry != INFINITY)
+        stack[top++] = near;
     }
+    for (size_t i = 0; i < hits.size(); i++)
+      if (hits[i].valid())
+        hits[i].distance = dist[i];
   }
 
-  BVH(const Mesh &m)
-      : BVH(m.getTriangles().size(), m.getTriangles().data(), 0,
-            sizeof(Triangle), m.getVertices().size(), m.getVertices().data(),
-            offsetof(Vertex, pos), sizeof(Vertex)) {};
+  // Depth first walk through the nodes whose box passes overlaps, calling
+  // visit on the primitives of the leaves reached
+  template <typename Overlaps, typename Visit>
+  void visitOverlaps(Overlaps &&overlaps, Visit &&visit) const {
+    std::span<const BVHNode> treeNodes = getNodes();
+    std::span<const uint32_t> treeIndices = getIndices();
+    if (treeNodes.empty() || !overlaps(treeNodes[0].box))
+      return;
+    uint32_t stack[maxDepth];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const BVHNode &node = treeNodes[stack[--top]];
+      if (node.isLeaf()) {
+        for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+          visit(treeIndices[i]);
+        continue;
+      }
+      for (uint32_t child : {node.leftFirst + 1, node.leftFirst})
+        if (overlaps(treeNodes[child].box))
+          stack[top++] = child;
+    }
+  }
 
-  bool castRay(const Ray &ray, uint32_t *result) {
-    std::queue<uint32_t> candidates;
-    candidates.push(0);
-    float dist = INFINITY;
+  // Sources can give the bounds of their primitives directly, otherwise they
+  // are triangles
+  AABB primitiveBox(uint32_t id) const {
+    if constexpr (requires { source.box(id); }) {
+      return source.box(id);
+    } else {
+      AABB box;
+      for (uint32_t vid : source.triangle(id))
+        box.grow(source.vertex(vid));
+      return box;
+    }
+  }
+
+  Vector3f primitiveCentroid(uint32_t id) const {
+    if constexpr (requires { source.box(id); }) {
+      AABB box = source.box(id);
+      return (box.min + box.max) / 2;
+    } else {
+      const Triangle t = source.triangle(id);
+      return (source.vertex(t.x()) + source.vertex(t.y()) +
+              source.vertex(t.z())) /
+             3;
+    }
+  }
+
+  void build() {
+    nodes.clear();
+    uint32_t n = source.size();
+    if (n == 0)
+      return;
+    centroids.resize(n);
+    for (uint32_t i = 0; i < n; i++) {
+      indices[i] = i;
+      centroids[i] = primitiveCentroid(i);
+    }
+    // A binary tree with n leaves at most has 2n - 1 nodes
+    nodes.reserve(2 * n - 1);
+    nodes.push_back({AABB(), 0, n});
+
+    // Node and depth of the nodes left to split
+    std::stack<std::pair<uint32_t, int>> toSplit;
+    toSplit.push({0, 1});
+    while (!toSplit.empty()) {
+      auto [cur, depth] = toSplit.top();
+      toSplit.pop();
+      updateBounds(cur);
+      if (subdivide(cur, depth >= maxDepth / 2)) {
+        toSplit.push({nodes[cur].leftFirst, depth + 1});
+        toSplit.push({nodes[cur].leftFirst + 1, depth + 1});
+      }
+    }
+    nodes.shrink_to_fit();
+    builtArea = totalArea();
+    centroids.clear();
+    centroids.shrink_to_fit();
+  }
 
-    while (!candidates.empty()) {
-      uint32_t cur = candidates.front();
-      candidates.pop();
-      AABB<nbElems> &box = boxes[cur];
-      if (ray.intersects(box)) {
-        for (uint32_t elem : box.elems) {
-          const Triangle &t = triangles[elem];
-          const Vector3f &v1 = vertices[t.x()];
-          const Vector3f &v2 = vertices[t.y()];
-          const Vector3f &v3 = vertices[t.z()];
-          if (ray.intersects(v1, v2, v3, dist))
-            *result = elem;
+  void updateBounds(uint32_t nodeId) {
+    BVHNode &node = nodes[nodeId];
+    node.box = AABB();
+    for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+      node.box.grow(primitiveBox(indices[i]));
+  }
+
+  Split findBestSplit(const BVHNode &node, const AABB &centroidBox) const {
+    Split best;
+    for (int axis = 0; axis < 3; axis++) {
+      float boundsMin = centroidBox.min[axis];
+      float boundsMax = centroidBox.max[axis];
+      if (boundsMax <= boundsMin)
+        continue;
+      Bin bins[nbBins];
+      float scale = nbBins / (boundsMax - boundsMin);
+      for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+        uint32_t tid = indices[i];
+        int b = std::min(nbBins - 1,
+                         (int)((centroids[tid][axis] - boundsMin) * scale));
+        bins[b].count++;
+        bins[b].box.grow(primitiveBox(tid));
+      }
+      // Sweep from both sides to get the cost of every split plane
+      float leftArea[nbBins - 1], rightArea[nbBins - 1];
+      uint32_t leftCount[nbBins - 1], rightCount[nbBins - 1];
+      AABB leftBox, rightBox;
+      uint32_t leftSum = 0, rightSum = 0;
+      for (int i = 0; i < nbBins - 1; i++) {
+        leftSum += bins[i].count;
+        leftCount[i] = leftSum;
+        leftBox.grow(bins[i].box);
+        leftArea[i] = leftBox.area();
+        rightSum += bins[nbBins - 1 - i].count;
+        rightCount[nbBins - 2 - i] = rightSum;
+        rightBox.grow(bins[nbBins - 1 - i].box);
+        rightArea[nbBins - 2 - i] = rightBox.area();
+      }
+      for (int i = 0; i < nbBins - 1; i++) {
+        if (leftCount[i] == 0 || rightCount[i] == 0)
+          continue;
+        float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+        if (cost < best.cost) {
+          best.axis = axis;
+          best.bin = i;
+          best.cost = cost;
         }
-        uint32_t left = 2 * cur + 1;
-        uint32_t right = 2 * cur + 2;
-        if (left < boxes.size())
-          candidates.push(left);
-        if (right < boxes.size())
-          candidates.push(right);
       }
     }
-    return dist != INFINITY;
+    return best;
   }
 
-private:
-  std::vector<AABB<nbElems>> boxes;
-  std::vector<Triangle> triangles;
-  std::vector<Vector3f> vertices;
+  // Split the node in two children, returns false if it stays a leaf
+  bool subdivide(uint32_t nodeId, bool forceMedian) {
+    BVHNode node = nodes[nodeId];
+    if (node.count <= 1)
+      return false;
+    if (forceMedian) {
+      if (node.count <= (uint32_t)nbElems)
+        return false;
+      splitNode(nodeId, node.count / 2);
+      return true;
+    }
+
+    AABB centroidBox;
+    for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+      centroidBox.grow(centroids[indices[i]]);
+
+    Split split = findBestSplit(node, centroidBox);
+    float leafCost = node.count * node.box.area();
+    float splitCost = traversalCost * node.box.area() + split.cost;
+    if (node.count <= (uint32_t)nbElems &&
+        (split.axis == -1 || splitCost >= leafCost))
+      return false;
+
+    auto first = indices.begin() + node.leftFirst;
+    auto last = first + node.count;
+    auto middle = first;
+    if (split.axis != -1) {
+      float boundsMin = centroidBox.min[split.axis];
+      float scale =
+          nbBins / (centroidBox.max[split.axis] - centroidBox.min[split.axis]);
+      middle = std::partition(first, last, [&](uint32_t tid) {
+        int b = std::min(nbBins - 1,
+                         (int)((centroids[tid][split.axis] - boundsMin) *
+                               scale));
+        return b <= split.bin;
+      });
+    }
+    // Every centroid is at the same place, only the leaf size forces a split
+    if (middle == first || middle == last)
+      middle = first + node.count / 2;
+    splitNode(nodeId, middle - first);
+    return true;
+  }
+
+  // Turn the node into an internal one whose left child holds its first
+  // leftCount primitives
+  void splitNode(uint32_t nodeId, uint32_t leftCount) {
+    BVHNode node = nodes[nodeId];
+    uint32_t leftChild = nodes.size();
+    nodes.push_back({AABB(), node.leftFirst, leftCount});
+    nodes.push_back(
+        {AABB(), node.leftFirst + leftCount, node.count - leftCount});
+    nodes[nodeId].leftFirst = leftChild;
+    nodes[nodeId].count = 0;
+  }
 };
 }; // namespace Flim
@@ -0,0 +1,114 @@
+#include "gpu_bvh.hh"
+#include "utils/checks.hh"
+#include "vulkan/context.hh"
+#include <cstring>
+#include <type_traits>
+#include <vulkan/vulkan_core.h>
+
+namespace Flim {
+
+void GPUBVH::attach(ComputeParams &params) {
+  CHECK(!uploads->nodes.empty(), "Cannot trace rays against an empty BVH");
+  CHECK(!uploads->rays.empty(), "Please provide at least one ray to trace");
+  if (params.shader.code.empty())
+    params.shader = Shader("shaders/bvh_traversal.comp.spv");
+
+  // The BVH is copied once, when the graphics are loaded
+  auto setStorage = [&](int binding, auto member,
+                        VkFormat format) -> AttributeDescriptor & {
+    using T = typename std::decay_t<decltype((*uploads).*member)>::value_type;
+    return params.setAttribute(binding)
+        .attach<T>(((*uploads).*member).size(),
+                   [up = uploads, member](T *data) {
+                     const std::vector<T> &values = (*up).*member;
+                     memcpy((void *)data, values.data(),
+                            values.size() * sizeof(T));
+                   })
+        .add(0, format)
+        .onlySetup(true)
+        .computeFriendly(true)
+        .singleBuffered(true);
+  };
+
+  setStorage(0, &Uploads::nodes, VK_FORMAT_R32G32B32A32_SFLOAT);
+  setStorage(1, &Uploads::indices, VK_FORMAT_R32_UINT);
+  setStorage(2, &Uploads::triangles, VK_FORMAT_R32G32B32A32_UINT);
+  setStorage(3, &Uploads::vertices, VK_FORMAT_R32G32B32A32_SFLOAT);
+
+  // The rays may change every frame, the buffer of a frame is written again
+  // when it is older than the last rays given
+  params.setAttribute(4)
+      .attach<GPURay>(uploads->rays.size(),
+                      [up = uploads](GPURay *data) {
+                        const int copy =
+                            context.currentImage % MAX_FRAMES_IN_FLIGHT;
+                        // The last dispatch of the frame traced these
+                        up->tracedVersion[copy] = up->writtenVersion[copy];
+                        if (up->writtenVersion[copy] == up->raysVersion)
+                          return;
+                        memcpy((void *)data, up->rays.data(),
+                               up->rays.size() * sizeof(GPURay));
+                        up->writtenVersion[copy] = up->raysVersion;
+                      })
+      .add(0, VK_FORMAT_R32G32B32A32_SFLOAT)
+      .computeFriendly(true)
+      // Written by the host every frame the rays change
+      .residency(AttributeResidency::MAPPABLE_DEVICE);
+  rays = params.getAttributeDescriptors().at(4);
+
+  std::vector<GPUHit> misses(uploads->rays.size(), {UINT32_MAX, INFINITY});
+  params.setAttribute(5)
+      .attach<GPUHit>(misses.size(),
+                      [misses](GPUHit *data) {
+                        memcpy((void *)data, misses.data(),
+                               misses.size() * sizeof(GPUHit));
+                      })
+      .add(0, VK_FORMAT_R32G32_UINT)
+      .onlySetup(true)
+      .computeFriendly(true)
+      // Read back by the host, one copy per frame so that the dispatch of a
+      // frame never overwrites hits still to be read
+      .residency(AttributeResidency::HOST);
+  hits = params.getAttributeDescriptors().at(5);
+}
+
+int GPUBVH::dispatchSize() const {
+  return (rayCount() + groupSize - 1) / groupSize;
+}
+
+void GPUBVH::toGPURays(std::span<const Ray> rays, GPURay *out) const {
+  for (size_t i = 0; i < rays.size(); i++) {
+    out[i].origin << rays[i].origin, uploads->maxDist;
+    out[i].direction << rays[i].direction, rays[i].cull ? 1.0f : 0.0f;
+  }
+}
+
+uint64_t GPUBVH::setRays(std::span<const Ray> rays) {
+  CHECK(rays.size() == rayCount(),
+        "Please give as many rays as when the BVH was created");
+  Uploads &up = *uploads;
+  toGPURays(rays, up.rays.data());
+  up.raysVersion++;
+  // The buffers only exist once the computer has been updated once
+  const int copy = context.currentImage % MAX_FRAMES_IN_FLIGHT;
+  if (this->rays == nullptr || up.writtenVersion[copy] == 0)
+    return up.raysVersion;
+  memcpy(this->rays->getBuffer()->getPtr(), up.rays.data(),
+         up.rays.size() * sizeof(GPURay));
+  up.writtenVersion[copy] = up.raysVersion;
+  return up.raysVersion;
+}
+
+std::vector<Hit> GPUBVH::readHits(uint64_t *raysVersion) const {
+  CHECK(hits != nullptr, "Please attach the BVH to compute parameters first");
+  const int copy = context.currentImage % MAX_FRAMES_IN_FLIGHT;
+  if (raysVersion != nullptr)
+    *raysVersion = uploads->tracedVersion[copy];
+  auto buffer = hits->getBuffer();
+  buffer->map();
+  std::vector<Hit> ret(rayCount());
+  memcpy((void *)ret.data(), buffer->getPtr(), ret.size() * sizeof(Hit));
+  return ret;
+}
+
+}; // namespace Flim
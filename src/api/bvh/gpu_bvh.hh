@@ -0,0 +1,138 @@
+#pragma once
+
+#include "api/bvh/bvh.hh"
+#include "api/parameters/compute_params.hh"
+#include "consts.hh"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace Flim {
+
+// Layouts shared with shaders/bvh_traversal.comp (std430)
+struct alignas(16) GPUBVHNode {
+  float min[3];
+  uint32_t leftFirst;
+  float max[3];
+  uint32_t count;
+};
+static_assert(sizeof(GPUBVHNode) == 32);
+
+struct GPURay {
+  Vector4f origin;    // w: maximum distance of a hit
+  Vector4f direction; // w: 1 to cull back faces, 0 otherwise
+};
+static_assert(sizeof(GPURay) == 32);
+
+struct GPUHit {
+  uint32_t triangle;
+  float distance;
+};
+static_assert(sizeof(GPUHit) == sizeof(Hit));
+
+// Traces a batch of rays against a BVH in a compute shader, without any ray
+// tracing extension. The flattened nodes and primitives are uploaded once as
+// storage buffers at bindings 0 to 3. The rays at binding 4 have one host
+// visible copy per frame in flight, so that they can be replaced every frame
+// with setRays, and the closest hits are written at binding 5, also with one
+// copy per frame in flight, each time the computer is dispatched.
+//
+//   ComputeParams traceParams("BVH traversal");
+//   GPUBVH gpuBvh(bvh, rays);
+//   gpuBvh.attach(traceParams);
+//   scene.registerComputer(traceParams, gpuBvh.dispatchSize(), 1, 1);
+//   ...
+//   uint64_t version = gpuBvh.setRays(nextRays); // from the frame callback
+//   ...
+//   uint64_t traced;
+//   std::vector<Hit> hits = gpuBvh.readHits(&traced); // a later callback
+//   if (traced == version)
+//     ...
+class GPUBVH {
+public:
+  // Invocations per workgroup, local_size_x of the kernel
+  static constexpr int groupSize = 64;
+
+  template <int nbElems, typename Source>
+  GPUBVH(const BVH<nbElems, Source> &bvh, std::span<const Ray> rays,
+         float maxDist = INFINITY)
+      : uploads(std::make_shared<Uploads>()) {
+    Uploads &up = *uploads;
+    const Source &source = bvh.getSource();
+
+    for (const BVHNode &node : bvh.getNodes())
+      up.nodes.push_back({{node.box.min.x(), node.box.min.y(),
+                           node.box.min.z()},
+                          node.leftFirst,
+                          {node.box.max.x(), node.box.max.y(),
+                           node.box.max.z()},
+                          node.count});
+
+    // Triangles are stored in leaf order, so that leaves read them
+    // contiguously, the indices give back their id in the source
+    std::span<const uint32_t> indices = bvh.getIndices();
+    up.indices.assign(indices.begin(), indices.end());
+    up.triangles.reserve(indices.size());
+    uint32_t nbVertices = 0;
+    for (uint32_t tid : indices) {
+      const Triangle t = source.triangle(tid);
+      up.triangles.push_back(Vector4<uint32_t>(t.x(), t.y(), t.z(), 0));
+      nbVertices = std::max(nbVertices, t.maxCoeff() + 1);
+    }
+    up.vertices.resize(nbVertices);
+    for (uint32_t i = 0; i < nbVertices; i++)
+      up.vertices[i] = source.vertex(i).homogeneous();
+
+    up.maxDist = maxDist;
+    up.rays.resize(rays.size());
+    toGPURays(rays, up.rays.data());
+  }
+
+  // Declare the buffers on the parameters of the compute shader, which
+  // default to the bundled traversal kernel
+  void attach(ComputeParams &params);
+
+  // Amount of workgroups to dispatch along x to trace every ray
+  int dispatchSize() const;
+  size_t rayCount() const { return uploads->rays.size(); }
+
+  // Replace the rays traced by the next dispatches, as many as given to the
+  // constructor. Called from the frame callback, the copy of the current
+  // frame is written right away and traced by its dispatch, the other copies
+  // are brought up to date when their frame comes. Returns the version of
+  // these rays, as given back by readHits.
+  uint64_t setRays(std::span<const Ray> rays);
+
+  // Closest hits traced by the last frame that used the copy of the current
+  // one, whose fence was waited for before the frame callback this is called
+  // from. raysVersion receives the version of the rays they were traced for,
+  // 0 if that frame traced none yet.
+  std::vector<Hit> readHits(uint64_t *raysVersion = nullptr) const;
+
+private:
+  struct Uploads {
+    std::vector<GPUBVHNode> nodes;
+    std::vector<uint32_t> indices;
+    std::vector<Vector4<uint32_t>> triangles;
+    std::vector<Vector4f> vertices;
+    std::vector<GPURay> rays;
+    float maxDist;
+    // Version of the rays, bumped by setRays, and the one held by the buffer
+    // of each frame (0 before its first update)
+    uint64_t raysVersion = 1;
+    std::array<uint64_t, MAX_FRAMES_IN_FLIGHT> writtenVersion{};
+    // Version of the rays the hits of each frame were traced for, recorded
+    // before the buffer of the frame gets its next rays
+    std::array<uint64_t, MAX_FRAMES_IN_FLIGHT> tracedVersion{};
+  };
+  void toGPURays(std::span<const Ray> rays, GPURay *out) const;
+  // Shared with the update functions of the attributes, which run when the
+  // graphics are loaded
+  std::shared_ptr<Uploads> uploads;
+  std::shared_ptr<AttributeDescriptor> rays;
+  std::shared_ptr<AttributeDescriptor> hits;
+};
+
+}; // namespace Flim
@@ -0,0 +1,95 @@
+#include "scene_bvh.hh"
+#include "api/scene.hh"
+
+namespace Flim {
+
+// The coarser levels of detail are appended to the same triangles and would
+// be hit along with the finest one
+static MeshLOD finestLevel(const Mesh &mesh) {
+  if (!mesh.lods.empty())
+    return mesh.lods[0];
+  return {0, static_cast<uint32_t>(mesh.triangles.size()), 0.0f};
+}
+
+SceneBVH::SceneBVH(const Scene &scene) : scene(scene) { update(); }
+
+void SceneBVH::rebuild() {
+  meshes.clear();
+  update();
+}
+
+void SceneBVH::update() {
+  entries.clear();
+  boxes.clear();
+  for (auto &[id, renderer] : scene.renderers) {
+    const Mesh &mesh = renderer->mesh;
+    const MeshLOD finest = finestLevel(mesh);
+    auto blas = meshes.find(id);
+    if (blas == meshes.end())
+      blas = meshes
+                 .emplace(id, std::make_unique<MeshBVH>(StridedSource(
+                                  finest.triangleCount,
+                                  mesh.triangles.data() + finest.firstTriangle,
+                                  0, sizeof(Triangle), mesh.vertices.size(),
+                                  mesh.vertices.data(), offsetof(Vertex, pos),
+                                  sizeof(Vertex))))
+                 .first;
+    if (blas->second->getNodes().empty())
+      continue;
+    const AABB &local = blas->second->getNodes()[0].box;
+
+    // Same matrices as the ones given to the vertex shader
+    Matrix4f meshToWorld = mesh.transform.getViewMatrix();
+    for (const Instance &instance : mesh.instances) {
+      Matrix4f toWorld = meshToWorld * instance.transform.getViewMatrix();
+      AABB box;
+      for (int corner = 0; corner < 8; corner++) {
+        Vector3f p((corner & 1) ? local.max.x() : local.min.x(),
+                   (corner & 2) ? local.max.y() : local.min.y(),
+                   (corner & 4) ? local.max.z() : local.min.z());
+        box.grow((toWorld * p.homogeneous()).head<3>());
+      }
+      entries.push_back({&instance, blas->second.get(), finest.firstTriangle,
+                         toWorld.inverse()});
+      boxes.push_back(box);
+    }
+  }
+  top = std::make_unique<BVH<2, BoxSource>>(BoxSource{boxes});
+}
+
+bool SceneBVH::castRay(const Ray &ray, SceneHit *hit) const {
+  float dist = INFINITY;
+  top->traverse(ray, dist, [&](uint32_t id, float &d) {
+    const Entry &entry = entries[id];
+    // The direction is not normalized, so distances along the local ray are
+    // the same as along the world one
+    Ray local = {
+        .origin = (entry.worldToInstance * ray.origin.homogeneous()).head<3>(),
+        .direction = entry.worldToInstance.topLeftCorner<3, 3>() * ray.direction,
+        .cull = ray.cull,
+    };
+    uint32_t triangle = UINT32_MAX;
+    if (!entry.bvh->traverse(local, d, [&](uint32_t tid, float &td) {
+          tid += entry.firstTriangle;
+          const Triangle &t = entry.instance->mesh.triangles[tid];
+          const auto &v = entry.instance->mesh.vertices;
+          if (!local.intersects(v[t.x()].pos, v[t.y()].pos, v[t.z()].pos, td))
+            return false;
+          triangle = tid;
+          return true;
+        }))
+      return false;
+    hit->instance = entry.instance;
+    hit->triangle = triangle;
+    hit->distance = d;
+    return true;
+  });
+  return dist != INFINITY;
+}
+
+const SceneBVH::MeshBVH *SceneBVH::getMeshBVH(int meshId) const {
+  auto res = meshes.find(meshId);
+  return res == meshes.end() ? nullptr : res->second.get();
+}
+
+} // namespace Flim
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "api/bvh/bvh.hh"
+#include "api/tree/instance.hh"
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace Flim {
+class Scene;
+
+// Closest hit of a ray cast against a whole scene
+struct SceneHit {
+  const Instance *instance = nullptr;
+  uint32_t triangle = UINT32_MAX;
+  float distance = INFINITY;
+
+  bool valid() const { return instance != nullptr; }
+};
+
+// Two-level acceleration structure over every instance of every mesh
+// registered in a scene. Each mesh gets a bottom-level BVH in object space,
+// shared by all of its instances, and a top-level BVH sorts the world space
+// bounds of the instances. Rays reaching an instance are moved into its space
+// before going down the mesh BVH. Meshes with levels of detail are only
+// represented by their finest one.
+class SceneBVH {
+public:
+  using MeshBVH = BVH<4>;
+
+  SceneBVH(const Scene &scene);
+
+  // Rebuild the top level only, after instances moved, were added or removed.
+  // Bottom-level BVHs of newly registered meshes are built on the way.
+  void update();
+  // Rebuild everything, after the vertices of some meshes changed on the CPU
+  void rebuild();
+
+  bool castRay(const Ray &ray, SceneHit *hit) const;
+
+  // Its triangle ids start at the first triangle of the finest level of
+  // detail of the mesh
+  const MeshBVH *getMeshBVH(int meshId) const;
+
+private:
+  struct Entry {
+    const Instance *instance;
+    const MeshBVH *bvh;
+    // Of the finest level of detail, the BVH indexing from there
+    uint32_t firstTriangle;
+    Matrix4f worldToInstance;
+  };
+
+  const Scene &scene;
+  // Bottom level, keyed by mesh id
+  std::map<int, std::unique_ptr<MeshBVH>> meshes;
+  // One entry and world space box per instance, in the same order
+  std::vector<Entry> entries;
+  std::vector<AABB> boxes;
+  std::unique_ptr<BVH<2, BoxSource>> top;
+};
+
+}; // namespace Flim
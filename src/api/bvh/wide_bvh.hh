@@ -0,0 +1,515 @@
+#pragma once
+
+#include "api/bvh/bvh.hh"
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace Flim {
+
+// Node of a WideBVH. The bounds of the up to four children are stored on 8
+// bits per axis and side, as steps within the decoded box of the node in its
+// parent, so that nodes carry no floating point box of their own.
+struct WideBVHNode {
+  static constexpr int width = 4;
+
+  // Internal children are stored contiguously from childBase and the
+  // primitives of leaf children contiguously from primBase
+  uint32_t childBase;
+  uint32_t primBase;
+  // Amount of primitives on the 3 upper bits, 7 for an internal child, and
+  // offset from the base on the 5 lower ones. 0 for an empty slot.
+  uint8_t meta[width];
+  uint8_t lo[3][width];
+  uint8_t hi[3][width];
+
+  bool isInternal(int i) const { return meta[i] >> 5 == 7; }
+  bool isEmpty(int i) const { return meta[i] == 0; }
+  uint32_t child(int i) const { return childBase + (meta[i] & 0x1f); }
+  uint32_t primFirst(int i) const { return primBase + (meta[i] & 0x1f); }
+  uint32_t primCount(int i) const { return meta[i] >> 5; }
+};
+static_assert(sizeof(WideBVHNode) == 36);
+
+// Header of the files written by WideBVH::save, followed by the nodes and the
+// triangle indices
+struct WideBVHCacheHeader {
+  // To bump whenever the layout of the file or of WideBVHNode changes
+  static constexpr uint32_t currentVersion = 1;
+
+  char magic[4];
+  uint32_t version;
+  uint32_t nbElems;
+  uint32_t nodeCount;
+  uint32_t indexCount;
+  // Bounds of the whole tree, which the root children are decoded in
+  float rootMin[3];
+  float rootMax[3];
+  // Identity of the geometry given to save
+  uint64_t sourceKey;
+};
+
+// Compressed 4-wide BVH, collapsed from a binary SAH BVH. A node takes about
+// the size of a binary one while replacing three of them, making the tree
+// around four times smaller, which matters for queries over large meshes
+// whose tree does not fit in cache. Leaves hold at most nbElems (<= 6)
+// triangles. The queries are the ones of BVH, batched across cores by
+// kokkos/bvh_queries.hh.
+template <int nbElems, typename Source = StridedSource> class WideBVH {
+  static_assert(nbElems <= 6, "Leaf sizes are stored on 3 bits");
+
+public:
+  static constexpr int width = WideBVHNode::width;
+  // Amount of rays castRays hands to a thread at once
+  static constexpr int packetSize = 8;
+  // Each visited node pushes at most width - 1 more candidates than it pops
+  static constexpr int stackSize = BVH<nbElems, Source>::maxDepth * width;
+
+  WideBVH(const Source &source) : WideBVH(BVH<nbElems, Source>(source)) {}
+
+  WideBVH(const Mesh &m) : WideBVH(Source(m)) {}
+
+  WideBVH(const BVH<nbElems, Source> &bvh) : source(bvh.getSource()) {
+    std::span<const BVHNode> binary = bvh.getNodes();
+    if (binary.empty())
+      return;
+    indices.reserve(bvh.getIndices().size());
+    root = rootFrame(binary[0].box);
+    nodes.push_back(WideBVHNode());
+    // Binary node to collapse into each wide node, with its frame
+    struct Pending {
+      uint32_t binaryId;
+      uint32_t wideId;
+      Frame frame;
+    };
+    std::vector<Pending> toCollapse = {{0, 0, root}};
+    while (!toCollapse.empty()) {
+      Pending cur = toCollapse.back();
+      toCollapse.pop_back();
+      collapse(bvh, cur.binaryId, cur.wideId, cur.frame,
+               [&](uint32_t binaryId, uint32_t wideId, const Frame &frame) {
+                 toCollapse.push_back({binaryId, wideId, frame});
+               });
+    }
+  }
+
+  // Same as BVH::castRay
+  bool castRay(const Ray &ray, uint32_t *result,
+               float *distance = nullptr) const {
+    float dist = INFINITY;
+    traverse(ray, dist, [&](uint32_t tid, float &d) {
+      const Triangle t = source.triangle(tid);
+      if (!ray.intersects(source.vertex(t.x()), source.vertex(t.y()),
+                          source.vertex(t.z()), d))
+        return false;
+      *result = tid;
+      return true;
+    });
+    if (distance != nullptr)
+      *distance = dist;
+    return dist != INFINITY;
+  }
+
+  // Same as BVH::traverse
+  template <typename Intersect>
+  bool traverse(const Ray &ray, float &dist, Intersect &&intersect) const {
+    const Vector3f invDir = ray.direction.cwiseInverse();
+    const float maxDist = dist;
+    search(
+        dist,
+        [&](const ChildBoxes &boxes) {
+          Lanes tmin = Lanes::Zero();
+          Lanes tmax = Lanes::Constant(dist);
+          for (int axis = 0; axis < 3; axis++) {
+            Lanes t1 = (boxes.lo[axis] - ray.origin[axis]) * invDir[axis];
+            Lanes t2 = (boxes.hi[axis] - ray.origin[axis]) * invDir[axis];
+            tmin = tmin.max(t1.min(t2));
+            tmax = tmax.min(t1.max(t2));
+          }
+          return (tmin <= tmax).select(tmin, Lanes::Constant(INFINITY));
+        },
+        [&](uint32_t tid, float &d) { intersect(tid, d); });
+    return dist < maxDist;
+  }
+
+  // Same as BVH::castRays, the rays of a batch being traced one at a time
+  void castRays(std::span<const Ray> rays, std::span<Hit> hits) const {
+    assert(hits.size() >= rays.size());
+    for (size_t i = 0; i < rays.size(); i++) {
+      hits[i] = Hit();
+      castRay(rays[i], &hits[i].triangle, &hits[i].distance);
+    }
+  }
+
+  // Same as BVH::closestPoint
+  ClosestPoint closestPoint(const Vector3f &p,
+                            float maxDist = INFINITY) const {
+    ClosestPoint best;
+    float bestSq = maxDist * maxDist;
+    search(
+        bestSq,
+        [&](const ChildBoxes &boxes) {
+          Lanes distSq = Lanes::Zero();
+          for (int axis = 0; axis < 3; axis++) {
+            Lanes d =
+                (boxes.lo[axis] - p[axis]).max(p[axis] - boxes.hi[axis]).max(0);
+            distSq += d * d;
+          }
+          return distSq;
+        },
+        [&](uint32_t tid, float &bound) {
+          const Triangle t = source.triangle(tid);
+          Vector3f q =
+              closestPointOnTriangle(p, source.vertex(t.x()),
+                                     source.vertex(t.y()), source.vertex(t.z()));
+          float distSq = (q - p).squaredNorm();
+          if (distSq < bound) {
+            bound = distSq;
+            best.triangle = tid;
+            best.point = q;
+          }
+        });
+    if (best.valid())
+      best.distance = sqrtf(bestSq);
+    return best;
+  }
+
+  // Same as BVH::distance
+  float distance(const Vector3f &p, float maxDist = INFINITY) const {
+    return closestPoint(p, maxDist).distance;
+  }
+
+  // Same as BVH::forEachInSphere
+  template <typename F>
+  void forEachInSphere(const Vector3f &center, float radius, F &&f) const {
+    float radiusSq = radius * radius;
+    float bound = INFINITY;
+    search(
+        bound,
+        [&](const ChildBoxes &boxes) {
+          Lanes distSq = Lanes::Zero();
+          for (int axis = 0; axis < 3; axis++) {
+            Lanes d = (boxes.lo[axis] - center[axis])
+                          .max(center[axis] - boxes.hi[axis])
+                          .max(0);
+            distSq += d * d;
+          }
+          return (distSq <= radiusSq).select(Lanes::Zero(), INFINITY);
+        },
+        [&](uint32_t tid, float &) {
+          const Triangle t = source.triangle(tid);
+          Vector3f q = closestPointOnTriangle(center, source.vertex(t.x()),
+                                              source.vertex(t.y()),
+                                              source.vertex(t.z()));
+          if ((q - center).squaredNorm() <= radiusSq)
+            f(tid);
+        });
+  }
+
+  // Same as BVH::forEachInBox
+  template <typename F> void forEachInBox(const AABB &box, F &&f) const {
+    float bound = INFINITY;
+    search(
+        bound,
+        [&](const ChildBoxes &boxes) {
+          Lanes overlaps = Lanes::Zero();
+          for (int axis = 0; axis < 3; axis++)
+            overlaps = (boxes.lo[axis] <= box.max[axis] &&
+                        box.min[axis] <= boxes.hi[axis])
+                           .select(overlaps, INFINITY);
+          return overlaps;
+        },
+        [&](uint32_t tid, float &) {
+          AABB b;
+          for (uint32_t vid : source.triangle(tid))
+            b.grow(source.vertex(vid));
+          if (b.overlaps(box))
+            f(tid);
+        });
+  }
+
+  // Same as BVH::save
+  void save(const std::string &path, uint64_t sourceKey) const {
+    std::span<const WideBVHNode> treeNodes = getNodes();
+    std::span<const uint32_t> treeIndices = getIndices();
+    WideBVHCacheHeader header = {{'F', 'W', 'B', 'V'},
+                                 WideBVHCacheHeader::currentVersion,
+                                 nbElems,
+                                 (uint32_t)treeNodes.size(),
+                                 (uint32_t)treeIndices.size(),
+                                 {root.origin[0], root.origin[1],
+                                  root.origin[2]},
+                                 {root.top[0], root.top[1], root.top[2]},
+                                 sourceKey};
+    std::string tmpPath = path + ".tmp";
+    {
+      std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+      CHECK(file.good(), "Could not write the BVH cache " + tmpPath);
+      file.write((const char *)&header, sizeof(header));
+      file.write((const char *)treeNodes.data(), treeNodes.size_bytes());
+      file.write((const char *)treeIndices.data(), treeIndices.size_bytes());
+      CHECK(file.good(), "Could not write the BVH cache " + tmpPath);
+    }
+    std::filesystem::rename(tmpPath, path);
+  }
+
+  // Same as BVH::load
+  static std::optional<WideBVH> load(const std::string &path,
+                                     const Source &source, uint64_t sourceKey) {
+    if (!std::filesystem::exists(path))
+      return std::nullopt;
+    auto file = std::make_shared<const MappedFile>(path);
+    if (file->size() < sizeof(WideBVHCacheHeader))
+      return std::nullopt;
+    const WideBVHCacheHeader &header =
+        *(const WideBVHCacheHeader *)file->data();
+    size_t expectedSize = sizeof(WideBVHCacheHeader) +
+                          header.nodeCount * sizeof(WideBVHNode) +
+                          header.indexCount * sizeof(uint32_t);
+    if (memcmp(header.magic, "FWBV", 4) != 0 ||
+        header.version != WideBVHCacheHeader::currentVersion ||
+        header.nbElems != nbElems || header.indexCount != source.size() ||
+        file->size() != expectedSize || header.sourceKey != sourceKey)
+      return std::nullopt;
+    return WideBVH(source, file);
+  }
+
+  std::span<const WideBVHNode> getNodes() const {
+    return mapping ? mappedNodes : std::span<const WideBVHNode>(nodes);
+  }
+  std::span<const uint32_t> getIndices() const {
+    return mapping ? mappedIndices : std::span<const uint32_t>(indices);
+  }
+  const Source &getSource() const { return source; }
+
+private:
+  using Lanes = Eigen::Array<float, width, 1>;
+  using ByteLanes = Eigen::Array<uint8_t, width, 1>;
+
+  // Box the children bounds of a node are decoded in: the decoded box of the
+  // node in its parent, or the bounds of the tree for the root. Bounds are
+  // origin + q * step, the last step reaching top exactly. Steps are powers
+  // of two so that decoding is exact whether or not the compiler fuses it.
+  struct Frame {
+    float origin[3];
+    float step[3];
+    float top[3];
+  };
+
+  // Decoded bounds of the children of a node, one lane per child
+  struct ChildBoxes {
+    Lanes lo[3];
+    Lanes hi[3];
+  };
+
+  // Ratio between the step of a child and the one of its parent, for each
+  // extent of the child in steps of the parent: the smallest power of two
+  // for which 255 steps still cover that extent
+  static constexpr std::array<float, 256> stepRatios = [] {
+    std::array<float, 256> ratios = {};
+    for (int extent = 0; extent < 256; extent++) {
+      float ratio = 1.0f;
+      while (ratio > 1.0f / 256 && 255 * ratio / 2 >= extent)
+        ratio /= 2;
+      ratios[extent] = ratio;
+    }
+    return ratios;
+  }();
+
+  Source source;
+  std::vector<WideBVHNode> nodes;
+  // Triangle indices, the primitives of the leaf children of a node following
+  // each other
+  std::vector<uint32_t> indices;
+  Frame root;
+  // File the tree was loaded from, if any, as for BVH
+  std::shared_ptr<const MappedFile> mapping;
+  std::span<const WideBVHNode> mappedNodes;
+  std::span<const uint32_t> mappedIndices;
+
+  WideBVH(const Source &source, std::shared_ptr<const MappedFile> file)
+      : source(source), mapping(file) {
+    const WideBVHCacheHeader &header =
+        *(const WideBVHCacheHeader *)file->data();
+    const uint8_t *data = file->data() + sizeof(WideBVHCacheHeader);
+    mappedNodes = {(const WideBVHNode *)data, header.nodeCount};
+    data += header.nodeCount * sizeof(WideBVHNode);
+    mappedIndices = {(const uint32_t *)data, header.indexCount};
+    AABB box;
+    box.min = Vector3f(header.rootMin);
+    box.max = Vector3f(header.rootMax);
+    root = rootFrame(box);
+  }
+
+  static Frame rootFrame(const AABB &box) {
+    Frame frame;
+    for (int axis = 0; axis < 3; axis++) {
+      int exponent;
+      frexpf((box.max[axis] - box.min[axis]) / 255.0f, &exponent);
+      frame.origin[axis] = box.min[axis];
+      frame.step[axis] = ldexpf(1.0f, exponent);
+      frame.top[axis] = box.max[axis];
+    }
+    return frame;
+  }
+
+  static ChildBoxes decode(const WideBVHNode &node, const Frame &frame) {
+    ChildBoxes boxes;
+    for (int axis = 0; axis < 3; axis++) {
+      ByteLanes lo = Eigen::Map<const ByteLanes>(node.lo[axis]);
+      ByteLanes hi = Eigen::Map<const ByteLanes>(node.hi[axis]);
+      boxes.lo[axis] =
+          frame.origin[axis] + lo.cast<float>() * frame.step[axis];
+      boxes.hi[axis] = (hi == 255).select(
+          Lanes::Constant(frame.top[axis]),
+          frame.origin[axis] + hi.cast<float>() * frame.step[axis]);
+    }
+    return boxes;
+  }
+
+  static Frame childFrame(const WideBVHNode &node, const Frame &frame,
+                          const ChildBoxes &boxes, int i) {
+    Frame child;
+    for (int axis = 0; axis < 3; axis++) {
+      int extent = std::max(node.hi[axis][i] - node.lo[axis][i], 0);
+      child.origin[axis] = boxes.lo[axis][i];
+      child.step[axis] = frame.step[axis] * stepRatios[extent];
+      child.top[axis] = boxes.hi[axis][i];
+    }
+    return child;
+  }
+
+  // Best-first traversal behind every query. keys(boxes) gives for each child
+  // the value it is ordered by, INFINITY to skip it, and children are skipped
+  // once their key reaches bound. visit(primitive, bound) tests a primitive,
+  // lowering bound if it gets closer.
+  template <typename Keys, typename Visit>
+  void search(float &bound, Keys &&keys, Visit &&visit) const {
+    std::span<const WideBVHNode> treeNodes = getNodes();
+    std::span<const uint32_t> treeIndices = getIndices();
+    if (treeNodes.empty())
+      return;
+
+    // A whole node, or a range of primitives for a leaf child
+    struct Candidate {
+      uint32_t first;
+      uint32_t count; // 0 for a node
+      float key;
+      Frame frame;
+    };
+    Candidate stack[stackSize];
+    int top = 0;
+    stack[top++] = {0, 0, 0.0f, root};
+
+    while (top > 0) {
+      Candidate cur = stack[--top];
+      if (cur.key >= bound)
+        continue;
+      if (cur.count != 0) {
+        for (uint32_t i = cur.first; i < cur.first + cur.count; i++)
+          visit(treeIndices[i], bound);
+        continue;
+      }
+      const WideBVHNode &node = treeNodes[cur.first];
+      ChildBoxes boxes = decode(node, cur.frame);
+      Lanes childKeys = keys(boxes);
+
+      // Push the children kept from the furthest to the nearest
+      Candidate kept[width];
+      int nbKept = 0;
+      for (int i = 0; i < width; i++) {
+        if (node.isEmpty(i) || !(childKeys[i] < bound))
+          continue;
+        Candidate c = {node.primFirst(i), node.primCount(i), childKeys[i],
+                       cur.frame};
+        if (node.isInternal(i))
+          c = {node.child(i), 0, childKeys[i],
+               childFrame(node, cur.frame, boxes, i)};
+        int j = nbKept++;
+        for (; j > 0 && kept[j - 1].key < c.key; j--)
+          kept[j] = kept[j - 1];
+        kept[j] = c;
+      }
+      for (int i = 0; i < nbKept; i++)
+        stack[top++] = kept[i];
+    }
+  }
+
+  // Fill the wide node with the descendants of the binary one, opening the
+  // largest internal child until there are width children, and hand the
+  // internal ones to push with their frame
+  template <typename Push>
+  void collapse(const BVH<nbElems, Source> &bvh, uint32_t binaryId,
+                uint32_t wideId, const Frame &frame, Push &&push) {
+    std::span<const BVHNode> binary = bvh.getNodes();
+    const BVHNode &parent = binary[binaryId];
+    std::vector<uint32_t> children;
+    if (parent.isLeaf())
+      children = {binaryId}; // only happens for the root of a tiny tree
+    else
+      children = {parent.leftFirst, parent.leftFirst + 1};
+    while (children.size() < width) {
+      int largest = -1;
+      for (size_t i = 0; i < children.size(); i++)
+        if (!binary[children[i]].isLeaf() &&
+            (largest == -1 || binary[children[i]].box.area() >
+                                  binary[children[largest]].box.area()))
+          largest = i;
+      if (largest == -1)
+        break;
+      uint32_t opened = children[largest];
+      children[largest] = binary[opened].leftFirst;
+      children.push_back(binary[opened].leftFirst + 1);
+    }
+
+    WideBVHNode node = {};
+    node.childBase = nodes.size();
+    node.primBase = indices.size();
+    uint32_t nbInternal = 0;
+    for (size_t i = 0; i < children.size(); i++) {
+      const BVHNode &child = binary[children[i]];
+      for (int axis = 0; axis < 3; axis++)
+        quantize(node, frame, i, axis, child.box);
+      if (child.isLeaf()) {
+        uint32_t offset = indices.size() - node.primBase;
+        node.meta[i] = child.count << 5 | offset;
+        for (uint32_t p = child.leftFirst; p < child.leftFirst + child.count;
+             p++)
+          indices.push_back(bvh.getIndices()[p]);
+      } else {
+        node.meta[i] = 7 << 5 | nbInternal++;
+      }
+    }
+    // Frames come from the same decoding as the traversal, so that the
+    // bounds the children are quantized against are the ones it will see
+    ChildBoxes boxes = decode(node, frame);
+    for (size_t i = 0; i < children.size(); i++)
+      if (node.isInternal(i))
+        push(children[i], node.child(i), childFrame(node, frame, boxes, i));
+    nodes.resize(nodes.size() + nbInternal);
+    nodes[wideId] = node;
+  }
+
+  // Smallest range of steps of frame whose decoded bounds contain the box
+  static void quantize(WideBVHNode &node, const Frame &frame, int child,
+                       int axis, const AABB &box) {
+    float origin = frame.origin[axis];
+    float step = frame.step[axis];
+    auto decode = [&](int q) {
+      return q == 255 ? frame.top[axis] : origin + q * step;
+    };
+    // fmaxf also turns the NaN of a flat frame into 0
+    int lo = fminf(fmaxf(std::floor((box.min[axis] - origin) / step), 0), 255);
+    int hi = fminf(fmaxf(std::ceil((box.max[axis] - origin) / step), 0), 255);
+    // Make up for the rounding of the decoding
+    while (lo > 0 && origin + lo * step > box.min[axis])
+      lo--;
+    while (hi < 255 && decode(hi) < box.max[axis])
+      hi++;
+    node.lo[axis][child] = lo;
+    node.hi[axis][child] = hi;
+  }
+};
+
+}; // namespace Flim
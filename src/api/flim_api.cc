@@ -46,4 +46,8 @@ int FlimAPI::run(const std::function<void(float)> &renderMethod) {
 
 GLFWwindow *FlimAPI::getWindow() const { return context.window; }
 
+MemoryStats FlimAPI::getMemoryStats() const {
+  return context.allocator.getStats();
+}
+
 } // namespace Flim
@@ -18,6 +18,8 @@ public:
 
   bool graphicsLoaded() const;
   GLFWwindow *getWindow() const;
+  // Device memory taken by every buffer and image
+  MemoryStats getMemoryStats() const;
   void cleanup();
 
 private:
@@ -1,9 +1,19 @@
 #include "compute_params.hh"
+#include "utils/checks.hh"
 
 namespace Flim {
 
 bool ComputeParams::usable() const { return !shader.code.empty(); }
 
+AttributeDescriptor &ComputeParams::setAttribute(int binding) {
+  CHECK(!attributes.contains(binding),
+        "Cannot 'set' an existing attribute, please use update instead");
+  std::shared_ptr<AttributeDescriptor> ptr =
+      std::make_shared<AttributeDescriptor>(binding, AttributeRate::VERTEX);
+  attributes[binding] = ptr;
+  return *ptr;
+}
+
 ComputeParams ComputeParams::clone() {
   ComputeParams cloned(*this);
   for (auto attr : attributes)
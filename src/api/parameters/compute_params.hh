@@ -17,6 +17,11 @@ public:
 
   void linkWriteableAttribute(int fromBinding, int toBinding);
 
+  using BaseParams::setAttribute;
+  // Attribute owned by the compute shader only, its amount of elements has to
+  // be given when attaching it
+  AttributeDescriptor &setAttribute(int binding);
+
   // Validators
   bool usable() const;
 
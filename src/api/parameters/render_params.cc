@@ -48,4 +48,23 @@ RenderParams RenderParams::DefaultParams(const Mesh& m, const Camera& cam) {
   return params;
 }
 
+RenderParams RenderParams::PackedParams(const Mesh &m, const Camera &cam,
+                                        PositionFormat format) {
+  RenderParams params("Packed");
+  VertexQuantization quantization(m, format);
+
+  // Uniforms
+  ParamsUtils::createViewMatrixUniform(params, BINDING_DEFAULT_VIEWS_UNIFORM, m, cam);
+  ParamsUtils::createMaterialUniform(params, BINDING_DEFAULT_MATERIALS_UNIFORM, m);
+  ParamsUtils::createQuantizationUniform(params, BINDING_DEFAULT_QUANTIZATION_UNIFORM, quantization);
+
+  // Attributes
+  ParamsUtils::createPackedVerticesAttribute(params, BINDING_DEFAULT_VERTICES_ATTRIBUTES, quantization);
+  ParamsUtils::createInstanceMatrixAttribute(params, BINDING_DEFAULT_INSTANCES_ATTRIBUTE);
+
+  params.vertexShader = Shader("shaders/quantized.vert.spv");
+  params.fragmentShader = Shader("shaders/default.frag.spv");
+  return params;
+}
+
 } // namespace Flim
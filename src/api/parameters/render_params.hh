@@ -1,5 +1,6 @@
 #pragma once
 
+#include "api/render/vertex_packing.hh"
 #include "api/shaders/shader.hh"
 #include "api/tree/camera.hh"
 #include "base_params.hh"
@@ -10,6 +11,7 @@ namespace Flim {
 
 #define BINDING_DEFAULT_VIEWS_UNIFORM 0
 #define BINDING_DEFAULT_MATERIALS_UNIFORM 1
+#define BINDING_DEFAULT_QUANTIZATION_UNIFORM 2
 #define BINDING_DEFAULT_VERTICES_ATTRIBUTES 0
 #define BINDING_DEFAULT_INSTANCES_ATTRIBUTE 3
 
@@ -27,6 +29,22 @@ public:
   bool useBackfaceCulling = true;
   int version = 0;
   RenderMode mode = RenderMode::RENDERER_MODE_TRIS;
+  // Reorder the mesh's triangles and vertices for the GPU caches before its
+  // index buffer is uploaded (see MeshOptimizer). Their ids change.
+  bool optimizeMesh = false;
+  // Use 16-bit indices when the mesh has few enough vertices, halving its
+  // index buffer. It can then not be viewed as triangles of uint32_t by
+  // getIndexBufferView, LBVH(const Renderer &) or Simplifier(const Renderer &).
+  bool compactIndices = false;
+  // Camera to cull the meshlets of the mesh against every frame (see
+  // MeshletCuller), nullptr to draw every triangle. Triangle ids change.
+  const Camera *cullingCamera = nullptr;
+  // Camera the level of detail of each instance is chosen for every frame,
+  // when the mesh has some (see Mesh::lods), nullptr to draw the finest one
+  const Camera *lodCamera = nullptr;
+  // Largest error of a level, projected on the screen in pixels, for it to be
+  // drawn
+  float lodPixelError = 1.0f;
 
   AttributeDescriptor &setAttribute(int binding,
                                     AttributeRate rate = AttributeRate::VERTEX);
@@ -35,6 +53,11 @@ public:
   void invalidate();
 
   static RenderParams DefaultParams(const Mesh &m, const Camera &cam);
+  // Same as the default ones, with vertices packed to half their size. The
+  // bounds used to pack the positions are taken from m as it is now.
+  static RenderParams
+  PackedParams(const Mesh &m, const Camera &cam,
+               PositionFormat format = PositionFormat::SNORM16);
 
 private:
   RenderParams clone();
@@ -0,0 +1,717 @@
+#include "api/render/mesh.hh"
+#include "api/render/mesh_utils.hh"
+#include "utils/checks.hh"
+#include "utils/mapped_file.hh"
+#include "utils/parallel.hh"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Loaders for the plain triangle soups (OBJ and binary PLY) that do not need
+// assimp's post-processing. Files are mapped and split into chunks parsed
+// concurrently.
+
+namespace Flim {
+
+// Files are parsed in chunks of at least that many bytes
+static constexpr size_t minChunkSize = 1 << 20;
+// Welding is spread over that many independent hash tables
+static constexpr int nbShards = 64;
+static constexpr int shardBits = 26; // vertices per shard are below 2^26
+
+static uint64_t mixHash(uint64_t h) {
+  // splitmix64 finalizer
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebull;
+  h ^= h >> 31;
+  return h;
+}
+
+// Area weighted vertex normals, for the vertices flagged in needsNormal (all
+// of them when empty). Triangles are gathered per vertex, so that no two
+// threads write the same normal.
+static void computeNormals(Mesh &m, const std::vector<uint8_t> &needsNormal,
+                           unsigned nbThreads) {
+  const size_t nbVertices = m.vertices.size();
+  const size_t nbTriangles = m.triangles.size();
+  const size_t blockSize = 1 << 16;
+  const size_t nbTriBlocks = (nbTriangles + blockSize - 1) / blockSize;
+  const size_t nbVtxBlocks = (nbVertices + blockSize - 1) / blockSize;
+
+  std::vector<Vector3f> faceNormals(nbTriangles);
+  std::vector<uint32_t> first(nbVertices + 1, 0);
+  parallelFor(nbTriBlocks, nbThreads, [&](size_t b) {
+    for (size_t t = b * blockSize; t < std::min(nbTriangles, (b + 1) * blockSize);
+         t++) {
+      const Triangle &tri = m.triangles[t];
+      const Vector3f &v0 = m.vertices[tri.x()].pos;
+      faceNormals[t] = (m.vertices[tri.y()].pos - v0)
+                           .cross(m.vertices[tri.z()].pos - v0);
+      for (uint32_t vid : tri)
+        std::atomic_ref<uint32_t>(first[vid + 1]).fetch_add(1);
+    }
+  });
+  std::partial_sum(first.begin(), first.end(), first.begin());
+
+  std::vector<uint32_t> cursor(first.begin(), first.end() - 1);
+  std::vector<uint32_t> adjacent(first.back());
+  parallelFor(nbTriBlocks, nbThreads, [&](size_t b) {
+    for (size_t t = b * blockSize; t < std::min(nbTriangles, (b + 1) * blockSize);
+         t++)
+      for (uint32_t vid : m.triangles[t])
+        adjacent[std::atomic_ref<uint32_t>(cursor[vid]).fetch_add(1)] = t;
+  });
+
+  parallelFor(nbVtxBlocks, nbThreads, [&](size_t b) {
+    for (size_t v = b * blockSize; v < std::min(nbVertices, (b + 1) * blockSize);
+         v++) {
+      if (!needsNormal.empty() && !needsNormal[v])
+        continue;
+      Vector3f n = Vector3f::Zero();
+      for (uint32_t i = first[v]; i < first[v + 1]; i++)
+        n += faceNormals[adjacent[i]];
+      m.vertices[v].normal = n.normalized();
+    }
+  });
+}
+
+// Split [begin, end) into chunks ending on line breaks
+static std::vector<std::string_view> splitLines(const char *begin,
+                                                const char *end,
+                                                unsigned nbThreads) {
+  size_t size = end - begin;
+  size_t nbChunks = std::clamp<size_t>(size / minChunkSize, 1, 4 * nbThreads);
+  std::vector<std::string_view> chunks;
+  const char *cur = begin;
+  for (size_t c = 1; c <= nbChunks && cur < end; c++) {
+    const char *cut = c == nbChunks ? end : begin + c * size / nbChunks;
+    if (cut < cur)
+      continue;
+    cut = (const char *)memchr(cut, '\n', end - cut);
+    cut = cut == nullptr ? end : cut + 1;
+    chunks.emplace_back(cur, cut - cur);
+    cur = cut;
+  }
+  return chunks;
+}
+
+// OBJ ------------------------------------------------------------------------
+
+namespace {
+
+// Indices of a face corner. Positive OBJ indices are stored 0-based, negative
+// ones relative to the amount of elements the chunk had read so far (flagged
+// in relative) until the chunk offsets are known. -1 when absent.
+struct ObjCorner {
+  int32_t index[3]; // v, vt, vn
+  uint8_t relative;
+};
+
+struct ObjChunk {
+  std::vector<Vector3f> positions;
+  std::vector<Vector2f> uvs;
+  std::vector<Vector3f> normals;
+  std::vector<ObjCorner> corners; // 3 per triangle, fans already split
+  bool valid = true;
+
+  // Filled while welding
+  uint32_t bases[3]; // offsets of the positions, uvs and normals
+  std::vector<uint32_t> shardLists[nbShards];
+  std::vector<uint32_t> vertexOf; // shard << shardBits | id in the shard
+  size_t firstTriangle;
+};
+
+struct ObjKey {
+  int32_t index[3];
+
+  bool operator==(const ObjKey &o) const {
+    return index[0] == o.index[0] && index[1] == o.index[1] &&
+           index[2] == o.index[2];
+  }
+  uint64_t hash() const {
+    return mixHash((uint64_t)(uint32_t)index[0] * 0x9e3779b97f4a7c15ull ^
+                   (uint64_t)(uint32_t)index[1] << 21 ^
+                   (uint64_t)(uint32_t)index[2] << 42);
+  }
+};
+
+} // namespace
+
+static const char *skipBlanks(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    p++;
+  return p;
+}
+
+// Checks are gathered in valid rather than thrown from the hot loops
+static const char *parseFloat(const char *p, const char *end, float &value,
+                              bool &valid) {
+  p = skipBlanks(p, end);
+  if (p < end && *p == '+')
+    p++;
+  auto [ptr, ec] = std::from_chars(p, end, value);
+  valid &= ec == std::errc();
+  return ptr;
+}
+
+// Parse "v", "v/vt", "v//vn" or "v/vt/vn", returns nullptr at the end of the
+// line
+static const char *parseCorner(const char *p, const char *end,
+                               const uint32_t counts[3], ObjCorner &corner,
+                               bool &valid) {
+  p = skipBlanks(p, end);
+  if (p == end)
+    return nullptr;
+  corner = {{-1, -1, -1}, 0};
+  for (int k = 0; k < 3 && p < end; k++) {
+    if (*p != '/') {
+      int32_t value;
+      auto [ptr, ec] = std::from_chars(p, end, value);
+      if (ec != std::errc() || value == 0) {
+        valid = false;
+        return nullptr;
+      }
+      p = ptr;
+      if (value > 0)
+        corner.index[k] = value - 1;
+      else {
+        corner.index[k] = (int32_t)counts[k] + value;
+        corner.relative |= 1 << k;
+      }
+    }
+    if (p == end || *p != '/')
+      break;
+    p++;
+  }
+  return p;
+}
+
+static void parseObjChunk(std::string_view text, ObjChunk &chunk) {
+  const char *p = text.data();
+  const char *end = p + text.size();
+  std::vector<ObjCorner> polygon;
+  while (p < end) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (eol == nullptr)
+      eol = end;
+    const char *cur = skipBlanks(p, eol);
+    p = eol + 1;
+    if (eol - cur < 2 || (cur[1] != ' ' && cur[1] != '\t' && cur[0] != 'v'))
+      continue;
+
+    if (cur[0] == 'v' && (cur[1] == ' ' || cur[1] == '\t')) {
+      Vector3f v;
+      cur = parseFloat(cur + 1, eol, v.x(), chunk.valid);
+      cur = parseFloat(cur, eol, v.y(), chunk.valid);
+      parseFloat(cur, eol, v.z(), chunk.valid);
+      chunk.positions.push_back(v);
+    } else if (cur[0] == 'v' && cur[1] == 't') {
+      Vector2f uv(0, 0);
+      cur = parseFloat(cur + 2, eol, uv.x(), chunk.valid);
+      if (skipBlanks(cur, eol) != eol)
+        parseFloat(cur, eol, uv.y(), chunk.valid);
+      chunk.uvs.push_back(Vector2f(uv.x(), 1.0f - uv.y())); // flipped as assimp
+    } else if (cur[0] == 'v' && cur[1] == 'n') {
+      Vector3f n;
+      cur = parseFloat(cur + 2, eol, n.x(), chunk.valid);
+      cur = parseFloat(cur, eol, n.y(), chunk.valid);
+      parseFloat(cur, eol, n.z(), chunk.valid);
+      chunk.normals.push_back(n);
+    } else if (cur[0] == 'f') {
+      const uint32_t counts[3] = {(uint32_t)chunk.positions.size(),
+                                  (uint32_t)chunk.uvs.size(),
+                                  (uint32_t)chunk.normals.size()};
+      polygon.clear();
+      ObjCorner corner;
+      cur++;
+      while ((cur = parseCorner(cur, eol, counts, corner, chunk.valid)) !=
+             nullptr)
+        polygon.push_back(corner);
+      // Fan triangulation
+      for (size_t i = 2; i < polygon.size(); i++) {
+        chunk.corners.push_back(polygon[0]);
+        chunk.corners.push_back(polygon[i - 1]);
+        chunk.corners.push_back(polygon[i]);
+      }
+    }
+  }
+}
+
+Mesh MeshUtils::loadObj(const char *path, unsigned nbThreads) {
+  nbThreads = resolveThreadCount(nbThreads);
+  MappedFile file(path);
+  const char *begin = (const char *)file.data();
+  std::vector<std::string_view> texts =
+      splitLines(begin, begin + file.size(), nbThreads);
+
+  std::vector<ObjChunk> chunks(texts.size());
+  parallelFor(chunks.size(), nbThreads,
+              [&](size_t c) { parseObjChunk(texts[c], chunks[c]); });
+  for (const ObjChunk &chunk : chunks)
+    CHECK(chunk.valid, "Invalid OBJ file " + std::string(path));
+
+  // Chunk offsets, to resolve relative indices and place the triangles
+  uint32_t totals[3] = {0, 0, 0};
+  size_t nbTriangles = 0;
+  for (ObjChunk &chunk : chunks) {
+    chunk.bases[0] = totals[0];
+    chunk.bases[1] = totals[1];
+    chunk.bases[2] = totals[2];
+    totals[0] += chunk.positions.size();
+    totals[1] += chunk.uvs.size();
+    totals[2] += chunk.normals.size();
+    chunk.firstTriangle = nbTriangles;
+    nbTriangles += chunk.corners.size() / 3;
+  }
+
+  // Resolve the indices and sort the corners by shard
+  parallelFor(chunks.size(), nbThreads, [&](size_t c) {
+    ObjChunk &chunk = chunks[c];
+    for (uint32_t i = 0; i < chunk.corners.size(); i++) {
+      ObjCorner &corner = chunk.corners[i];
+      for (int k = 0; k < 3; k++) {
+        bool absent = k > 0 && corner.index[k] == -1 && !(corner.relative & (1 << k));
+        if (corner.relative & (1 << k))
+          corner.index[k] += chunk.bases[k];
+        chunk.valid &= absent || (corner.index[k] >= 0 &&
+                                  corner.index[k] < (int32_t)totals[k]);
+      }
+      ObjKey key = {{corner.index[0], corner.index[1], corner.index[2]}};
+      chunk.shardLists[key.hash() >> (64 - 6)].push_back(i);
+    }
+    chunk.vertexOf.resize(chunk.corners.size());
+  });
+  static_assert(nbShards == 1 << 6);
+  for (const ObjChunk &chunk : chunks)
+    CHECK(chunk.valid, "Out of range index in OBJ file " + std::string(path));
+
+  // Weld identical corners, each shard owning its own open addressing table
+  std::vector<std::vector<ObjKey>> shardKeys(nbShards);
+  parallelFor(nbShards, nbThreads, [&](size_t s) {
+    size_t count = 0;
+    for (const ObjChunk &chunk : chunks)
+      count += chunk.shardLists[s].size();
+    size_t capacity = std::bit_ceil(std::max<size_t>(2 * count, 16));
+    std::vector<ObjKey> table(capacity, ObjKey{{-1, -1, -1}});
+    std::vector<uint32_t> ids(capacity);
+    std::vector<ObjKey> &keys = shardKeys[s];
+
+    for (ObjChunk &chunk : chunks)
+      for (uint32_t i : chunk.shardLists[s]) {
+        const ObjCorner &corner = chunk.corners[i];
+        ObjKey key = {{corner.index[0], corner.index[1], corner.index[2]}};
+        size_t slot = key.hash() & (capacity - 1);
+        while (table[slot].index[0] != -1 && !(table[slot] == key))
+          slot = (slot + 1) & (capacity - 1);
+        if (table[slot].index[0] == -1) {
+          CHECK(keys.size() < (1u << shardBits), "Too many OBJ vertices");
+          table[slot] = key;
+          ids[slot] = keys.size();
+          keys.push_back(key);
+        }
+        chunk.vertexOf[i] = s << shardBits | ids[slot];
+      }
+  });
+
+  std::vector<uint32_t> shardBase(nbShards + 1, 0);
+  for (int s = 0; s < nbShards; s++)
+    shardBase[s + 1] = shardBase[s] + shardKeys[s].size();
+
+  // Elements are looked up in their chunk
+  auto locate = [&](int k, int32_t index) {
+    size_t c = std::upper_bound(chunks.begin(), chunks.end(), (uint32_t)index,
+                                [k](uint32_t i, const ObjChunk &chunk) {
+                                  return i < chunk.bases[k];
+                                }) -
+               chunks.begin() - 1;
+    return std::make_pair(c, index - chunks[c].bases[k]);
+  };
+
+  Mesh m;
+  m.vertices.resize(shardBase.back());
+  m.triangles.resize(nbTriangles);
+  std::vector<uint8_t> needsNormal(totals[2] == 0 ? 0 : m.vertices.size(), 0);
+  bool missingNormals = totals[2] == 0;
+  parallelFor(nbShards, nbThreads, [&](size_t s) {
+    for (size_t i = 0; i < shardKeys[s].size(); i++) {
+      const ObjKey &key = shardKeys[s][i];
+      Vertex &vtx = m.vertices[shardBase[s] + i];
+      auto [pc, pi] = locate(0, key.index[0]);
+      vtx.pos = chunks[pc].positions[pi];
+      vtx.uv = Vector2f(0, 0);
+      if (key.index[1] >= 0) {
+        auto [uc, ui] = locate(1, key.index[1]);
+        vtx.uv = chunks[uc].uvs[ui];
+      }
+      vtx.normal = Vector3f::Zero();
+      if (key.index[2] >= 0) {
+        auto [nc, ni] = locate(2, key.index[2]);
+        vtx.normal = chunks[nc].normals[ni];
+      } else if (!missingNormals)
+        needsNormal[shardBase[s] + i] = 1;
+    }
+  });
+
+  parallelFor(chunks.size(), nbThreads, [&](size_t c) {
+    const ObjChunk &chunk = chunks[c];
+    for (size_t i = 0; i < chunk.vertexOf.size(); i++) {
+      uint32_t packed = chunk.vertexOf[i];
+      uint32_t vid =
+          shardBase[packed >> shardBits] + (packed & ((1u << shardBits) - 1));
+      m.triangles[chunk.firstTriangle + i / 3][i % 3] = vid;
+    }
+  });
+
+  if (missingNormals ||
+      std::find(needsNormal.begin(), needsNormal.end(), 1) != needsNormal.end())
+    computeNormals(m, needsNormal, nbThreads);
+
+  std::cout << "Loaded " << path << " (" << m.vertices.size() << " vertices, "
+            << m.triangles.size() << " triangles)" << std::endl;
+  return m;
+}
+
+// PLY ------------------------------------------------------------------------
+
+namespace {
+
+enum class PlyType { INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT, DOUBLE };
+
+struct PlyProperty {
+  std::string name;
+  PlyType type;
+  bool isList = false;
+  PlyType countType; // for lists
+  size_t offset;     // within the record, for scalars before any list
+};
+
+struct PlyElement {
+  std::string name;
+  size_t count;
+  std::vector<PlyProperty> properties;
+  size_t stride = 0; // 0 when the records have lists
+};
+
+} // namespace
+
+static PlyType parsePlyType(const std::string &name) {
+  if (name == "char" || name == "int8")
+    return PlyType::INT8;
+  if (name == "uchar" || name == "uint8")
+    return PlyType::UINT8;
+  if (name == "short" || name == "int16")
+    return PlyType::INT16;
+  if (name == "ushort" || name == "uint16")
+    return PlyType::UINT16;
+  if (name == "int" || name == "int32")
+    return PlyType::INT32;
+  if (name == "uint" || name == "uint32")
+    return PlyType::UINT32;
+  if (name == "float" || name == "float32")
+    return PlyType::FLOAT;
+  if (name == "double" || name == "float64")
+    return PlyType::DOUBLE;
+  throw std::runtime_error("Unknown PLY type " + name);
+}
+
+static size_t plyTypeSize(PlyType type) {
+  switch (type) {
+  case PlyType::INT8:
+  case PlyType::UINT8:
+    return 1;
+  case PlyType::INT16:
+  case PlyType::UINT16:
+    return 2;
+  case PlyType::INT32:
+  case PlyType::UINT32:
+  case PlyType::FLOAT:
+    return 4;
+  case PlyType::DOUBLE:
+    return 8;
+  }
+  return 0;
+}
+
+template <typename T> static T readAs(const uint8_t *p, bool swap) {
+  uint8_t bytes[sizeof(T)];
+  memcpy(bytes, p, sizeof(T));
+  if (swap)
+    std::reverse(bytes, bytes + sizeof(T));
+  T value;
+  memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+static double readPly(const uint8_t *p, PlyType type, bool swap) {
+  switch (type) {
+  case PlyType::INT8:
+    return readAs<int8_t>(p, swap);
+  case PlyType::UINT8:
+    return readAs<uint8_t>(p, swap);
+  case PlyType::INT16:
+    return readAs<int16_t>(p, swap);
+  case PlyType::UINT16:
+    return readAs<uint16_t>(p, swap);
+  case PlyType::INT32:
+    return readAs<int32_t>(p, swap);
+  case PlyType::UINT32:
+    return readAs<uint32_t>(p, swap);
+  case PlyType::FLOAT:
+    return readAs<float>(p, swap);
+  case PlyType::DOUBLE:
+    return readAs<double>(p, swap);
+  }
+  return 0;
+}
+
+// Size of the record at p, reading the lengths of its lists
+static size_t plyRecordSize(const PlyElement &element, const uint8_t *p,
+                            const uint8_t *end, bool swap) {
+  if (element.stride != 0)
+    return element.stride;
+  size_t size = 0;
+  for (const PlyProperty &prop : element.properties) {
+    if (!prop.isList) {
+      size += plyTypeSize(prop.type);
+      continue;
+    }
+    CHECK(p + size + plyTypeSize(prop.countType) <= end, "Truncated PLY file");
+    size_t count = readPly(p + size, prop.countType, swap);
+    size += plyTypeSize(prop.countType) + count * plyTypeSize(prop.type);
+  }
+  CHECK(p + size <= end, "Truncated PLY file");
+  return size;
+}
+
+Mesh MeshUtils::loadPly(const char *path, unsigned nbThreads) {
+  nbThreads = resolveThreadCount(nbThreads);
+  MappedFile file(path);
+  const char *text = (const char *)file.data();
+  std::string_view whole(text, file.size());
+  size_t headerEnd = whole.find("end_header");
+  CHECK(whole.starts_with("ply") && headerEnd != std::string_view::npos,
+        "Invalid PLY file " + std::string(path));
+  headerEnd = whole.find('\n', headerEnd);
+  CHECK(headerEnd != std::string_view::npos, "Truncated PLY file");
+
+  // Header
+  std::istringstream header(std::string(whole.substr(0, headerEnd)));
+  std::vector<PlyElement> elements;
+  std::string line, format;
+  while (std::getline(header, line)) {
+    std::istringstream words(line);
+    std::string keyword;
+    words >> keyword;
+    if (keyword == "format")
+      words >> format;
+    else if (keyword == "element") {
+      PlyElement element;
+      words >> element.name >> element.count;
+      elements.push_back(element);
+    } else if (keyword == "property") {
+      CHECK(!elements.empty(), "PLY property outside of an element");
+      PlyProperty prop;
+      std::string type;
+      words >> type;
+      if (type == "list") {
+        std::string countType, itemType;
+        words >> countType >> itemType;
+        prop.isList = true;
+        prop.countType = parsePlyType(countType);
+        prop.type = parsePlyType(itemType);
+      } else
+        prop.type = parsePlyType(type);
+      words >> prop.name;
+      elements.back().properties.push_back(prop);
+    }
+  }
+  if (format == "ascii") // nothing to gain over assimp there
+    return loadFromFile(path);
+  CHECK(format == "binary_little_endian" || format == "binary_big_endian",
+        "Unknown PLY format " + format);
+  bool swap = (format == "binary_little_endian") !=
+              (std::endian::native == std::endian::little);
+
+  for (PlyElement &element : elements) {
+    size_t offset = 0;
+    bool fixed = true;
+    for (PlyProperty &prop : element.properties) {
+      prop.offset = offset;
+      fixed &= !prop.isList;
+      offset += plyTypeSize(prop.type);
+    }
+    element.stride = fixed ? offset : 0;
+  }
+
+  const uint8_t *data = file.data() + headerEnd + 1;
+  const uint8_t *end = file.data() + file.size();
+  const PlyElement *vertexElement = nullptr;
+  const PlyElement *faceElement = nullptr;
+  const uint8_t *vertexData = nullptr;
+  // Faces are split in chunks of records, the offset of each being found by
+  // a quick walk over the list lengths
+  const size_t recordsPerChunk = 1 << 16;
+  std::vector<const uint8_t *> faceChunks;
+  std::vector<size_t> faceChunkTriangles;
+
+  for (const PlyElement &element : elements) {
+    if (element.name == "vertex") {
+      CHECK(element.stride != 0, "PLY vertices cannot hold lists");
+      CHECK(data + element.count * element.stride <= end, "Truncated PLY file");
+      vertexElement = &element;
+      vertexData = data;
+      data += element.count * element.stride;
+    } else if (element.name == "face") {
+      faceElement = &element;
+      const PlyProperty *indices = nullptr;
+      for (const PlyProperty &prop : element.properties)
+        if (prop.isList && (prop.name == "vertex_indices" ||
+                            prop.name == "vertex_index"))
+          indices = &prop;
+      CHECK(indices != nullptr, "PLY faces without vertex indices");
+      size_t triangles = 0;
+      for (size_t f = 0; f < element.count; f++) {
+        if (f % recordsPerChunk == 0) {
+          faceChunks.push_back(data);
+          faceChunkTriangles.push_back(triangles);
+        }
+        size_t size = 0;
+        for (const PlyProperty &prop : element.properties) {
+          if (!prop.isList) {
+            size += plyTypeSize(prop.type);
+            continue;
+          }
+          CHECK(data + size + plyTypeSize(prop.countType) <= end,
+                "Truncated PLY file");
+          size_t count = readPly(data + size, prop.countType, swap);
+          if (&prop == indices && count >= 3)
+            triangles += count - 2;
+          size += plyTypeSize(prop.countType) + count * plyTypeSize(prop.type);
+        }
+        CHECK(data + size <= end, "Truncated PLY file");
+        data += size;
+      }
+      faceChunkTriangles.push_back(triangles);
+    } else {
+      for (size_t r = 0; r < element.count; r++)
+        data += plyRecordSize(element, data, end, swap);
+    }
+  }
+  CHECK(vertexElement != nullptr && faceElement != nullptr,
+        "PLY file without vertices or faces " + std::string(path));
+
+  // Vertices
+  auto findProperty = [&](std::initializer_list<const char *> names) {
+    for (const PlyProperty &prop : vertexElement->properties)
+      for (const char *name : names)
+        if (prop.name == name)
+          return &prop;
+    return (const PlyProperty *)nullptr;
+  };
+  const PlyProperty *pos[3] = {findProperty({"x"}), findProperty({"y"}),
+                               findProperty({"z"})};
+  const PlyProperty *normal[3] = {findProperty({"nx"}), findProperty({"ny"}),
+                                  findProperty({"nz"})};
+  const PlyProperty *uv[2] = {
+      findProperty({"u", "s", "texture_u", "texture_s"}),
+      findProperty({"v", "t", "texture_v", "texture_t"})};
+  CHECK(pos[0] && pos[1] && pos[2], "PLY vertices without positions");
+  bool hasNormals = normal[0] && normal[1] && normal[2];
+  bool hasUvs = uv[0] && uv[1];
+
+  Mesh m;
+  m.vertices.resize(vertexElement->count);
+  const size_t stride = vertexElement->stride;
+  parallelFor((m.vertices.size() + recordsPerChunk - 1) / recordsPerChunk,
+              nbThreads, [&](size_t c) {
+                size_t last = std::min(m.vertices.size(),
+                                       (c + 1) * recordsPerChunk);
+                for (size_t v = c * recordsPerChunk; v < last; v++) {
+                  const uint8_t *record = vertexData + v * stride;
+                  Vertex &vtx = m.vertices[v];
+                  for (int k = 0; k < 3; k++)
+                    vtx.pos[k] =
+                        readPly(record + pos[k]->offset, pos[k]->type, swap);
+                  vtx.normal = Vector3f::Zero();
+                  if (hasNormals)
+                    for (int k = 0; k < 3; k++)
+                      vtx.normal[k] = readPly(record + normal[k]->offset,
+                                              normal[k]->type, swap);
+                  vtx.uv = Vector2f(0, 0);
+                  if (hasUvs)
+                    vtx.uv = Vector2f(
+                        readPly(record + uv[0]->offset, uv[0]->type, swap),
+                        1.0f - readPly(record + uv[1]->offset, uv[1]->type,
+                                       swap));
+                }
+              });
+
+  // Faces, fan triangulated
+  m.triangles.resize(faceChunkTriangles.back());
+  std::vector<uint8_t> chunkValid(faceChunks.size(), 1);
+  parallelFor(faceChunks.size(), nbThreads, [&](size_t c) {
+    const uint8_t *record = faceChunks[c];
+    size_t tri = faceChunkTriangles[c];
+    size_t last = std::min(faceElement->count, (c + 1) * recordsPerChunk);
+    for (size_t f = c * recordsPerChunk; f < last; f++) {
+      for (const PlyProperty &prop : faceElement->properties) {
+        if (!prop.isList) {
+          record += plyTypeSize(prop.type);
+          continue;
+        }
+        size_t count = readPly(record, prop.countType, swap);
+        record += plyTypeSize(prop.countType);
+        size_t itemSize = plyTypeSize(prop.type);
+        if (prop.name == "vertex_indices" || prop.name == "vertex_index") {
+          auto index = [&](size_t i) {
+            double value = readPly(record + i * itemSize, prop.type, swap);
+            if (value < 0 || value >= m.vertices.size()) {
+              chunkValid[c] = 0;
+              return 0u;
+            }
+            return (uint32_t)value;
+          };
+          for (size_t i = 2; i < count; i++)
+            m.triangles[tri++] = Triangle(index(0), index(i - 1), index(i));
+        }
+        record += count * itemSize;
+      }
+    }
+  });
+
+  CHECK(std::find(chunkValid.begin(), chunkValid.end(), 0) == chunkValid.end(),
+        "Out of range index in PLY file " + std::string(path));
+
+  if (!hasNormals)
+    computeNormals(m, {}, nbThreads);
+
+  std::cout << "Loaded " << path << " (" << m.vertices.size() << " vertices, "
+            << m.triangles.size() << " triangles)" << std::endl;
+  return m;
+}
+
+Mesh MeshUtils::loadFast(const char *path, unsigned nbThreads) {
+  std::string extension = std::filesystem::path(path).extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 ::tolower);
+  if (extension == ".obj")
+    return loadObj(path, nbThreads);
+  if (extension == ".ply")
+    return loadPly(path, nbThreads);
+  return loadFromFile(path);
+}
+
+}; // namespace Flim
@@ -11,4 +11,52 @@ const std::vector<Triangle> &Mesh::getTriangles() const { return triangles; }
 Mesh::Mesh() : id(meshid++), material(), vertices(), triangles() {};
 void Mesh::attachMaterial(Material m) { material = m; }
 
+void Mesh::setInstanceOrder(std::vector<uint32_t> order) {
+  if (order.empty() && instanceOrder.empty())
+    return;
+  const size_t count = instances.size();
+  if ((!order.empty() && order.size() != count) ||
+      (!instanceOrder.empty() && instanceOrder.size() != count)) {
+    // The instances were not all in the previous order
+    allInstancesChanged();
+  } else {
+    // Empty orders being the identity
+    std::vector<uint32_t> moved;
+    for (uint32_t slot = 0; slot < count; slot++) {
+      uint32_t before = instanceOrder.empty() ? slot : instanceOrder[slot];
+      uint32_t after = order.empty() ? slot : order[slot];
+      if (before != after)
+        moved.push_back(slot);
+    }
+    for (const auto &weak : instanceTrackers)
+      if (auto tracker = weak.lock())
+        for (uint32_t slot : moved)
+          tracker->markChanged(slot);
+  }
+  instanceOrder = std::move(order);
+  instanceSlots.resize(instanceOrder.size());
+  for (uint32_t slot = 0; slot < instanceOrder.size(); slot++)
+    instanceSlots[instanceOrder[slot]] = slot;
+}
+
+void Mesh::instanceChanged(uint32_t id) {
+  if (id < instanceSlots.size())
+    id = instanceSlots[id];
+  for (const auto &weak : instanceTrackers)
+    if (auto tracker = weak.lock())
+      tracker->markChanged(id);
+}
+
+void Mesh::allInstancesChanged() {
+  for (const auto &weak : instanceTrackers)
+    if (auto tracker = weak.lock())
+      tracker->markAllChanged();
+}
+
+void Mesh::subscribeInstances(const std::shared_ptr<ChangeTracker> &tracker) {
+  std::erase_if(instanceTrackers,
+                [](const auto &weak) { return weak.expired(); });
+  instanceTrackers.push_back(tracker);
+}
+
 } // namespace Flim
@@ -3,8 +3,11 @@
 #include "api/render/material.hh"
 #include "api/transform.hh"
 #include "api/tree/instance.hh"
+#include "utils/change_tracker.hh"
+#include <atomic>
 #include <cstdint>
 #include <fwd.hh>
+#include <memory>
 #include <span>
 #include <vector>
 
@@ -22,7 +25,14 @@ struct Vertex {
 
 typedef Vector3<uint32_t> Triangle;
 
-static int meshid = 0;
+// A level of detail of a mesh, as a range of its triangles
+struct MeshLOD {
+  uint32_t firstTriangle;
+  uint32_t triangleCount;
+  float error; // distance to the finest level, in the units of the positions
+};
+
+static std::atomic<int> meshid = 0; // meshes can be created by import threads
 class Mesh {
 
 public:
@@ -36,11 +46,33 @@ public:
 
   std::vector<Vertex> vertices;
   std::vector<Triangle> triangles;
+  // Levels of detail, finest first, all indexing the same vertices (see
+  // Simplifier::buildLODs). Empty to draw every triangle.
+  std::vector<MeshLOD> lods;
+  // Order the instances are uploaded in, grouped by level of detail by the
+  // renderer every frame (see setInstanceOrder). Empty for their own order.
+  std::vector<uint32_t> instanceOrder;
+  // Only the slots of the buffers now holding another instance are marked
+  // as changed. Empty for the instances' own order.
+  void setInstanceOrder(std::vector<uint32_t> order);
+
+  // Mark the slot of the instance in the buffers as changed in every tracker
+  // subscribed to the instances, called by their transforms once the
+  // graphics are loaded
+  void instanceChanged(uint32_t id);
+  void allInstancesChanged();
+  // Each attribute attached per instance has its own tracker, as it writes
+  // its buffers on its own (see AttributeDescriptor::attachPerInstance)
+  void subscribeInstances(const std::shared_ptr<ChangeTracker> &tracker);
 
 protected:
   Mesh();
 
   Material material;
+  // Dropped once their attribute is gone
+  std::vector<std::weak_ptr<ChangeTracker>> instanceTrackers;
+  // Slot of each instance in instanceOrder, empty along with it
+  std::vector<uint32_t> instanceSlots;
 
   friend class Scene;
   friend class MeshUtils;
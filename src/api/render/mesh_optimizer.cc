@@ -0,0 +1,250 @@
+#include "mesh_optimizer.hh"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace Flim {
+
+float MeshOptimizer::acmr(const Mesh &m, int cacheSize) {
+  if (m.triangles.empty())
+    return 0.0f;
+  // FIFO cache, a vertex is in it if it was pushed at most cacheSize misses
+  // ago
+  std::vector<uint64_t> pushedAt(m.vertices.size(), 0);
+  uint64_t misses = 0;
+  for (const Triangle &t : m.triangles)
+    for (uint32_t v : t)
+      if (pushedAt[v] == 0 || misses - pushedAt[v] >= (uint64_t)cacheSize)
+        pushedAt[v] = ++misses;
+  return misses / (float)m.triangles.size();
+}
+
+MeshOptimizer::Report MeshOptimizer::optimize(Mesh &m, bool overdraw) {
+  Report report;
+  report.acmrBefore = acmr(m);
+  optimizeVertexCache(m);
+  if (overdraw)
+    optimizeOverdraw(m);
+  optimizeVertexFetch(m);
+  report.acmrAfter = acmr(m);
+  return report;
+}
+
+// Forsyth ---------------------------------------------------------------------
+
+static constexpr int forsythCacheSize = 32;
+static constexpr int maxValence = 32; // scores are flat past it
+
+void MeshOptimizer::optimizeVertexCache(Mesh &m) {
+  const size_t nbVertices = m.vertices.size();
+  const size_t nbTriangles = m.triangles.size();
+  if (nbTriangles == 0)
+    return;
+
+  static const auto [cacheScores, valenceScores] = []() {
+    std::array<float, forsythCacheSize> cache;
+    for (int i = 0; i < forsythCacheSize; i++)
+      // The last triangle's vertices get a fixed score, so that strips do not
+      // always go the same way
+      cache[i] = i < 3 ? 0.75f
+                       : powf(1.0f - (i - 3) / float(forsythCacheSize - 3),
+                              1.5f);
+    std::array<float, maxValence + 1> valence;
+    valence[0] = 0.0f;
+    for (int i = 1; i <= maxValence; i++)
+      // Vertices with few triangles left are finished first
+      valence[i] = 2.0f * powf(i, -0.5f);
+    return std::make_pair(cache, valence);
+  }();
+  auto vertexScore = [&](int cachePos, uint32_t live) {
+    if (live == 0)
+      return -1.0f;
+    float score = cachePos >= 0 ? cacheScores[cachePos] : 0.0f;
+    return score + valenceScores[std::min<uint32_t>(live, maxValence)];
+  };
+
+  // Live triangles of each vertex, emitted ones being swapped out of the range
+  std::vector<uint32_t> first(nbVertices + 1, 0);
+  for (const Triangle &t : m.triangles)
+    for (uint32_t v : t)
+      first[v + 1]++;
+  std::partial_sum(first.begin(), first.end(), first.begin());
+  std::vector<uint32_t> live(nbVertices);
+  for (size_t v = 0; v < nbVertices; v++)
+    live[v] = first[v + 1] - first[v];
+  std::vector<uint32_t> adjacent(first.back());
+  {
+    std::vector<uint32_t> cursor(first.begin(), first.end() - 1);
+    for (uint32_t t = 0; t < nbTriangles; t++)
+      for (uint32_t v : m.triangles[t])
+        adjacent[cursor[v]++] = t;
+  }
+
+  std::vector<int> cachePos(nbVertices, -1);
+  std::vector<float> vScores(nbVertices);
+  for (size_t v = 0; v < nbVertices; v++)
+    vScores[v] = vertexScore(-1, live[v]);
+  std::vector<float> tScores(nbTriangles);
+  std::vector<bool> emitted(nbTriangles, false);
+  for (size_t t = 0; t < nbTriangles; t++) {
+    const Triangle &tri = m.triangles[t];
+    tScores[t] = vScores[tri.x()] + vScores[tri.y()] + vScores[tri.z()];
+  }
+
+  std::vector<Triangle> ordered;
+  ordered.reserve(nbTriangles);
+  std::vector<uint32_t> cache, newCache;
+  cache.reserve(forsythCacheSize + 3);
+  newCache.reserve(forsythCacheSize + 3);
+  int64_t best = std::max_element(tScores.begin(), tScores.end()) -
+                 tScores.begin();
+  size_t fallback = 0;
+
+  while (ordered.size() < nbTriangles) {
+    if (best < 0) {
+      // Dead end, nothing in the cache has triangles left
+      while (emitted[fallback])
+        fallback++;
+      best = fallback;
+    }
+    const Triangle tri = m.triangles[best];
+    ordered.push_back(tri);
+    emitted[best] = true;
+
+    newCache.clear();
+    for (uint32_t v : tri) {
+      // Drop the triangle from the live ones of its vertices
+      uint32_t *begin = adjacent.data() + first[v];
+      uint32_t *end = begin + live[v];
+      std::iter_swap(std::find(begin, end, (uint32_t)best), end - 1);
+      live[v]--;
+      newCache.push_back(v);
+    }
+    for (uint32_t v : cache)
+      if (v != tri.x() && v != tri.y() && v != tri.z())
+        newCache.push_back(v);
+
+    for (size_t i = 0; i < newCache.size(); i++) {
+      uint32_t v = newCache[i];
+      cachePos[v] = i < forsythCacheSize ? i : -1;
+      float delta = vertexScore(cachePos[v], live[v]) - vScores[v];
+      vScores[v] += delta;
+      for (uint32_t a = first[v]; a < first[v] + live[v]; a++)
+        tScores[adjacent[a]] += delta;
+    }
+    // The next triangle is the best one around the cache
+    best = -1;
+    float bestScore = -1.0f;
+    for (uint32_t v : newCache)
+      for (uint32_t a = first[v]; a < first[v] + live[v]; a++)
+        if (tScores[adjacent[a]] > bestScore) {
+          bestScore = tScores[adjacent[a]];
+          best = adjacent[a];
+        }
+    newCache.resize(std::min<size_t>(newCache.size(), forsythCacheSize));
+    std::swap(cache, newCache);
+  }
+  m.triangles = std::move(ordered);
+}
+
+// Overdraw --------------------------------------------------------------------
+
+void MeshOptimizer::optimizeOverdraw(Mesh &m, float threshold) {
+  const size_t nbTriangles = m.triangles.size();
+  if (nbTriangles == 0)
+    return;
+  const float before = acmr(m);
+
+  // A cluster starts wherever a triangle misses the cache on all its vertices
+  std::vector<size_t> clusterStarts;
+  {
+    std::vector<uint64_t> pushedAt(m.vertices.size(), 0);
+    uint64_t misses = 0;
+    for (size_t t = 0; t < nbTriangles; t++) {
+      int triMisses = 0;
+      for (uint32_t v : m.triangles[t])
+        if (pushedAt[v] == 0 ||
+            misses - pushedAt[v] >= (uint64_t)defaultCacheSize) {
+          pushedAt[v] = ++misses;
+          triMisses++;
+        }
+      if (triMisses == 3 || t == 0)
+        clusterStarts.push_back(t);
+    }
+  }
+  clusterStarts.push_back(nbTriangles);
+  const size_t nbClusters = clusterStarts.size() - 1;
+  if (nbClusters < 2)
+    return;
+
+  // Clusters facing away from the center of the mesh are likely in front of
+  // the others, so they are drawn first
+  Vector3f center = Vector3f::Zero();
+  float totalArea = 0.0f;
+  std::vector<Vector3f> centroids(nbClusters, Vector3f::Zero());
+  std::vector<Vector3f> normals(nbClusters, Vector3f::Zero());
+  std::vector<float> areas(nbClusters, 0.0f);
+  for (size_t c = 0; c < nbClusters; c++) {
+    for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+      const Triangle &tri = m.triangles[t];
+      const Vector3f &p0 = m.vertices[tri.x()].pos;
+      const Vector3f &p1 = m.vertices[tri.y()].pos;
+      const Vector3f &p2 = m.vertices[tri.z()].pos;
+      Vector3f n = (p1 - p0).cross(p2 - p0);
+      float area = n.norm();
+      centroids[c] += area * (p0 + p1 + p2) / 3.0f;
+      normals[c] += n;
+      areas[c] += area;
+    }
+    center += centroids[c];
+    totalArea += areas[c];
+    if (areas[c] > 0.0f)
+      centroids[c] /= areas[c];
+  }
+  if (totalArea > 0.0f)
+    center /= totalArea;
+
+  std::vector<float> keys(nbClusters);
+  for (size_t c = 0; c < nbClusters; c++)
+    keys[c] = (centroids[c] - center).dot(normals[c].normalized());
+  std::vector<size_t> order(nbClusters);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+  std::vector<Triangle> sorted;
+  sorted.reserve(nbTriangles);
+  for (size_t c : order)
+    sorted.insert(sorted.end(), m.triangles.begin() + clusterStarts[c],
+                  m.triangles.begin() + clusterStarts[c + 1]);
+  std::swap(m.triangles, sorted);
+  if (acmr(m) > before * threshold)
+    std::swap(m.triangles, sorted);
+}
+
+// Vertex fetch ----------------------------------------------------------------
+
+void MeshOptimizer::optimizeVertexFetch(Mesh &m) {
+  const uint32_t unset = UINT32_MAX;
+  std::vector<uint32_t> remap(m.vertices.size(), unset);
+  uint32_t next = 0;
+  for (Triangle &t : m.triangles)
+    for (uint32_t &v : t) {
+      if (remap[v] == unset)
+        remap[v] = next++;
+      v = remap[v];
+    }
+  for (uint32_t &r : remap)
+    if (r == unset)
+      r = next++;
+
+  std::vector<Vertex> vertices(m.vertices.size());
+  for (size_t v = 0; v < m.vertices.size(); v++)
+    vertices[remap[v]] = m.vertices[v];
+  m.vertices = std::move(vertices);
+}
+
+} // namespace Flim
@@ -0,0 +1,38 @@
+#pragma once
+#include "api/render/mesh.hh"
+
+namespace Flim {
+
+// Reorders the triangles and vertices of a mesh for the GPU: triangles for
+// the post-transform vertex cache, then optionally for overdraw, and vertices
+// in the order they are first used. Ids of triangles and vertices change, so
+// run it before anything refers to them (e.g through RenderParams::optimizeMesh
+// when the mesh is registered).
+class MeshOptimizer {
+public:
+  // FIFO cache size used to measure the ACMR, typical of current GPUs
+  static constexpr int defaultCacheSize = 16;
+
+  struct Report {
+    float acmrBefore;
+    float acmrAfter;
+  };
+
+  // Average cache miss ratio: vertices transformed per triangle, from 0.5 at
+  // best on large regular meshes to 3 at worst
+  static float acmr(const Mesh &m, int cacheSize = defaultCacheSize);
+
+  // Every pass below, returning the ACMR before and after
+  static Report optimize(Mesh &m, bool overdraw = true);
+
+  // Forsyth's linear-speed vertex cache optimization
+  static void optimizeVertexCache(Mesh &m);
+  // Cut the triangles into clusters wherever the cache restarts, and draw the
+  // outer facing ones first. Kept only if the ACMR grows by less than
+  // threshold.
+  static void optimizeOverdraw(Mesh &m, float threshold = 1.05f);
+  // Sort the vertices by first use, unused ones going last
+  static void optimizeVertexFetch(Mesh &m);
+};
+
+} // namespace Flim
@@ -1,104 +1,145 @@
 #include "mesh_utils.hh"
 #include "api/render/mesh.hh"
+#include "utils/checks.hh"
+#include "utils/mapped_file.hh"
+#include "utils/parallel.hh"
 #include <Eigen/Eigen>
 #include <Eigen/src/Core/Matrix.h>
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <numeric>
 #include <stdexcept>
 #include <string>
 
 namespace Flim {
 
-Mesh MeshUtils::createCube(float side_length) {
-  Mesh model;
+// Rows of the generated meshes are filled by blocks of about this many items
+static constexpr size_t generatorBlockSize = 1 << 16;
+
+// Run f(begin, end) over blocks of rows of [0, n), each row being rowSize
+// items, on every core
+template <typename F>
+static void forRowBlocks(size_t n, size_t rowSize, const F &f) {
+  const size_t rowsPerBlock =
+      std::max<size_t>(1, generatorBlockSize / std::max<size_t>(1, rowSize));
+  parallelFor((n + rowsPerBlock - 1) / rowsPerBlock, 0, [&](size_t b) {
+    f(b * rowsPerBlock, std::min(n, (b + 1) * rowsPerBlock));
+  });
+}
 
-  Vertex vertex{};
+MeshSize MeshUtils::cubeSize() { return {8, 12}; }
 
+void MeshUtils::fillCube(float side_length, Vertex *vertices,
+                         Triangle *triangles) {
   float half = side_length / 2.0f;
 
   // Define the 8 vertices of the cube
-  std::vector<Vector3f> positions = {
+  const Vector3f positions[8] = {
       {half, -half, -half},  {half, -half, half},  {-half, -half, half},
       {-half, -half, -half}, {half, half, -half},  {half, half, half},
       {-half, half, half},   {-half, half, -half},
   };
-
-  // Add vertices to the mesh
-  for (const auto &pos : positions) {
-    vertex.pos = pos;
-    vertex.normal = pos.normalized();
-    model.vertices.push_back(vertex);
-  }
+  for (int i = 0; i < 8; i++)
+    vertices[i] = {positions[i], positions[i].normalized(), Vector2f::Zero()};
 
   // Define the 12 triangles (2 per face)
-  const std::vector<Triangle> indices = {
+  const Triangle indices[12] = {
       Triangle(1, 2, 3), Triangle(7, 6, 5), Triangle(4, 5, 1),
       Triangle(5, 6, 2), Triangle(2, 6, 7), Triangle(0, 3, 7),
       Triangle(0, 1, 3), Triangle(4, 7, 5), Triangle(0, 4, 1),
       Triangle(1, 5, 2), Triangle(3, 2, 7), Triangle(4, 0, 7),
   };
-  // Add indices to the mesh
-  for (const auto &tri : indices) {
-    model.triangles.push_back(tri);
-  }
+  std::copy(indices, indices + 12, triangles);
+}
 
+Mesh MeshUtils::createCube(float side_length) {
+  Mesh model;
+  const MeshSize size = cubeSize();
+  model.vertices.resize(size.vertexCount);
+  model.triangles.resize(size.triangleCount);
+  fillCube(side_length, model.vertices.data(), model.triangles.data());
   return model;
 }
 
-Mesh MeshUtils::createSphere(float radius, int n_slices, int n_stacks) {
-  Mesh model;
+MeshSize MeshUtils::sphereSize(int n_slices, int n_stacks) {
+  CHECK(n_slices > 0 && n_stacks > 1,
+        "A sphere needs at least one slice and two stacks");
+  return {(size_t)n_slices * (n_stacks - 1) + 2,
+          2 * (size_t)n_slices * (n_stacks - 1)};
+}
 
-  Vertex vertex{};
+void MeshUtils::fillSphere(float radius, int n_slices, int n_stacks,
+                           Vertex *vertices, Triangle *triangles) {
+  sphereSize(n_slices, n_stacks); // checks the amounts
+  const size_t slices = n_slices;
 
-  // add top vertex
-  vertex.pos = radius * Vector3f(0, 1, 0);
-  uint32_t v0 = model.vertices.size();
-  model.vertices.push_back(vertex);
+  // top and bottom vertices, the first and the last ones
+  const uint32_t v0 = 0;
+  const uint32_t v1 = slices * (n_stacks - 1) + 1;
+  vertices[v0] = {radius * Vector3f(0, 1, 0), Vector3f(0, 1, 0),
+                  Vector2f::Zero()};
+  vertices[v1] = {radius * Vector3f(0, -1, 0), Vector3f(0, -1, 0),
+                  Vector2f::Zero()};
 
   // generate vertices per stack / slice
-  for (int i = 0; i < n_stacks - 1; i++) {
-    auto phi = M_PI * double(i + 1) / double(n_stacks);
-    for (int j = 0; j < n_slices; j++) {
-      auto theta = 2.0 * M_PI * double(j) / double(n_slices);
-      auto x = std::sin(phi) * std::cos(theta);
-      auto y = std::cos(phi);
-      auto z = std::sin(phi) * std::sin(theta);
-      vertex.pos = radius * Vector3f(x, y, z);
-      model.vertices.push_back(vertex);
+  forRowBlocks(n_stacks - 1, slices, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      auto phi = M_PI * double(i + 1) / double(n_stacks);
+      for (size_t j = 0; j < slices; j++) {
+        auto theta = 2.0 * M_PI * double(j) / double(n_slices);
+        auto x = std::sin(phi) * std::cos(theta);
+        auto y = std::cos(phi);
+        auto z = std::sin(phi) * std::sin(theta);
+        const Vector3f normal(x, y, z);
+        vertices[1 + i * slices + j] = {radius * normal, normal,
+                                        Vector2f::Zero()};
+      }
     }
-  }
-
-  // add bottom vertex
-  vertex.pos = radius * Vector3f(0, -1, 0);
-  int v1 = model.vertices.size();
-  model.vertices.push_back(vertex);
-
-  // add top / bottom triangles
-  for (int i = 0; i < n_slices; ++i) {
-    auto i0 = i + 1;
-    auto i1 = (i + 1) % n_slices + 1;
-    model.triangles.push_back(Triangle(v0, i1, i0));
-    i0 = i + n_slices * (n_stacks - 2) + 1;
-    i1 = (i + 1) % n_slices + n_slices * (n_stacks - 2) + 1;
-    model.triangles.push_back(Triangle(v1, i0, i1));
+  });
+
+  // add top / bottom triangles, interleaved
+  for (size_t i = 0; i < slices; ++i) {
+    uint32_t i0 = i + 1;
+    uint32_t i1 = (i + 1) % slices + 1;
+    triangles[2 * i] = Triangle(v0, i1, i0);
+    i0 = i + slices * (n_stacks - 2) + 1;
+    i1 = (i + 1) % slices + slices * (n_stacks - 2) + 1;
+    triangles[2 * i + 1] = Triangle(v1, i0, i1);
   }
 
   // add quads per stack / slice
-  for (int j = 0; j < n_stacks - 2; j++) {
-    auto j0 = j * n_slices + 1;
-    auto j1 = (j + 1) * n_slices + 1;
-    for (int i = 0; i < n_slices; i++) {
-      auto i0 = j0 + i;
-      auto i1 = j0 + (i + 1) % n_slices;
-      auto i2 = j1 + (i + 1) % n_slices;
-      auto i3 = j1 + i;
-
-      model.triangles.push_back(Triangle(i0, i1, i2));
-      model.triangles.push_back(Triangle(i0, i1, i3));
+  Triangle *quads = triangles + 2 * slices;
+  forRowBlocks(n_stacks - 2, 2 * slices, [&](size_t begin, size_t end) {
+    for (size_t j = begin; j < end; j++) {
+      uint32_t j0 = j * slices + 1;
+      uint32_t j1 = (j + 1) * slices + 1;
+      for (size_t i = 0; i < slices; i++) {
+        uint32_t i0 = j0 + i;
+        uint32_t i1 = j0 + (i + 1) % slices;
+        uint32_t i2 = j1 + (i + 1) % slices;
+        uint32_t i3 = j1 + i;
+
+        quads[2 * (j * slices + i)] = Triangle(i0, i1, i2);
+        quads[2 * (j * slices + i) + 1] = Triangle(i0, i1, i3);
+      }
     }
-  }
+  });
+}
+
+Mesh MeshUtils::createSphere(float radius, int n_slices, int n_stacks) {
+  Mesh model;
+  const MeshSize size = sphereSize(n_slices, n_stacks);
+  model.vertices.resize(size.vertexCount);
+  model.triangles.resize(size.triangleCount);
+  fillSphere(radius, n_slices, n_stacks, model.vertices.data(),
+             model.triangles.data());
   return model;
 }
 
@@ -141,20 +182,64 @@ static Transform getMeshTransformFromScene(const aiScene *scene) {
                   0.0f, 0.0f, 0.0f, 1.0f);
   Transform t;
   Matrix3f mat3 = (*((Matrix4f *)&mat)).block<3, 3>(0, 0);
-  t.rotation = Quaternionf(mat3);
+  t.setRotation(Quaternionf(mat3));
   return t;
 }
 
 static Matrix4f convertAssimpMatrix(const aiMatrix4x4 &from) {
-  static Matrix4f to;
+  Matrix4f to;
   for (size_t i = 0; i < 4; i++)
     for (size_t j = 0; j < 4; j++)
       to(i, j) = from[i][j];
   return to;
 }
 
-Mesh MeshUtils::loadFromFile(const char *path, bool smoothNormals) {
-  std::cout << "Importing " << path << "..." << '\n';
+static Transform convertAssimpTransform(const aiMatrix4x4 &from) {
+  aiVector3D scaling, position;
+  aiQuaternion rotation;
+  from.Decompose(scaling, rotation, position);
+  Transform t;
+  t.setPosition(Vector3f(position.x, position.y, position.z));
+  t.setRotation(Quaternionf(rotation.w, rotation.x, rotation.y, rotation.z));
+  t.setScale(Vector3f(scaling.x, scaling.y, scaling.z));
+  return t;
+}
+
+static void convertMesh(const aiScene *scene, const aiMesh *from, Mesh &to) {
+  // Sized once and filled in place, with no reallocation
+  to.vertices.resize(from->mNumVertices);
+  const aiVector3D *uvs = from->mTextureCoords[0];
+  for (unsigned int vertexId = 0; vertexId < from->mNumVertices; ++vertexId) {
+    Vertex &vtx = to.vertices[vertexId];
+    aiVector3D v = from->mVertices[vertexId];
+    vtx.pos = Vector3f(v.x, v.y, v.z);
+    if (from->mNormals != nullptr) {
+      aiVector3D n = from->mNormals[vertexId];
+      vtx.normal = Vector3f(n.x, n.y, n.z);
+    } else
+      vtx.normal = Vector3f::Zero();
+    vtx.uv = uvs != nullptr ? Vector2f(uvs[vertexId].x, uvs[vertexId].y)
+                            : Vector2f(0, 0);
+  }
+
+  // Points and lines left by the triangulation are skipped
+  to.triangles.resize(from->mNumFaces);
+  size_t nbTriangles = 0;
+  for (unsigned int faceId = 0; faceId < from->mNumFaces; ++faceId) {
+    const aiFace &face = from->mFaces[faceId];
+    if (face.mNumIndices != 3)
+      continue;
+    to.triangles[nbTriangles++] =
+        Triangle(face.mIndices[0], face.mIndices[1], face.mIndices[2]);
+  }
+  to.triangles.resize(nbTriangles);
+
+  to.attachMaterial(
+      Material::createFrom(scene->mMaterials[from->mMaterialIndex]));
+}
+
+ImportedScene MeshUtils::importScene(const char *path, bool smoothNormals,
+                                     unsigned nbThreads) {
   auto postProcessEffects = aiProcess_Triangulate |
                             aiProcess_JoinIdenticalVertices |
                             aiProcess_GenUVCoords | aiProcess_FlipUVs |
@@ -163,76 +248,276 @@ Mesh MeshUtils::loadFromFile(const char *path, bool smoothNormals) {
     postProcessEffects |= aiProcess_GenSmoothNormals;
   else
     postProcessEffects |= aiProcess_GenNormals;
-  static Assimp::Importer importer;
+  // One importer per call, so that files can be read concurrently
+  Assimp::Importer importer;
   const aiScene *scene = importer.ReadFile(path, postProcessEffects);
 
   if (scene == nullptr || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
       scene->mRootNode == nullptr)
     throw std::runtime_error("Could not load path: " + std::string(path));
 
-  Matrix4f rot = convertAssimpMatrix(scene->mRootNode->mTransformation);
-
-  for (uint meshId = 0; meshId < scene->mNumMeshes; meshId++) {
-    Mesh m;
-    std::cout << " = [MESH " << meshId << "] Creating mesh" << std::endl;
-    auto mesh = scene->mMeshes[meshId];
-    Vertex vtx{};
-    std::cout << " | Retrieving vertices (" << mesh->mNumVertices << ")"
-              << std::endl;
-    for (unsigned int vertexId = 0; vertexId < mesh->mNumVertices; ++vertexId) {
-      aiVector3D v = mesh->mVertices[vertexId];
-      aiVector3D n = mesh->mNormals[vertexId];
-      vtx.pos = Vector3f(v.x, v.y, v.z);
-      vtx.normal = Vector3f(n.x, n.y, n.z);
-      vtx.uv = Vector2f(0, 0);
-      m.vertices.push_back(vtx);
+  ImportedScene imported;
+  imported.meshes.reserve(scene->mNumMeshes);
+  for (uint meshId = 0; meshId < scene->mNumMeshes; meshId++)
+    imported.meshes.push_back(Mesh());
+
+  // Biggest meshes first, so that no thread is left with a big one at the end
+  std::vector<uint> order(scene->mNumMeshes);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](uint a, uint b) {
+    return scene->mMeshes[a]->mNumVertices > scene->mMeshes[b]->mNumVertices;
+  });
+  parallelFor(order.size(), nbThreads, [&](size_t i) {
+    convertMesh(scene, scene->mMeshes[order[i]], imported.meshes[order[i]]);
+  });
+
+  // Depth first walk of the hierarchy, accumulating the transforms
+  std::vector<std::pair<const aiNode *, aiMatrix4x4>> toVisit = {
+      {scene->mRootNode, aiMatrix4x4()}};
+  std::vector<int> parents = {-1};
+  while (!toVisit.empty()) {
+    auto [node, parentWorld] = toVisit.back();
+    toVisit.pop_back();
+    int parent = parents.back();
+    parents.pop_back();
+
+    aiMatrix4x4 world = parentWorld * node->mTransformation;
+    int id = imported.nodes.size();
+    imported.nodes.push_back({node->mName.C_Str(), parent,
+                              convertAssimpTransform(world),
+                              std::vector<uint32_t>(node->mMeshes,
+                                                    node->mMeshes +
+                                                        node->mNumMeshes)});
+    for (uint c = 0; c < node->mNumChildren; c++) {
+      toVisit.push_back({node->mChildren[c], world});
+      parents.push_back(id);
     }
+  }
 
-    std::cout << " | Retrieving indices (" << mesh->mNumFaces << ")"
-              << std::endl;
-    // Retrieve indices (assuming triangles)
+  std::cout << "Imported " << path << " (" << imported.meshes.size()
+            << " meshes, " << imported.nodes.size() << " nodes)" << std::endl;
+  return imported;
+}
+
+std::vector<ImportedScene>
+MeshUtils::importScenes(const std::vector<std::string> &paths,
+                        bool smoothNormals, unsigned nbThreads) {
+  nbThreads = resolveThreadCount(nbThreads);
+  // Files are read concurrently, the remaining threads convert their meshes
+  unsigned nbFileThreads = std::min<size_t>(nbThreads, paths.size());
+  unsigned nbMeshThreads = std::max(1u, nbThreads / std::max(1u, nbFileThreads));
+
+  std::vector<ImportedScene> scenes(paths.size());
+  parallelFor(paths.size(), nbFileThreads, [&](size_t i) {
+    scenes[i] = importScene(paths[i].c_str(), smoothNormals, nbMeshThreads);
+  });
+  return scenes;
+}
 
-    for (unsigned int faceId = 0; faceId < mesh->mNumFaces; ++faceId) {
-      aiFace face = mesh->mFaces[faceId];
-      assert(face.mNumIndices == 3);
+Mesh MeshUtils::loadFromFile(const char *path, bool smoothNormals) {
+  ImportedScene imported = importScene(path, smoothNormals);
+
+  // Every placement of a mesh is baked in world space
+  struct Part {
+    const Mesh *mesh;
+    Matrix4f world;
+    size_t firstVertex;
+    size_t firstTriangle;
+  };
+  std::vector<Part> parts;
+  size_t nbVertices = 0;
+  size_t nbTriangles = 0;
+  for (const ImportedNode &node : imported.nodes)
+    for (uint32_t meshId : node.meshes) {
+      const Mesh &m = imported.meshes[meshId];
+      parts.push_back({&m, node.transform.getViewMatrix(), nbVertices,
+                       nbTriangles});
+      nbVertices += m.vertices.size();
+      nbTriangles += m.triangles.size();
+    }
 
-      m.triangles.push_back(
-          Triangle(face.mIndices[0], face.mIndices[1], face.mIndices[2]));
+  Mesh merged;
+  if (parts.empty())
+    return merged;
+  merged.attachMaterial(parts.front().mesh->getMaterial());
+  merged.vertices.resize(nbVertices);
+  merged.triangles.resize(nbTriangles);
+
+  parallelFor(parts.size(), 0, [&](size_t p) {
+    const Part &part = parts[p];
+    const Matrix3f normalMat =
+        part.world.block<3, 3>(0, 0).inverse().transpose();
+    for (size_t i = 0; i < part.mesh->vertices.size(); i++) {
+      Vertex v = part.mesh->vertices[i];
+      v.pos = (part.world * v.pos.homogeneous()).head<3>();
+      v.normal = (normalMat * v.normal).normalized();
+      merged.vertices[part.firstVertex + i] = v;
     }
-    std::cout << " | Attaching material (ID " << mesh->mMaterialIndex << ")"
-              << std::endl;
-    m.attachMaterial(
-        Material::createFrom(scene->mMaterials[mesh->mMaterialIndex]));
-    /* m.transform = getMeshTransformFromScene(scene); */
-
-    std::cout << " = [MESH " << meshId << "] Finished creating" << std::endl;
-    return m;
+    const Triangle offset = Triangle::Constant(part.firstVertex);
+    for (size_t i = 0; i < part.mesh->triangles.size(); i++)
+      merged.triangles[part.firstTriangle + i] =
+          part.mesh->triangles[i] + offset;
+  });
+  return merged;
+}
+
+uint64_t MeshUtils::importKey(const char *path, bool smoothNormals) {
+  // FNV-1a over bytes
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&](const void *data, size_t size) {
+    for (size_t i = 0; i < size; i++)
+      hash = (hash ^ ((const uint8_t *)data)[i]) * 1099511628211ull;
+  };
+  std::string canonical = std::filesystem::canonical(path).string();
+  uint64_t fileSize = std::filesystem::file_size(path);
+  int64_t modified =
+      std::filesystem::last_write_time(path).time_since_epoch().count();
+  mix(canonical.data(), canonical.size());
+  mix(&fileSize, sizeof(fileSize));
+  mix(&modified, sizeof(modified));
+  mix(&smoothNormals, sizeof(smoothNormals));
+  return hash;
+}
+
+void MeshUtils::saveBinary(const Mesh &m, const std::string &path,
+                           uint64_t sourceHash) {
+  static_assert(sizeof(Vertex) == 8 * sizeof(float) &&
+                    sizeof(Triangle) == 3 * sizeof(uint32_t),
+                "The binary mesh layout relies on packed vertices");
+  const Material &mat = m.getMaterial();
+  MeshCacheHeader header{};
+  memcpy(header.magic, "FMSH", 4);
+  header.version = MeshCacheHeader::currentVersion;
+  header.vertexCount = m.vertices.size();
+  header.triangleCount = m.triangles.size();
+  strncpy(header.materialName, mat.name.c_str(),
+          sizeof(header.materialName) - 1);
+  Map<Vector3f>(header.ambient) = mat.ambient;
+  Map<Vector3f>(header.diffuse) = mat.diffuse;
+  Map<Vector3f>(header.specular) = mat.specular;
+  header.mask = mat.mask;
+  AlignedBox3f bounds(Vector3f::Zero());
+  if (!m.vertices.empty())
+    bounds = AlignedBox3f(m.vertices.front().pos);
+  for (const Vertex &v : m.vertices)
+    bounds.extend(v.pos);
+  Map<Vector3f>(header.min) = bounds.min();
+  Map<Vector3f>(header.max) = bounds.max();
+  header.sourceHash = sourceHash;
+
+  // Written aside and renamed so that a reader never maps a partial file
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    CHECK(file.good(), "Could not write the binary mesh " + tmpPath);
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)m.vertices.data(),
+               m.vertices.size() * sizeof(Vertex));
+    file.write((const char *)m.triangles.data(),
+               m.triangles.size() * sizeof(Triangle));
+    CHECK(file.good(), "Could not write the binary mesh " + tmpPath);
   }
-  return Mesh();
+  std::filesystem::rename(tmpPath, path);
 }
 
-Mesh MeshUtils::createGrid(float length, int nbpts_width, int nbpts_height) {
-  Mesh model;
-  Vertex v{};
-  v.normal = Vector3f(0, 0, 1);
-  for (int i = 0; i < nbpts_height; i++) {
-    for (int j = 0; j < nbpts_width; j++) {
-      v.pos = Vector3f(j * length, i * length, 0);
-      model.vertices.push_back(v);
-    }
+std::optional<Mesh> MeshUtils::loadBinary(const std::string &path,
+                                          uint64_t sourceHash) {
+  if (!std::filesystem::exists(path))
+    return std::nullopt;
+  MappedFile file(path);
+  if (file.size() < sizeof(MeshCacheHeader))
+    return std::nullopt;
+  const MeshCacheHeader &header = *(const MeshCacheHeader *)file.data();
+  size_t expectedSize = sizeof(MeshCacheHeader) +
+                        header.vertexCount * sizeof(Vertex) +
+                        header.triangleCount * sizeof(Triangle);
+  if (memcmp(header.magic, "FMSH", 4) != 0 ||
+      header.version != MeshCacheHeader::currentVersion ||
+      file.size() != expectedSize ||
+      (sourceHash != 0 && header.sourceHash != sourceHash))
+    return std::nullopt;
+
+  const Vertex *vertices =
+      (const Vertex *)(file.data() + sizeof(MeshCacheHeader));
+  const Triangle *triangles =
+      (const Triangle *)(vertices + header.vertexCount);
+  Mesh m;
+  m.vertices.assign(vertices, vertices + header.vertexCount);
+  m.triangles.assign(triangles, triangles + header.triangleCount);
+
+  std::string name(header.materialName,
+                   strnlen(header.materialName, sizeof(header.materialName)));
+  Material mat(name.c_str());
+  mat.ambient = Map<const Vector3f>(header.ambient);
+  mat.diffuse = Map<const Vector3f>(header.diffuse);
+  mat.specular = Map<const Vector3f>(header.specular);
+  mat.mask = header.mask;
+  m.attachMaterial(mat);
+  return m;
+}
+
+Mesh MeshUtils::loadCached(const char *path, const std::string &cacheDir,
+                           bool smoothNormals) {
+  if (!std::filesystem::exists(path))
+    return loadFromFile(path, smoothNormals); // reports the missing file
+
+  uint64_t hash = importKey(path, smoothNormals);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.mesh", (unsigned long long)hash);
+  std::string cachePath = (std::filesystem::path(cacheDir) / name).string();
+  if (std::optional<Mesh> m = loadBinary(cachePath, hash)) {
+    std::cout << "Loaded " << path << " from " << cachePath << std::endl;
+    return std::move(*m);
   }
 
-  for (int i = 0; i < nbpts_width - 1; i++) {
-    for (int j = 0; j < nbpts_height - 1; j++) {
-      int bot_left = i + j * (nbpts_width);
-      int bot_right = bot_left + 1;
-      int top_left = i + (j + 1) * (nbpts_width);
-      int top_right = top_left + 1;
+  Mesh m = loadFromFile(path, smoothNormals);
+  std::filesystem::create_directories(cacheDir);
+  saveBinary(m, cachePath, hash);
+  return m;
+}
+
+MeshSize MeshUtils::gridSize(int nbpts_width, int nbpts_height) {
+  CHECK(nbpts_width > 0 && nbpts_height > 0,
+        "A grid needs at least one point per side");
+  return {(size_t)nbpts_width * nbpts_height,
+          2 * (size_t)(nbpts_width - 1) * (nbpts_height - 1)};
+}
 
-      model.triangles.push_back(Triangle(top_left, top_right, bot_left));
-      model.triangles.push_back(Triangle(top_right, bot_right, bot_left));
+void MeshUtils::fillGrid(float length, int nbpts_width, int nbpts_height,
+                         Vertex *vertices, Triangle *triangles) {
+  gridSize(nbpts_width, nbpts_height); // checks the amounts
+  const size_t width = nbpts_width, height = nbpts_height;
+  forRowBlocks(height, width, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+      for (size_t j = 0; j < width; j++)
+        vertices[i * width + j] = {Vector3f(j * length, i * length, 0),
+                                   Vector3f(0, 0, 1), Vector2f::Zero()};
+  });
+
+  // Column by column
+  forRowBlocks(width - 1, 2 * (height - 1), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      Triangle *column = triangles + 2 * i * (height - 1);
+      for (size_t j = 0; j < height - 1; j++) {
+        uint32_t bot_left = i + j * width;
+        uint32_t bot_right = bot_left + 1;
+        uint32_t top_left = i + (j + 1) * width;
+        uint32_t top_right = top_left + 1;
+
+        column[2 * j] = Triangle(top_left, top_right, bot_left);
+        column[2 * j + 1] = Triangle(top_right, bot_right, bot_left);
+      }
     }
-  }
+  });
+}
+
+Mesh MeshUtils::createGrid(float length, int nbpts_width, int nbpts_height) {
+  Mesh model;
+  const MeshSize size = gridSize(nbpts_width, nbpts_height);
+  model.vertices.resize(size.vertexCount);
+  model.triangles.resize(size.triangleCount);
+  fillGrid(length, nbpts_width, nbpts_height, model.vertices.data(),
+           model.triangles.data());
   return model;
 }
 
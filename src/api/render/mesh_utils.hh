@@ -1,17 +1,137 @@
 #pragma once
 #include "api/render/mesh.hh"
+#include "api/transform.hh"
+#include <cstdint>
 #include <fwd.hh>
+#include <optional>
+#include <string>
+#include <vector>
 
 namespace Flim {
 
+// Node of an imported file, placing some of its meshes in the world
+struct ImportedNode {
+  std::string name;
+  int parent; // -1 for the root
+  // World transform, accumulated from the root (shear is dropped)
+  Transform transform;
+  std::vector<uint32_t> meshes; // indices in ImportedScene::meshes
+};
+
+// Every mesh of a file, in object space, and the nodes instantiating them:
+//
+//   for (auto &node : imported.nodes)
+//     for (uint32_t m : node.meshes)
+//       scene.instantiate(imported.meshes[m]).transform = node.transform;
+struct ImportedScene {
+  std::vector<Mesh> meshes;
+  std::vector<ImportedNode> nodes; // parents come before their children
+};
+
+// Header of the binary meshes written by MeshUtils::saveBinary, followed by
+// the vertices and the triangles, laid out as they are uploaded
+struct MeshCacheHeader {
+  // To bump whenever the layout of the file, of Vertex or of Triangle changes
+  static constexpr uint32_t currentVersion = 1;
+
+  char magic[4];
+  uint32_t version;
+  uint32_t vertexCount;
+  uint32_t triangleCount;
+  // Material
+  char materialName[64];
+  float ambient[3];
+  float diffuse[3];
+  float specular[3];
+  int32_t mask;
+  // Bounds of the vertices
+  float min[3];
+  float max[3];
+  // Identifies what the mesh was imported from, 0 if unknown
+  uint64_t sourceHash;
+};
+
+// A cluster of neighbouring triangles, contiguous in Mesh::triangles, and
+// what is needed to cull it as a whole. Laid out for std430.
+struct Meshlet {
+  Vector4f sphere;   // bounding sphere: center and radius
+  Vector4f coneApex; // w: cutoff, the meshlet faces away from every camera
+                     // with dot(normalize(apex - camera), axis) >= cutoff
+  Vector4f coneAxis; // average normal, w unused
+  uint32_t firstTriangle;
+  uint32_t triangleCount;
+  uint32_t padding[2];
+};
+
+// Amounts of vertices and triangles of a generated mesh, to allocate what the
+// in-place generators write to
+struct MeshSize {
+  size_t vertexCount;
+  size_t triangleCount;
+};
+
 class MeshUtils {
 public:
+  // Generated meshes are sized up front and filled on every core
   static Mesh createGrid(float length, int amount_widht, int amount_height);
   static Mesh createCube(float side_length = 1.0f);
   static Mesh createSphere(float radius = 1.0f, int n_slices = 10,
                            int n_stacks = 10);
+
+  static MeshSize gridSize(int amount_widht, int amount_height);
+  static MeshSize cubeSize();
+  static MeshSize sphereSize(int n_slices = 10, int n_stacks = 10);
+  // The same meshes, written in place to memory of the size above (e.g a
+  // mapped upload buffer, from Buffer::populate)
+  static void fillGrid(float length, int amount_widht, int amount_height,
+                       Vertex *vertices, Triangle *triangles);
+  static void fillCube(float side_length, Vertex *vertices,
+                       Triangle *triangles);
+  static void fillSphere(float radius, int n_slices, int n_stacks,
+                         Vertex *vertices, Triangle *triangles);
+  // Every mesh of the file merged in a single one, in world space
   static Mesh loadFromFile(const char *path, bool smoothNormals = true);
+  // Meshes are converted on nbThreads worker threads (0 to use every core)
+  static ImportedScene importScene(const char *path, bool smoothNormals = true,
+                                   unsigned nbThreads = 0);
+  // Import several files concurrently, in the order of the paths
+  static std::vector<ImportedScene>
+  importScenes(const std::vector<std::string> &paths,
+               bool smoothNormals = true, unsigned nbThreads = 0);
   static Mesh createNodalMesh();
+
+  // Fast path for plain triangle soups, skipping assimp: OBJ and binary PLY
+  // files are mapped and parsed by chunks on nbThreads threads (0 to use
+  // every core), identical vertices are welded and missing normals are
+  // smoothed. Materials are not read. Other formats go through loadFromFile.
+  static Mesh loadFast(const char *path, unsigned nbThreads = 0);
+  static Mesh loadObj(const char *path, unsigned nbThreads = 0);
+  static Mesh loadPly(const char *path, unsigned nbThreads = 0);
+
+  // Flim binary meshes, read back without any parsing: the vertices and
+  // triangles are copied out of the mapped file in one go. Since the Mesh
+  // owns its arrays, uploading it makes a second copy into staging memory.
+  static void saveBinary(const Mesh &m, const std::string &path,
+                         uint64_t sourceHash = 0);
+  // Returns nothing if the file is missing, from another version, or does
+  // not match sourceHash (when it is not 0)
+  static std::optional<Mesh> loadBinary(const std::string &path,
+                                        uint64_t sourceHash = 0);
+  // loadFromFile, through binary meshes kept in cacheDir. The first import
+  // of a file writes it, later ones load it as long as the file is unchanged.
+  static Mesh loadCached(const char *path, const std::string &cacheDir = "cache",
+                         bool smoothNormals = true);
+  // Identifies what loadCached imports from path: changes with the path, the
+  // content (through its size and modification time) and the options. Also
+  // keys the BVH caches of the mesh, see BVH::save.
+  static uint64_t importKey(const char *path, bool smoothNormals = true);
+
+  // Greedily grow clusters of at most maxVertices vertices and maxTriangles
+  // triangles over the connected triangles of m, preferring the ones adding
+  // the fewest vertices and facing the same way. The triangles of m are
+  // reordered so that each meshlet is a range of them.
+  static std::vector<Meshlet> buildMeshlets(Mesh &m, uint32_t maxVertices = 64,
+                                            uint32_t maxTriangles = 124);
 };
 
 } // namespace Flim
@@ -0,0 +1,218 @@
+#include "api/render/mesh.hh"
+#include "api/render/mesh_utils.hh"
+#include "utils/checks.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+// Meshlet partitioning, and the bounds used to cull the meshlets on the GPU
+
+namespace Flim {
+
+// Ritter's bounding sphere, at most a few percent larger than the optimal one
+static Vector4f boundingSphere(const std::vector<Vector3f> &points) {
+  auto farthest = [&](const Vector3f &from) {
+    return *std::max_element(points.begin(), points.end(),
+                             [&](const Vector3f &a, const Vector3f &b) {
+                               return (a - from).squaredNorm() <
+                                      (b - from).squaredNorm();
+                             });
+  };
+  Vector3f a = farthest(points[0]);
+  Vector3f b = farthest(a);
+  Vector3f center = (a + b) / 2.0f;
+  float radius = (b - a).norm() / 2.0f;
+  for (const Vector3f &p : points) {
+    float dist = (p - center).norm();
+    if (dist > radius) {
+      // Grow the sphere just enough to hold p
+      float grown = (radius + dist) / 2.0f;
+      center += (p - center) * ((grown - radius) / dist);
+      radius = grown;
+    }
+  }
+  return Vector4f(center.x(), center.y(), center.z(), radius);
+}
+
+// Normal cone of the meshlet, its apex being behind every triangle so that
+// perspective is accounted for (as in meshoptimizer's meshopt_computeMeshletBounds)
+static void normalCone(Meshlet &meshlet, const Mesh &m,
+                       const std::vector<Vector3f> &normals) {
+  const uint32_t first = meshlet.firstTriangle;
+  const uint32_t last = first + meshlet.triangleCount;
+  Vector3f axis = Vector3f::Zero();
+  for (uint32_t t = first; t < last; t++)
+    axis += normals[t];
+  meshlet.coneAxis = Vector4f::Zero();
+  // Never culled unless the cone is narrower than ~85 degrees
+  meshlet.coneApex = Vector4f(0.0f, 0.0f, 0.0f, 2.0f);
+  if (axis.squaredNorm() == 0.0f)
+    return;
+  axis.normalize();
+  meshlet.coneAxis.head<3>() = axis;
+
+  float minDot = 1.0f;
+  for (uint32_t t = first; t < last; t++)
+    if (normals[t] != Vector3f::Zero())
+      minDot = std::min(minDot, normals[t].dot(axis));
+  if (minDot <= 0.1f)
+    return;
+
+  // Move the apex back along the axis until it is behind every triangle
+  Vector3f center = meshlet.sphere.head<3>();
+  float maxT = 0.0f;
+  for (uint32_t t = first; t < last; t++) {
+    if (normals[t] == Vector3f::Zero())
+      continue;
+    const Vector3f &corner = m.vertices[m.triangles[t].x()].pos;
+    float dist = (center - corner).dot(normals[t]) / axis.dot(normals[t]);
+    maxT = std::max(maxT, dist);
+  }
+  Vector3f apex = center - axis * maxT;
+  // The normal cone widened by 90 degrees on both sides, then flipped
+  meshlet.coneApex =
+      Vector4f(apex.x(), apex.y(), apex.z(), sqrtf(1.0f - minDot * minDot));
+}
+
+std::vector<Meshlet> MeshUtils::buildMeshlets(Mesh &m, uint32_t maxVertices,
+                                              uint32_t maxTriangles) {
+  CHECK(maxVertices >= 3 && maxTriangles >= 1,
+        "A meshlet needs room for at least one triangle");
+  const size_t nbVertices = m.vertices.size();
+  const size_t nbTriangles = m.triangles.size();
+  std::vector<Meshlet> meshlets;
+  if (nbTriangles == 0)
+    return meshlets;
+
+  std::vector<Vector3f> normals(nbTriangles);
+  for (size_t t = 0; t < nbTriangles; t++) {
+    const Triangle &tri = m.triangles[t];
+    const Vector3f &p0 = m.vertices[tri.x()].pos;
+    Vector3f n =
+        (m.vertices[tri.y()].pos - p0).cross(m.vertices[tri.z()].pos - p0);
+    float norm = n.norm();
+    normals[t] = norm > 0.0f ? Vector3f(n / norm) : Vector3f::Zero();
+  }
+
+  // Triangles around each vertex
+  std::vector<uint32_t> first(nbVertices + 1, 0);
+  for (const Triangle &t : m.triangles)
+    for (uint32_t v : t)
+      first[v + 1]++;
+  std::partial_sum(first.begin(), first.end(), first.begin());
+  std::vector<uint32_t> adjacent(first.back());
+  {
+    std::vector<uint32_t> cursor(first.begin(), first.end() - 1);
+    for (uint32_t t = 0; t < nbTriangles; t++)
+      for (uint32_t v : m.triangles[t])
+        adjacent[cursor[v]++] = t;
+  }
+
+  std::vector<bool> used(nbTriangles, false);
+  // Meshlet a vertex was last added to, to count the new vertices
+  std::vector<uint32_t> owner(nbVertices, UINT32_MAX);
+  std::vector<uint32_t> order;
+  order.reserve(nbTriangles);
+  std::vector<uint32_t> vertices;
+  vertices.reserve(maxVertices);
+  size_t seed = 0;
+
+  while (order.size() < nbTriangles) {
+    while (used[seed])
+      seed++;
+    const uint32_t id = meshlets.size();
+    Meshlet &meshlet = meshlets.emplace_back();
+    meshlet.firstTriangle = order.size();
+    meshlet.triangleCount = 0;
+    vertices.clear();
+    Vector3f axis = Vector3f::Zero();
+
+    auto newVertices = [&](uint32_t t) {
+      uint32_t count = 0;
+      for (uint32_t v : m.triangles[t])
+        count += owner[v] != id;
+      return count;
+    };
+    auto add = [&](uint32_t t) {
+      used[t] = true;
+      order.push_back(t);
+      meshlet.triangleCount++;
+      axis += normals[t];
+      for (uint32_t v : m.triangles[t])
+        if (owner[v] != id) {
+          owner[v] = id;
+          vertices.push_back(v);
+        }
+    };
+    // Best unused triangle around the given vertices that still fits, -1 if
+    // there is none
+    auto bestAround = [&](auto begin, auto end) {
+      int64_t best = -1;
+      float bestScore = std::numeric_limits<float>::max();
+      Vector3f direction = axis.normalized();
+      for (auto v = begin; v != end; v++)
+        for (uint32_t a = first[*v]; a < first[*v + 1]; a++) {
+          uint32_t t = adjacent[a];
+          if (used[t])
+            continue;
+          uint32_t added = newVertices(t);
+          if (vertices.size() + added > maxVertices)
+            continue;
+          float score = added + (1.0f - normals[t].dot(direction));
+          if (score < bestScore) {
+            bestScore = score;
+            best = t;
+          }
+        }
+      return best;
+    };
+
+    add(seed);
+    while (meshlet.triangleCount < maxTriangles) {
+      // Neighbours of the last triangle first, then of the whole meshlet
+      const Triangle &last = m.triangles[order.back()];
+      int64_t next = bestAround(last.data(), last.data() + 3);
+      if (next < 0)
+        next = bestAround(vertices.begin(), vertices.end());
+      if (next < 0) {
+        // Nothing connected left. Small pieces (e.g triangle soups) are
+        // completed with the next triangles in order, usually close by, as
+        // long as they face the same way.
+        while (seed < nbTriangles && used[seed])
+          seed++;
+        if (meshlet.triangleCount >= maxTriangles / 4 || seed == nbTriangles ||
+            vertices.size() + newVertices(seed) > maxVertices ||
+            normals[seed].dot(axis.normalized()) < 0.5f)
+          break;
+        next = seed;
+      }
+      add(next);
+    }
+  }
+
+  std::vector<Triangle> triangles(nbTriangles);
+  std::vector<Vector3f> orderedNormals(nbTriangles);
+  for (size_t t = 0; t < nbTriangles; t++) {
+    triangles[t] = m.triangles[order[t]];
+    orderedNormals[t] = normals[order[t]];
+  }
+  m.triangles = std::move(triangles);
+
+  std::vector<Vector3f> points;
+  for (Meshlet &meshlet : meshlets) {
+    points.clear();
+    for (uint32_t t = meshlet.firstTriangle;
+         t < meshlet.firstTriangle + meshlet.triangleCount; t++)
+      for (uint32_t v : m.triangles[t])
+        points.push_back(m.vertices[v].pos);
+    meshlet.sphere = boundingSphere(points);
+    normalCone(meshlet, m, orderedNormals);
+    meshlet.padding[0] = meshlet.padding[1] = 0;
+  }
+  return meshlets;
+}
+
+} // namespace Flim
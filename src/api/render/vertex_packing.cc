@@ -0,0 +1,63 @@
+#include "vertex_packing.hh"
+#include "utils/packing.hh"
+#include "utils/parallel.hh"
+#include <algorithm>
+
+namespace Flim {
+
+VertexQuantization::VertexQuantization(const Mesh &m, PositionFormat format)
+    : offset(Vector3f::Zero()), scale(Vector3f::Ones()), format(format) {
+  if (m.vertices.empty())
+    return;
+  Vector3f min = m.vertices[0].pos;
+  Vector3f max = m.vertices[0].pos;
+  for (const Vertex &v : m.vertices) {
+    min = min.cwiseMin(v.pos);
+    max = max.cwiseMax(v.pos);
+  }
+  offset = (min + max) / 2.0f;
+  scale = (max - min) / 2.0f;
+}
+
+PackedVertex VertexQuantization::pack(const Vertex &v) const {
+  PackedVertex p{};
+  for (int i = 0; i < 3; i++) {
+    // Flat axes only have the offset
+    float value = scale[i] > 0.0f ? (v.pos[i] - offset[i]) / scale[i] : 0.0f;
+    value = std::clamp(value, -1.0f, 1.0f);
+    p.pos[i] = format == PositionFormat::HALF ? floatToHalf(value)
+                                              : (uint16_t)packSnorm16(value);
+  }
+  Vector2f n = octahedralEncode(v.normal);
+  p.normal[0] = packSnorm16(n.x());
+  p.normal[1] = packSnorm16(n.y());
+  p.uv[0] = floatToHalf(v.uv.x());
+  p.uv[1] = floatToHalf(v.uv.y());
+  return p;
+}
+
+Vertex VertexQuantization::unpack(const PackedVertex &p) const {
+  Vertex v;
+  for (int i = 0; i < 3; i++) {
+    float value = format == PositionFormat::HALF
+                      ? halfToFloat(p.pos[i])
+                      : unpackSnorm16((int16_t)p.pos[i]);
+    v.pos[i] = offset[i] + scale[i] * value;
+  }
+  v.normal = octahedralDecode(
+      Vector2f(unpackSnorm16(p.normal[0]), unpackSnorm16(p.normal[1])));
+  v.uv = Vector2f(halfToFloat(p.uv[0]), halfToFloat(p.uv[1]));
+  return v;
+}
+
+void VertexQuantization::pack(const Mesh &m, PackedVertex *out) const {
+  constexpr size_t blockSize = 1 << 16;
+  const size_t nbBlocks = (m.vertices.size() + blockSize - 1) / blockSize;
+  parallelFor(nbBlocks, 0, [&](size_t b) {
+    size_t end = std::min(m.vertices.size(), (b + 1) * blockSize);
+    for (size_t v = b * blockSize; v < end; v++)
+      out[v] = pack(m.vertices[v]);
+  });
+}
+
+} // namespace Flim
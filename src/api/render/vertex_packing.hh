@@ -0,0 +1,38 @@
+#pragma once
+#include "api/render/mesh.hh"
+#include <cstdint>
+
+namespace Flim {
+
+// Half the size of a Vertex, decoded by shaders/quantized.vert
+struct PackedVertex {
+  uint16_t pos[4];   // half or snorm16 relative to the mesh bounds, w unused
+  int16_t normal[2]; // octahedral, snorm16
+  uint16_t uv[2];    // half, so that repeating UVs are kept
+};
+static_assert(sizeof(PackedVertex) == 16);
+
+enum class PositionFormat {
+  HALF,    // denser around the center of the mesh
+  SNORM16, // uniform, 16 bits over the extent of each axis
+};
+
+// Maps the bounding box of a mesh onto [-1, 1]^3, positions being decoded as
+// offset + scale * p. It is computed once, so vertices moved out of the box
+// afterwards are clamped to it.
+class VertexQuantization {
+public:
+  VertexQuantization(const Mesh &m,
+                     PositionFormat format = PositionFormat::SNORM16);
+
+  PackedVertex pack(const Vertex &v) const;
+  Vertex unpack(const PackedVertex &p) const;
+  // Pack every vertex of m in out, in parallel for large meshes
+  void pack(const Mesh &m, PackedVertex *out) const;
+
+  Vector3f offset;
+  Vector3f scale;
+  PositionFormat format;
+};
+
+} // namespace Flim
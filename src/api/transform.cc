@@ -1,10 +1,44 @@
 #include "transform.hh"
+#include "api/render/mesh.hh"
 #include "utils/geometry.hh"
 #include <Eigen/src/Core/Matrix.h>
 #include <Eigen/src/Geometry/Quaternion.h>
 
 namespace Flim {
 
+Transform &Transform::operator=(const Transform &from) {
+  position = from.position;
+  rotation = from.rotation;
+  scale = from.scale;
+  changed();
+  return *this;
+}
+
+void Transform::setPosition(const Vector3f &p) {
+  position = p;
+  changed();
+}
+
+void Transform::setRotation(const Quaternionf &r) {
+  rotation = r;
+  changed();
+}
+
+void Transform::setScale(const Vector3f &s) {
+  scale = s;
+  changed();
+}
+
+void Transform::track(Mesh *mesh, uint32_t id) {
+  trackingMesh = mesh;
+  trackedId = id;
+}
+
+void Transform::changed() {
+  if (trackingMesh != nullptr)
+    trackingMesh->instanceChanged(trackedId);
+}
+
 // Right hand rule applies
 Vector3f Transform::front() const {
   // The forward vector in world space (-Z)
@@ -19,10 +53,10 @@ Vector3f Transform::right() const {
   return (rotation * world_right).normalized();
 }
 
-void Transform::translate(Vector3f v) { position = position + v; }
+void Transform::translate(Vector3f v) { setPosition(position + v); }
 
 void Transform::lookAt(Vector3f target) {
-  rotation = lookToward(position - target);
+  setRotation(lookToward(position - target));
 }
 
 Matrix4f Transform::getViewMatrix() const {
@@ -8,15 +8,27 @@ const Vector3f world_front = Vector3f(0, 0, -1);
 const Vector3f world_right = Vector3f(1, 0, 0);
 const Vector3f world_up = Vector3f(0, 1, 0);
 
+class Mesh;
+
+// Every change goes through the setters, so that the buffers depending on the
+// transform are only written again when it changed (see track)
 class Transform {
 
 public:
   Transform()
       : position({0, 0, 0}), rotation(Quaternionf::Identity()),
         scale(Vector3f(1, 1, 1)) {};
-  Vector3f position;
-  Quaternionf rotation;
-  Vector3f scale;
+  // Only the values are copied, the transform being tracked as before
+  Transform(const Transform &from)
+      : position(from.position), rotation(from.rotation), scale(from.scale) {};
+  Transform &operator=(const Transform &from);
+
+  const Vector3f &getPosition() const { return position; }
+  const Quaternionf &getRotation() const { return rotation; }
+  const Vector3f &getScale() const { return scale; }
+  void setPosition(const Vector3f &p);
+  void setRotation(const Quaternionf &r);
+  void setScale(const Vector3f &s);
 
   // Right hand rule applies
   Vector3f front() const;
@@ -27,6 +39,20 @@ public:
   void lookAt(Vector3f target);
 
   Matrix4f getViewMatrix() const;
+
+  // Tell the mesh its instance id changed on every change (see
+  // Mesh::instanceChanged)
+  void track(Mesh *mesh, uint32_t id);
+
+private:
+  void changed();
+
+  Vector3f position;
+  Quaternionf rotation;
+  Vector3f scale;
+
+  Mesh *trackingMesh = nullptr;
+  uint32_t trackedId = 0;
 };
 
 } // namespace Flim
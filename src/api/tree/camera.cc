@@ -13,13 +13,13 @@ void Camera::handleInputs2D(double deltaTime) {
   auto curSpeed = deltaTime * speed;
   auto win = scene.api.getWindow();
   if (glfwGetKey(win, GLFW_KEY_D) == GLFW_PRESS)
-    transform.position += curSpeed * world_right;
+    transform.translate(curSpeed * world_right);
   if (glfwGetKey(win, GLFW_KEY_A) == GLFW_PRESS)
-    transform.position += curSpeed * -world_right;
+    transform.translate(curSpeed * -world_right);
   if (glfwGetKey(win, GLFW_KEY_W) == GLFW_PRESS)
-    transform.position += curSpeed * world_up;
+    transform.translate(curSpeed * world_up);
   if (glfwGetKey(win, GLFW_KEY_S) == GLFW_PRESS)
-    transform.position += curSpeed * -world_up;
+    transform.translate(curSpeed * -world_up);
   if (glfwGetKey(win, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
     orthoScale += curSpeed;
   if (glfwGetKey(win, GLFW_KEY_SPACE) == GLFW_PRESS)
@@ -31,17 +31,17 @@ void Camera::handleInputs3D(double deltaTime) {
   auto win = scene.api.getWindow();
   float curSpeed = speed * deltaTime;
   if (glfwGetKey(win, GLFW_KEY_D) == GLFW_PRESS)
-    transform.position += curSpeed * transform.right();
+    transform.translate(curSpeed * transform.right());
   if (glfwGetKey(win, GLFW_KEY_A) == GLFW_PRESS)
-    transform.position += curSpeed * -transform.right();
+    transform.translate(curSpeed * -transform.right());
   if (glfwGetKey(win, GLFW_KEY_W) == GLFW_PRESS)
-    transform.position += curSpeed * transform.front();
+    transform.translate(curSpeed * transform.front());
   if (glfwGetKey(win, GLFW_KEY_S) == GLFW_PRESS)
-    transform.position += curSpeed * -transform.front();
+    transform.translate(curSpeed * -transform.front());
   if (glfwGetKey(win, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
-    transform.position += curSpeed * -world_up;
+    transform.translate(curSpeed * -world_up);
   if (glfwGetKey(win, GLFW_KEY_SPACE) == GLFW_PRESS)
-    transform.position += curSpeed * world_up;
+    transform.translate(curSpeed * world_up);
 
   float curSensivity = sensivity;
   if (glfwGetKey(win, GLFW_KEY_L) == GLFW_PRESS)
@@ -55,7 +55,7 @@ void Camera::handleInputs3D(double deltaTime) {
   pitch = std::max(std::min(pitch, lockPitch), -lockPitch);
 
   // Combine yaw and pitch (order matters: typically Yaw * Pitch)
-  transform.rotation = toQuaternion(0.0f, TO_RAD(pitch), TO_RAD(yaw));
+  transform.setRotation(toQuaternion(0.0f, TO_RAD(pitch), TO_RAD(yaw)));
 }
 
 void Camera::handleInputs(double deltaTime) {
@@ -67,11 +67,11 @@ void Camera::handleInputs(double deltaTime) {
 
 Matrix4f Camera::getViewMat() const {
   // Create a translation matrix
-  auto translation = Eigen::Translation3f(-transform.position);
+  auto translation = Eigen::Translation3f(-transform.getPosition());
   // Create a rotation matrix
   auto rotationMatrix = toQuaternion(0.0f, -TO_RAD(pitch), -TO_RAD(yaw));
   // Create a scale matrix
-  auto scaleMatrix = Eigen::Scaling(transform.scale);
+  auto scaleMatrix = Eigen::Scaling(transform.getScale());
 
   // Apply transformations in the same order as (translate, rotate, scale)
   return (scaleMatrix * rotationMatrix * translation).matrix();
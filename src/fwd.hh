@@ -13,6 +13,8 @@ using namespace Eigen;
 #include <GLFW/glfw3.h>
 #include <consts.hh>
 
+#include "vulkan/buffers/memory_allocator.hh"
+
 typedef struct SwapChainSupportDetails {
   VkSurfaceCapabilitiesKHR capabilities;
   std::vector<VkSurfaceFormatKHR> formats;
@@ -23,6 +25,11 @@ typedef struct Queues {
   VkQueue presentQueue;
   VkQueue graphicsQueue;
   VkQueue computeQueue;
+  // Of a transfer only family if there is one, the graphics queue otherwise
+  VkQueue transferQueue;
+  // Graphics and compute, then transfer (the same when there is no transfer
+  // only family)
+  uint32_t families[2];
 } Queues;
 
 // The pool of the commands to be sent to the device along with the
@@ -42,7 +49,7 @@ typedef struct CommandPool {
 
 typedef struct Image {
   VkImage textureImage;
-  VkDeviceMemory textureImageMemory;
+  Flim::MemoryAllocation textureImageMemory;
   VkImageView view;
   VkImageLayout layout;
   VkFormat format;
@@ -0,0 +1,83 @@
+#pragma once
+#include "api/bvh/bvh.hh"
+#include "api/bvh/wide_bvh.hh"
+#include <algorithm>
+#include <cassert>
+#include <span>
+
+#include <Kokkos_Core.hpp>
+
+namespace Flim {
+
+// The batched queries below take a BVH or a WideBVH
+
+// castRays of the tree with the batch split across the host cores, each
+// thread tracing whole packets
+template <typename Tree>
+void castRays(const Tree &bvh, std::span<const Ray> rays,
+              std::span<Hit> hits) {
+  assert(hits.size() >= rays.size());
+  constexpr size_t packetSize = Tree::packetSize;
+  size_t nbPackets = (rays.size() + packetSize - 1) / packetSize;
+  Kokkos::parallel_for(
+      "BVH cast rays",
+      Kokkos::RangePolicy<Kokkos::DefaultHostExecutionSpace>(0, nbPackets),
+      [&](const size_t packet) {
+        size_t first = packet * packetSize;
+        size_t amount = std::min(packetSize, rays.size() - first);
+        bvh.castRays(rays.subspan(first, amount),
+                     hits.subspan(first, amount));
+      });
+  Kokkos::fence("BVH rays cast");
+}
+
+// Leaf pass of BVH::refitWith, spread across the host cores
+struct RefitLeaves {
+  template <typename F> void operator()(size_t n, const F &f) const {
+    Kokkos::parallel_for(
+        "BVH refit leaves",
+        Kokkos::RangePolicy<Kokkos::DefaultHostExecutionSpace>(0, n),
+        [&](const size_t i) { f(i); });
+    Kokkos::fence("BVH leaves refitted");
+  }
+};
+
+// BVH::refit with the leaves refitted across the host cores, e.g every frame
+// for a deforming mesh
+template <int nbElems, typename Source>
+bool refit(BVH<nbElems, Source> &bvh, float maxAreaGrowth = INFINITY) {
+  return bvh.refitWith(maxAreaGrowth, RefitLeaves());
+}
+
+// Same, reading the vertices from a new place (the next frame's buffer...)
+template <int nbElems, typename Source>
+bool refit(BVH<nbElems, Source> &bvh, const Source &source,
+           float maxAreaGrowth = INFINITY) {
+  return bvh.refitWith(source, maxAreaGrowth, RefitLeaves());
+}
+
+// closestPoint for a batch of query points, spread across the host cores
+template <typename Tree>
+void closestPoints(const Tree &bvh, std::span<const Vector3f> points,
+                   std::span<ClosestPoint> results, float maxDist = INFINITY) {
+  assert(results.size() >= points.size());
+  Kokkos::parallel_for(
+      "BVH closest points",
+      Kokkos::RangePolicy<Kokkos::DefaultHostExecutionSpace>(0, points.size()),
+      [&](const size_t i) { results[i] = bvh.closestPoint(points[i], maxDist); });
+  Kokkos::fence("BVH closest points found");
+}
+
+// distance for a batch of query points, spread across the host cores
+template <typename Tree>
+void distances(const Tree &bvh, std::span<const Vector3f> points,
+               std::span<float> results, float maxDist = INFINITY) {
+  assert(results.size() >= points.size());
+  Kokkos::parallel_for(
+      "BVH distances",
+      Kokkos::RangePolicy<Kokkos::DefaultHostExecutionSpace>(0, points.size()),
+      [&](const size_t i) { results[i] = bvh.distance(points[i], maxDist); });
+  Kokkos::fence("BVH distances computed");
+}
+
+}; // namespace Flim
@@ -0,0 +1,527 @@
+#pragma once
+#include "api/bvh/bvh.hh"
+#include "kokkos/renderer_accesser.hh"
+#include <cstdint>
+
+#include <Kokkos_Core.hpp>
+
+namespace Flim {
+
+#define LBVH_LEAF UINT32_MAX
+
+// Node of a linear BVH. Internal nodes point to their two children, leaves
+// have right set to LBVH_LEAF and left set to the triangle they hold.
+struct LBVHNode {
+  AABB box;
+  uint32_t left;
+  uint32_t right;
+
+  KOKKOS_INLINE_FUNCTION bool isLeaf() const { return right == LBVH_LEAF; }
+};
+
+KOKKOS_INLINE_FUNCTION int countLeadingZeros(uint32_t x) {
+#if defined(__CUDA_ARCH__) || defined(__HIP_DEVICE_COMPILE__)
+  return __clz(x);
+#else
+  return x == 0 ? 32 : __builtin_clz(x);
+#endif
+}
+
+// Spread the 10 lower bits of v so that there are two zeros between each bit
+KOKKOS_INLINE_FUNCTION uint32_t expandBits(uint32_t v) {
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+// 30 bits Morton code of a point given in the [0, 1] unit cube
+KOKKOS_INLINE_FUNCTION uint32_t morton3D(float x, float y, float z) {
+  x = fminf(fmaxf(x * 1024.0f, 0.0f), 1023.0f);
+  y = fminf(fmaxf(y * 1024.0f, 0.0f), 1023.0f);
+  z = fminf(fmaxf(z * 1024.0f, 0.0f), 1023.0f);
+  return (expandBits((uint32_t)x) << 2) | (expandBits((uint32_t)y) << 1) |
+         expandBits((uint32_t)z);
+}
+
+// Union of boxes as a Kokkos reducer, to get the bounds of a set of points or
+// boxes in a single parallel_reduce
+struct AABBUnion {
+  using reducer = AABBUnion;
+  using value_type = AABB;
+  using result_view_type =
+      Kokkos::View<value_type, Kokkos::HostSpace, Kokkos::MemoryUnmanaged>;
+
+  KOKKOS_INLINE_FUNCTION AABBUnion(value_type &result) : result(&result) {}
+  KOKKOS_INLINE_FUNCTION void join(value_type &dst,
+                                   const value_type &src) const {
+    dst.grow(src);
+  }
+  KOKKOS_INLINE_FUNCTION void init(value_type &val) const { val = AABB(); }
+  KOKKOS_INLINE_FUNCTION value_type &reference() const {
+    return *result.data();
+  }
+  KOKKOS_INLINE_FUNCTION result_view_type view() const { return result; }
+  KOKKOS_INLINE_FUNCTION bool references_scalar() const { return true; }
+
+private:
+  result_view_type result;
+};
+
+/**
+ * Linear BVH built in parallel with Kokkos, following Karras 2012 ("Maximizing
+ * parallelism in the construction of BVHs, octrees, and k-d trees").
+ * Triangles are sorted along a Morton curve and the hierarchy is emitted with
+ * one thread per internal node, so the whole build is a handful of kernels
+ * that can run every frame on meshes deformed on the device.
+ *
+ * The n - 1 internal nodes come first (the root is node 0) followed by the n
+ * leaves, in Morton order.
+ */
+template <typename ExecSpace = Kokkos::DefaultExecutionSpace> class LBVH {
+public:
+  using VertexView = Kokkos::View<VertexW *, ExecSpace>;
+  using TriangleView = Kokkos::View<Vector3uW *, ExecSpace>;
+  template <typename T> using DeviceView = Kokkos::View<T *, ExecSpace>;
+
+  // Size of the traversal stacks. The common prefix of the keys (30 bits of
+  // Morton code then 32 bits of leaf index for equal codes) grows by at least
+  // one bit from a node to its children, so a path from the root crosses at
+  // most 64 internal nodes, and a stack holds at most one more entry than that.
+  static constexpr int maxDepth = 66;
+
+  LBVH() = default;
+
+  // Build over the vertices and indices used to draw a registered mesh, which
+  // must not have RenderParams::compactIndices on.
+  LBVH(const Renderer &r) {
+    build(getAttributeBufferView<VertexW>(r,
+                                          BINDING_DEFAULT_VERTICES_ATTRIBUTES),
+          getIndexBufferView(r));
+  }
+
+  // Build over the CPU copy of a mesh, only for host execution spaces
+  LBVH(Mesh &m) {
+    static_assert(
+        Kokkos::SpaceAccessibility<ExecSpace, Kokkos::HostSpace>::accessible,
+        "Building from a Mesh requires a host execution space");
+    build(VertexView((VertexW *)m.vertices.data(), m.vertices.size()),
+          TriangleView((Vector3uW *)m.triangles.data(), m.triangles.size()));
+  }
+
+  // (Re)build the whole hierarchy, the views are kept and read again by the
+  // queries so they must outlive the LBVH
+  void build(VertexView vertices, TriangleView triangles) {
+    this->vertices = vertices;
+    this->triangles = triangles;
+    uint32_t n = triangles.extent(0);
+    if (n == 0) {
+      nodes = DeviceView<LBVHNode>();
+      return;
+    }
+    if (nodes.extent(0) != 2 * n - 1) {
+      nodes = DeviceView<LBVHNode>("LBVH nodes", 2 * n - 1);
+      parents = DeviceView<uint32_t>("LBVH parents", 2 * n - 1);
+      flags = DeviceView<uint32_t>("LBVH refit flags", n);
+      mortons = DeviceView<uint32_t>("LBVH morton codes", n);
+      order = DeviceView<uint32_t>("LBVH sorted triangles", n);
+    }
+    computeMortonCodes();
+    sortMortonCodes();
+    emitHierarchy();
+    computeBounds();
+    builtArea = totalArea();
+  }
+
+  // Update the bounds for moved vertices in a single parallel bottom-up pass,
+  // keeping the hierarchy. The triangles must be the same as at build time.
+  // The tree is rebuilt instead once the total surface area of its nodes grows
+  // over maxAreaGrowth times the one of the last build. Returns true if the
+  // tree was rebuilt.
+  bool refit(VertexView vertices, float maxAreaGrowth = INFINITY) {
+    this->vertices = vertices;
+    if (nodes.extent(0) == 0)
+      return false;
+    computeBounds();
+    if (maxAreaGrowth == INFINITY || totalArea() <= builtArea * maxAreaGrowth)
+      return false;
+    build(vertices, triangles);
+    return true;
+  }
+
+  bool refit(const Renderer &r, float maxAreaGrowth = INFINITY) {
+    return refit(getAttributeBufferView<VertexW>(
+                     r, BINDING_DEFAULT_VERTICES_ATTRIBUTES),
+                 maxAreaGrowth);
+  }
+
+  // Sum of the surface area of every node
+  float totalArea() const {
+    float area = 0;
+    auto nodes = this->nodes;
+    Kokkos::parallel_reduce(
+        "LBVH total area", Kokkos::RangePolicy<ExecSpace>(0, nodes.extent(0)),
+        KOKKOS_LAMBDA(const uint32_t i, float &sum) {
+          sum += nodes(i).box.area();
+        },
+        area);
+    return area;
+  }
+
+  uint32_t size() const { return triangles.extent(0); }
+  DeviceView<LBVHNode> getNodes() const { return nodes; }
+
+  // Closest hit against the hierarchy, callable from inside a kernel
+  KOKKOS_INLINE_FUNCTION float traverse(const Ray &ray,
+                                        uint32_t &result) const {
+    float dist = INFINITY;
+    if (nodes.extent(0) == 0)
+      return dist;
+    const Vector3f invDir = ray.direction.cwiseInverse();
+    struct Candidate {
+      uint32_t node;
+      float entry;
+    } stack[maxDepth];
+    int top = 0;
+    if (ray.entry(nodes(0).box, invDir) != INFINITY)
+      stack[top++] = {0, 0.0f};
+
+    while (top > 0) {
+      Candidate cur = stack[--top];
+      if (cur.entry >= dist)
+        continue;
+      const LBVHNode &node = nodes(cur.node);
+      if (node.isLeaf()) {
+        Triangle t = triangles(node.left).get();
+        if (ray.intersects(vertices(t.x()).pos.get(), vertices(t.y()).pos.get(),
+                           vertices(t.z()).pos.get(), dist))
+          result = node.left;
+        continue;
+      }
+      // Cannot happen given maxDepth, kept against corrupted nodes
+      if (top + 2 > maxDepth)
+        Kokkos::abort("LBVH traversal stack overflow");
+      Candidate near = {node.left,
+                        ray.entry(nodes(node.left).box, invDir, dist)};
+      Candidate far = {node.right,
+                       ray.entry(nodes(node.right).box, invDir, dist)};
+      if (far.entry < near.entry) {
+        Candidate tmp = near;
+        near = far;
+        far = tmp;
+      }
+      if (far.entry != INFINITY)
+        stack[top++] = far;
+      if (near.entry != INFINITY)
+        stack[top++] = near;
+    }
+    return dist;
+  }
+
+  // Same interface as BVH::castRay, the ray is traced on the execution space
+  bool castRay(const Ray &ray, uint32_t *result,
+               float *distance = nullptr) const {
+    Kokkos::View<float, ExecSpace> dist("LBVH hit distance");
+    Kokkos::View<uint32_t, ExecSpace> prim("LBVH hit triangle");
+    const LBVH self = *this;
+    Kokkos::parallel_for(
+        "LBVH cast ray", Kokkos::RangePolicy<ExecSpace>(0, 1),
+        KOKKOS_LAMBDA(const int) { dist() = self.traverse(ray, prim()); });
+    auto hostDist =
+        Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), dist);
+    if (hostDist() == INFINITY)
+      return false;
+    auto hostPrim =
+        Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), prim);
+    *result = hostPrim();
+    if (distance != nullptr)
+      *distance = hostDist();
+    return true;
+  }
+
+  // Point of the surface closest to p within maxDist, callable from inside a
+  // kernel. Same branch and bound as BVH::closestPoint.
+  KOKKOS_INLINE_FUNCTION ClosestPoint
+  closestPoint(const Vector3f &p, float maxDist = INFINITY) const {
+    ClosestPoint best;
+    float bestSq = maxDist * maxDist;
+    if (nodes.extent(0) == 0)
+      return best;
+    struct Candidate {
+      uint32_t node;
+      float distSq;
+    } stack[maxDepth];
+    int top = 0;
+    float rootSq = nodes(0).box.distanceSquared(p);
+    if (rootSq < bestSq)
+      stack[top++] = {0, rootSq};
+
+    while (top > 0) {
+      Candidate cur = stack[--top];
+      if (cur.distSq >= bestSq)
+        continue;
+      const LBVHNode &node = nodes(cur.node);
+      if (node.isLeaf()) {
+        Triangle t = triangles(node.left).get();
+        Vector3f q = closestPointOnTriangle(p, vertices(t.x()).pos.get(),
+                                            vertices(t.y()).pos.get(),
+                                            vertices(t.z()).pos.get());
+        float distSq = (q - p).squaredNorm();
+        if (distSq < bestSq) {
+          bestSq = distSq;
+          best.triangle = node.left;
+          best.point = q;
+        }
+        continue;
+      }
+      // Cannot happen given maxDepth, kept against corrupted nodes
+      if (top + 2 > maxDepth)
+        Kokkos::abort("LBVH traversal stack overflow");
+      Candidate near = {node.left, nodes(node.left).box.distanceSquared(p)};
+      Candidate far = {node.right, nodes(node.right).box.distanceSquared(p)};
+      if (far.distSq < near.distSq) {
+        Candidate tmp = near;
+        near = far;
+        far = tmp;
+      }
+      if (far.distSq < bestSq)
+        stack[top++] = far;
+      if (near.distSq < bestSq)
+        stack[top++] = near;
+    }
+    if (best.valid())
+      best.distance = sqrtf(bestSq);
+    return best;
+  }
+
+  // Call f(triangle) for every triangle closer than radius to center,
+  // callable from inside a kernel
+  template <typename F>
+  KOKKOS_INLINE_FUNCTION void forEachInSphere(const Vector3f &center,
+                                              float radius, F &&f) const {
+    float radiusSq = radius * radius;
+    if (nodes.extent(0) == 0 || nodes(0).box.distanceSquared(center) > radiusSq)
+      return;
+    uint32_t stack[maxDepth];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const LBVHNode &node = nodes(stack[--top]);
+      if (node.isLeaf()) {
+        Triangle t = triangles(node.left).get();
+        Vector3f q = closestPointOnTriangle(center, vertices(t.x()).pos.get(),
+                                            vertices(t.y()).pos.get(),
+                                            vertices(t.z()).pos.get());
+        if ((q - center).squaredNorm() <= radiusSq)
+          f(node.left);
+        continue;
+      }
+      // Cannot happen given maxDepth, kept against corrupted nodes
+      if (top + 2 > maxDepth)
+        Kokkos::abort("LBVH traversal stack overflow");
+      if (nodes(node.right).box.distanceSquared(center) <= radiusSq)
+        stack[top++] = node.right;
+      if (nodes(node.left).box.distanceSquared(center) <= radiusSq)
+        stack[top++] = node.left;
+    }
+  }
+
+  // Closest points of a whole batch of query points, one thread per point
+  void closestPoints(DeviceView<Vector3fW> points,
+                     DeviceView<ClosestPoint> results,
+                     float maxDist = INFINITY) const {
+    const LBVH self = *this;
+    Kokkos::parallel_for(
+        "LBVH closest points",
+        Kokkos::RangePolicy<ExecSpace>(0, points.extent(0)),
+        KOKKOS_LAMBDA(const uint32_t i) {
+          results(i) = self.closestPoint(points(i).get(), maxDist);
+        });
+  }
+
+private:
+  VertexView vertices;
+  TriangleView triangles;
+
+  DeviceView<LBVHNode> nodes;
+  DeviceView<uint32_t> parents;
+  DeviceView<uint32_t> flags;
+  DeviceView<uint32_t> mortons;
+  DeviceView<uint32_t> order; // triangle id of each leaf
+  // Total node area right after the last build, the reference for refits
+  float builtArea = 0;
+
+  void computeMortonCodes() {
+    uint32_t n = triangles.extent(0);
+    auto vertices = this->vertices;
+    auto triangles = this->triangles;
+    auto mortons = this->mortons;
+    auto order = this->order;
+    auto centroid = KOKKOS_LAMBDA(const uint32_t i) {
+      Triangle t = triangles(i).get();
+      return Vector3f((vertices(t.x()).pos.get() + vertices(t.y()).pos.get() +
+                       vertices(t.z()).pos.get()) /
+                      3.0f);
+    };
+
+    // Bounds of the centroids, which the Morton grid is fitted to
+    AABB bounds;
+    Kokkos::parallel_reduce(
+        "LBVH centroid bounds", Kokkos::RangePolicy<ExecSpace>(0, n),
+        KOKKOS_LAMBDA(const uint32_t i, AABB &b) { b.grow(centroid(i)); },
+        AABBUnion(bounds));
+    const Vector3f min = bounds.min;
+    Vector3f extent = (bounds.max - min).cwiseMax(Vector3f::Constant(1e-20f));
+    Vector3f scale = extent.cwiseInverse();
+
+    Kokkos::parallel_for(
+        "LBVH morton codes", Kokkos::RangePolicy<ExecSpace>(0, n),
+        KOKKOS_LAMBDA(const uint32_t i) {
+          Vector3f p = (centroid(i) - min).cwiseProduct(scale);
+          mortons(i) = morton3D(p.x(), p.y(), p.z());
+          order(i) = i;
+        });
+  }
+
+  // Least significant digit radix sort of the Morton codes (and the triangle
+  // ids along with them), one bit per pass. Each pass is a stable split made
+  // of a prefix sum and a scatter.
+  void sortMortonCodes() {
+    uint32_t n = mortons.extent(0);
+    DeviceView<uint32_t> keys = mortons, values = order;
+    DeviceView<uint32_t> keysTmp(
+        Kokkos::ViewAllocateWithoutInitializing("LBVH sort keys"), n);
+    DeviceView<uint32_t> valuesTmp(
+        Kokkos::ViewAllocateWithoutInitializing("LBVH sort values"), n);
+    DeviceView<uint32_t> zerosBefore(
+        Kokkos::ViewAllocateWithoutInitializing("LBVH sort offsets"), n);
+
+    for (int bit = 0; bit < 30; bit++) {
+      uint32_t zeros = 0;
+      Kokkos::parallel_scan(
+          "LBVH radix count", Kokkos::RangePolicy<ExecSpace>(0, n),
+          KOKKOS_LAMBDA(const uint32_t i, uint32_t &update, const bool final) {
+            if (final)
+              zerosBefore(i) = update;
+            update += ((keys(i) >> bit) & 1) == 0;
+          },
+          zeros);
+      Kokkos::parallel_for(
+          "LBVH radix scatter", Kokkos::RangePolicy<ExecSpace>(0, n),
+          KOKKOS_LAMBDA(const uint32_t i) {
+            uint32_t dst = ((keys(i) >> bit) & 1) == 0
+                               ? zerosBefore(i)
+                               : zeros + i - zerosBefore(i);
+            keysTmp(dst) = keys(i);
+            valuesTmp(dst) = values(i);
+          });
+      std::swap(keys, keysTmp);
+      std::swap(values, valuesTmp);
+    }
+    // An even amount of passes leaves the result in the original views
+    static_assert(30 % 2 == 0);
+  }
+
+  // Length of the common prefix of the keys of leaves i and j, -1 if j is out
+  // of range. Equal codes are disambiguated with the leaf indices.
+  KOKKOS_INLINE_FUNCTION static int delta(const DeviceView<uint32_t> &codes,
+                                          int i, int j) {
+    if (j < 0 || j >= (int)codes.extent(0))
+      return -1;
+    uint32_t a = codes(i), b = codes(j);
+    if (a == b)
+      return 32 + countLeadingZeros((uint32_t)i ^ (uint32_t)j);
+    return countLeadingZeros(a ^ b);
+  }
+
+  void emitHierarchy() {
+    int n = mortons.extent(0);
+    auto nodes = this->nodes;
+    auto parents = this->parents;
+    auto mortons = this->mortons;
+    auto order = this->order;
+
+    Kokkos::parallel_for(
+        "LBVH leaves", Kokkos::RangePolicy<ExecSpace>(0, n),
+        KOKKOS_LAMBDA(const int i) {
+          if (i == 0)
+            parents(0) = LBVH_LEAF; // the root has no parent
+          nodes(n - 1 + i).left = order(i);
+          nodes(n - 1 + i).right = LBVH_LEAF;
+        });
+    Kokkos::parallel_for(
+        "LBVH internal nodes", Kokkos::RangePolicy<ExecSpace>(0, n - 1),
+        KOKKOS_LAMBDA(const int i) {
+          // Direction of the range covered by the node
+          int d = delta(mortons, i, i + 1) - delta(mortons, i, i - 1) > 0 ? 1
+                                                                         : -1;
+          // Upper bound of the length of the range
+          int deltaMin = delta(mortons, i, i - d);
+          int lmax = 2;
+          while (delta(mortons, i, i + lmax * d) > deltaMin)
+            lmax *= 2;
+          // Exact other end with a binary search
+          int l = 0;
+          for (int t = lmax / 2; t >= 1; t /= 2)
+            if (delta(mortons, i, i + (l + t) * d) > deltaMin)
+              l += t;
+          int j = i + l * d;
+          // Split position with a binary search
+          int deltaNode = delta(mortons, i, j);
+          int s = 0;
+          for (int t = (l + 1) / 2;; t = (t + 1) / 2) {
+            if (delta(mortons, i, i + (s + t) * d) > deltaNode)
+              s += t;
+            if (t == 1)
+              break;
+          }
+          int gamma = i + s * d + (d < 0 ? d : 0);
+
+          uint32_t left = (i < j ? i : j) == gamma ? n - 1 + gamma : gamma;
+          uint32_t right =
+              (i > j ? i : j) == gamma + 1 ? n - 1 + gamma + 1 : gamma + 1;
+          nodes(i).left = left;
+          nodes(i).right = right;
+          parents(left) = i;
+          parents(right) = i;
+        });
+  }
+
+  // Bottom-up bounds: a thread starts from each leaf and climbs up, only the
+  // second thread to reach a node goes on, once both children are ready
+  void computeBounds() {
+    int n = triangles.extent(0);
+    auto nodes = this->nodes;
+    auto parents = this->parents;
+    auto flags = this->flags;
+    auto vertices = this->vertices;
+    auto triangles = this->triangles;
+    Kokkos::deep_copy(flags, 0);
+
+    Kokkos::parallel_for(
+        "LBVH bounds", Kokkos::RangePolicy<ExecSpace>(0, n),
+        KOKKOS_LAMBDA(const int i) {
+          uint32_t cur = n - 1 + i;
+          LBVHNode &leaf = nodes(cur);
+          Triangle t = triangles(leaf.left).get();
+          leaf.box = AABB();
+          for (int k = 0; k < 3; k++)
+            leaf.box.grow(Vector3f(vertices(t[k]).pos.get()));
+          cur = parents(cur);
+          while (cur != LBVH_LEAF) {
+            Kokkos::memory_fence();
+            if (Kokkos::atomic_fetch_add(&flags(cur), 1u) == 0)
+              return;
+            Kokkos::memory_fence();
+            LBVHNode &node = nodes(cur);
+            node.box = nodes(node.left).box;
+            node.box.grow(nodes(node.right).box);
+            cur = parents(cur);
+          }
+        });
+    Kokkos::fence("LBVH built");
+  }
+};
+
+} // namespace Flim
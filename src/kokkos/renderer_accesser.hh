@@ -51,6 +51,9 @@ getAttributeBufferView(const Renderer &r, int binding,
 
 Kokkos::View<Vector3uW *, Kokkos::DefaultExecutionSpace>
 getIndexBufferView(const Renderer &r) {
+  CHECK(r.indexType == VK_INDEX_TYPE_UINT32,
+        "The index buffer uses 16-bit indices, please leave "
+        "RenderParams::compactIndices off to view it");
   return getBufferView<Vector3uW>(r.indexBuffer);
 }
 
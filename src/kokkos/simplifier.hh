@@ -0,0 +1,734 @@
+#pragma once
+#include "kokkos/renderer_accesser.hh"
+#include "utils/checks.hh"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <Kokkos_Core.hpp>
+
+namespace Flim {
+
+// Symmetric 4x4 error quadric of Garland and Heckbert (the upper triangle, row
+// by row), and the summed area of the planes it was made of
+struct Quadric {
+  float a[10];
+  float weight;
+
+  KOKKOS_INLINE_FUNCTION static Quadric zero() {
+    Quadric q;
+    for (int i = 0; i < 10; i++)
+      q.a[i] = 0.0f;
+    q.weight = 0.0f;
+    return q;
+  }
+
+  // Squared distance to the plane n.p + d = 0, scaled by weight
+  KOKKOS_INLINE_FUNCTION static Quadric plane(const Vector3f &n, float d,
+                                              float weight) {
+    Quadric q;
+    const float v[4] = {n.x(), n.y(), n.z(), d};
+    int k = 0;
+    for (int i = 0; i < 4; i++)
+      for (int j = i; j < 4; j++)
+        q.a[k++] = v[i] * v[j] * weight;
+    q.weight = weight;
+    return q;
+  }
+
+  KOKKOS_INLINE_FUNCTION Quadric &operator+=(const Quadric &o) {
+    for (int i = 0; i < 10; i++)
+      a[i] += o.a[i];
+    weight += o.weight;
+    return *this;
+  }
+
+  KOKKOS_INLINE_FUNCTION void atomicAddTo(Quadric &dst) const {
+    for (int i = 0; i < 10; i++)
+      Kokkos::atomic_add(&dst.a[i], a[i]);
+    Kokkos::atomic_add(&dst.weight, weight);
+  }
+
+  KOKKOS_INLINE_FUNCTION float eval(const Vector3f &p) const {
+    const float x = p.x(), y = p.y(), z = p.z();
+    float e = a[0] * x * x + 2.0f * a[1] * x * y + 2.0f * a[2] * x * z +
+              2.0f * a[3] * x + a[4] * y * y + 2.0f * a[5] * y * z +
+              2.0f * a[6] * y + a[7] * z * z + 2.0f * a[8] * z + a[9];
+    return e > 0.0f ? e : 0.0f; // rounding errors
+  }
+};
+
+/**
+ * Mesh simplification with quadric error metrics, made of data parallel
+ * Kokkos kernels so that it runs on the buffers of a registered mesh.
+ *
+ * Collapses are half-edge collapses, a vertex being merged into one of its
+ * neighbours, so every level of detail indexes the original vertices and they
+ * can all share one vertex buffer. Each pass, every vertex picks its cheapest
+ * valid collapse, and an independent set of them is applied at once: the
+ * collapses claim the triangles they read and write with an atomic min of
+ * their (cost, vertex) key, and are applied only if no conflicting collapse
+ * has a smaller key. The smallest key always wins, so every pass makes
+ * progress.
+ *
+ * The topology is the one of the positions: vertices sharing one are welded,
+ * so that attribute seams do not cut the mesh in pieces. Vertices with several
+ * copies (on a seam) or on a border or a non-manifold edge are never removed,
+ * so that the mesh is not torn apart.
+ */
+template <typename ExecSpace = Kokkos::DefaultExecutionSpace> class Simplifier {
+public:
+  using VertexView = Kokkos::View<VertexW *, ExecSpace>;
+  using TriangleView = Kokkos::View<Vector3uW *, ExecSpace>;
+  template <typename T> using DeviceView = Kokkos::View<T *, ExecSpace>;
+
+  // A level of a chain, as a range of its triangles
+  using LOD = MeshLOD;
+
+  // Collapses a vertex can choose from each pass, the cheapest ones
+  static constexpr int maxCandidates = 8;
+
+  // The triangles are copied, the vertices are only read
+  Simplifier(VertexView vertices, TriangleView triangles)
+      : count(triangles.extent(0)) {
+    const uint32_t n = vertices.extent(0);
+    this->triangles = TriangleView(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier triangles"), count);
+    Kokkos::deep_copy(this->triangles, triangles);
+    scratch = TriangleView(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier scratch"), count);
+    corners = TriangleView(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier corners"), count);
+    cornersScratch = TriangleView(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier corners scratch"),
+        count);
+    positions = DeviceView<Vector3fW>(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier positions"), n);
+    quadrics = DeviceView<Quadric>(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier quadrics"), n);
+    welded = DeviceView<uint32_t>(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier welded"), n);
+    locked = DeviceView<uint32_t>("Simplifier locked vertices", n);
+    offsets = DeviceView<uint32_t>("Simplifier adjacency offsets", n + 1);
+    adjacency = DeviceView<uint32_t>(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier adjacency"),
+        3 * count);
+    targets = DeviceView<uint32_t>(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier targets"), n);
+    keys = DeviceView<uint64_t>(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier keys"), n);
+    readClaims = DeviceView<uint64_t>(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier read claims"),
+        count);
+    writeClaims = DeviceView<uint64_t>(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier write claims"),
+        count);
+    owners = DeviceView<uint32_t>(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier owners"), count);
+    remap = DeviceView<uint32_t>(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier remap"), n);
+    histogram = DeviceView<uint32_t>("Simplifier cost histogram", nbBuckets);
+    maxError = Kokkos::View<float, ExecSpace>("Simplifier error");
+    applied = Kokkos::View<uint32_t, ExecSpace>("Simplifier collapses");
+    if (n == 0 || count == 0)
+      return;
+    normalizePositions(vertices);
+    weld(vertices);
+    buildAdjacency();
+    lockBorders();
+    computeQuadrics();
+  }
+
+  // Simplify the mesh drawn by a renderer, which must use 32-bit indices:
+  // leave RenderParams::compactIndices off when registering the mesh
+  Simplifier(const Renderer &r)
+      : Simplifier(getAttributeBufferView<VertexW>(
+                       r, BINDING_DEFAULT_VERTICES_ATTRIBUTES),
+                   getIndexBufferView(r)) {}
+
+  // Collapse edges until at most target triangles are left, or until no
+  // collapse is valid anymore. Returns the amount of triangles left.
+  uint32_t simplify(uint32_t target) {
+    while (count > target) {
+      // Each collapse removes two triangles
+      if (pass((count - target + 1) / 2) == 0)
+        break;
+    }
+    return count;
+  }
+
+  // The current triangles, valid until the next call to simplify
+  TriangleView getTriangles() const {
+    return Kokkos::subview(triangles, Kokkos::make_pair(0u, count));
+  }
+  uint32_t size() const { return count; }
+
+  // Largest error of a collapse so far, roughly the distance to the original
+  // surface
+  float getError() const {
+    auto host = Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(),
+                                                    maxError);
+    return host() / scale;
+  }
+
+  // Simplify down to each target in turn, which must be decreasing. The
+  // triangles of the current mesh (the level 0) and of every level after it
+  // are concatenated in chain.
+  std::vector<LOD> buildChain(const std::vector<uint32_t> &levelTargets,
+                              TriangleView &chain) {
+    std::vector<LOD> lods;
+    std::vector<TriangleView> levels;
+    uint32_t total = 0;
+    auto keep = [&]() {
+      TriangleView level(
+          Kokkos::ViewAllocateWithoutInitializing("Simplifier level"), count);
+      Kokkos::deep_copy(level, getTriangles());
+      levels.push_back(level);
+      lods.push_back({total, count, getError()});
+      total += count;
+    };
+    keep();
+    for (size_t i = 0; i < levelTargets.size(); i++) {
+      CHECK(i == 0 || levelTargets[i] <= levelTargets[i - 1],
+            "The targets of a LOD chain must be decreasing");
+      simplify(levelTargets[i]);
+      keep();
+    }
+    chain = TriangleView(
+        Kokkos::ViewAllocateWithoutInitializing("LOD chain"), total);
+    for (size_t i = 0; i < lods.size(); i++)
+      Kokkos::deep_copy(
+          Kokkos::subview(chain,
+                          Kokkos::make_pair(lods[i].firstTriangle,
+                                            lods[i].firstTriangle +
+                                                lods[i].triangleCount)),
+          levels[i]);
+    return lods;
+  }
+
+  // Replace the triangles of the CPU copy of a mesh with a chain built from
+  // them, before it is registered, only for host execution spaces. The
+  // levels are kept in m.lods for the renderer to choose from.
+  static void buildLODs(Mesh &m, const std::vector<uint32_t> &levelTargets) {
+    static_assert(
+        Kokkos::SpaceAccessibility<ExecSpace, Kokkos::HostSpace>::accessible,
+        "Building from a Mesh requires a host execution space");
+    TriangleView chain;
+    {
+      Simplifier simplifier(
+          VertexView((VertexW *)m.vertices.data(), m.vertices.size()),
+          TriangleView((Vector3uW *)m.triangles.data(), m.triangles.size()));
+      m.lods = simplifier.buildChain(levelTargets, chain);
+    }
+    m.triangles.resize(chain.extent(0));
+    memcpy((void *)m.triangles.data(), chain.data(),
+           chain.extent(0) * sizeof(Triangle));
+  }
+
+private:
+  static constexpr uint64_t noCandidate = UINT64_MAX;
+  enum Owner : uint32_t { FREE, READ, WRITTEN };
+  static constexpr uint32_t empty = UINT32_MAX;
+  // Buckets of the costs, indexed by the exponent and the 4 upper bits of the
+  // mantissa of the (positive) cost
+  static constexpr int bucketBits = 19;
+  static constexpr uint32_t nbBuckets = 1 << 12;
+  // Rounds of claims of a pass, most collapses are found by the first ones
+  static constexpr int maxRounds = 4;
+  // About one in expectedRatio of the cheapest candidates is collapsed
+  static constexpr uint32_t expectedRatio = 4;
+
+  uint32_t count;
+  // Positions fitted in the unit cube, so that float quadrics are precise
+  // enough whatever the scale of the mesh
+  float scale = 1.0f;
+  TriangleView triangles;
+  TriangleView scratch;
+  // The triangles made of welded vertices, the topology
+  TriangleView corners;
+  TriangleView cornersScratch;
+  DeviceView<Vector3fW> positions;
+  // First vertex found with the same position, every vertex-indexed view
+  // below but remap is indexed with it
+  DeviceView<uint32_t> welded;
+  DeviceView<Quadric> quadrics;
+  DeviceView<uint32_t> locked;
+  // Triangles around each vertex
+  DeviceView<uint32_t> offsets;
+  DeviceView<uint32_t> adjacency;
+  // Cheapest valid collapse of each vertex, and its key
+  DeviceView<uint32_t> targets;
+  DeviceView<uint64_t> keys;
+  // Smallest key of the collapses reading (or writing) and writing each
+  // triangle, and how the applied ones use it
+  DeviceView<uint64_t> readClaims;
+  DeviceView<uint64_t> writeClaims;
+  DeviceView<uint32_t> owners;
+  // Vertex each vertex is replaced with by the current pass
+  DeviceView<uint32_t> remap;
+  DeviceView<uint32_t> histogram;
+  Kokkos::View<float, ExecSpace> maxError;
+  Kokkos::View<uint32_t, ExecSpace> applied;
+
+  KOKKOS_INLINE_FUNCTION static bool contains(const Triangle &t, uint32_t v) {
+    return t.x() == v || t.y() == v || t.z() == v;
+  }
+
+  // The cost, roughly, then the vertex shuffled by a bijection. Exact costs
+  // would order long chains of neighbours on regular meshes (with equal costs
+  // sorted by index), each round of claims only taking the head of each chain.
+  KOKKOS_INLINE_FUNCTION static uint64_t makeKey(float cost, uint32_t vertex) {
+    uint32_t bits;
+    memcpy(&bits, &cost, sizeof(bits));
+    vertex *= 0x9e3779b1u;
+    vertex ^= vertex >> 15;
+    vertex *= 0x85ebca6bu;
+    vertex ^= vertex >> 13;
+    return ((uint64_t)(bits >> bucketBits) << 32) | vertex;
+  }
+
+  void normalizePositions(VertexView vertices) {
+    const uint32_t n = vertices.extent(0);
+    Vector3f min, max;
+    for (int axis = 0; axis < 3; axis++) {
+      Kokkos::MinMaxScalar<float> bounds;
+      Kokkos::parallel_reduce(
+          "Simplifier bounds", Kokkos::RangePolicy<ExecSpace>(0, n),
+          KOKKOS_LAMBDA(const uint32_t i, Kokkos::MinMaxScalar<float> &b) {
+            float c = vertices(i).pos.vec[axis];
+            b.min_val = fminf(b.min_val, c);
+            b.max_val = fmaxf(b.max_val, c);
+          },
+          Kokkos::MinMax<float>(bounds));
+      min[axis] = bounds.min_val;
+      max[axis] = bounds.max_val;
+    }
+    float extent = (max - min).maxCoeff();
+    scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+    const float scale = this->scale;
+    auto positions = this->positions;
+    Kokkos::parallel_for(
+        "Simplifier positions", Kokkos::RangePolicy<ExecSpace>(0, n),
+        KOKKOS_LAMBDA(const uint32_t i) {
+          positions(i).get() = (vertices(i).pos.get() - min) * scale;
+        });
+  }
+
+  // Welds the vertices through a hash table of their positions (with linear
+  // probing), and locks the ones that have several copies
+  void weld(VertexView vertices) {
+    const uint32_t n = vertices.extent(0);
+    uint32_t size = 1;
+    while (size < 2 * n)
+      size *= 2;
+    const uint32_t mask = size - 1;
+    DeviceView<uint32_t> table(
+        Kokkos::ViewAllocateWithoutInitializing("Simplifier weld table"), size);
+    Kokkos::deep_copy(table, empty);
+    auto welded = this->welded;
+    Kokkos::parallel_for(
+        "Simplifier weld", Kokkos::RangePolicy<ExecSpace>(0, n),
+        KOKKOS_LAMBDA(const uint32_t i) {
+          const float *p = vertices(i).pos.vec;
+          uint32_t bits[3];
+          memcpy(bits, p, sizeof(bits));
+          // Murmur3 finalizer, the low bits of the positions are often zeros
+          uint32_t h = (bits[0] * 0x9e3779b1u ^ bits[1]) * 0x9e3779b1u ^ bits[2];
+          h ^= h >> 16;
+          h *= 0x85ebca6bu;
+          h ^= h >> 13;
+          h *= 0xc2b2ae35u;
+          h ^= h >> 16;
+          h &= mask;
+          while (true) {
+            uint32_t cur = table(h);
+            if (cur == empty) {
+              cur = Kokkos::atomic_compare_exchange(&table(h), empty, i);
+              if (cur == empty) {
+                welded(i) = i;
+                return;
+              }
+            }
+            const float *q = vertices(cur).pos.vec;
+            if (p[0] == q[0] && p[1] == q[1] && p[2] == q[2]) {
+              welded(i) = cur;
+              return;
+            }
+            h = (h + 1) & mask;
+          }
+        });
+
+    auto copies = remap;
+    auto locked = this->locked;
+    Kokkos::deep_copy(copies, 0u);
+    Kokkos::parallel_for(
+        "Simplifier copies", Kokkos::RangePolicy<ExecSpace>(0, n),
+        KOKKOS_LAMBDA(const uint32_t i) {
+          Kokkos::atomic_add(&copies(welded(i)), 1u);
+        });
+    Kokkos::parallel_for(
+        "Simplifier seams", Kokkos::RangePolicy<ExecSpace>(0, n),
+        KOKKOS_LAMBDA(const uint32_t i) { locked(i) = copies(i) > 1; });
+
+    auto triangles = this->triangles;
+    auto corners = this->corners;
+    Kokkos::parallel_for(
+        "Simplifier corners", Kokkos::RangePolicy<ExecSpace>(0, count),
+        KOKKOS_LAMBDA(const uint32_t i) {
+          for (int k = 0; k < 3; k++)
+            corners(i).vec[k] = welded(triangles(i).vec[k]);
+        });
+  }
+
+  // Counting sort of the triangle corners by vertex, remap is free to use as
+  // the cursors between two passes
+  void buildAdjacency() {
+    const uint32_t n = positions.extent(0);
+    const uint32_t count = this->count;
+    auto corners = this->corners;
+    auto offsets = this->offsets;
+    auto adjacency = this->adjacency;
+    auto cursor = remap;
+    Kokkos::deep_copy(cursor, 0u);
+    Kokkos::parallel_for(
+        "Simplifier valences", Kokkos::RangePolicy<ExecSpace>(0, count),
+        KOKKOS_LAMBDA(const uint32_t i) {
+          Triangle t = corners(i).get();
+          for (int k = 0; k < 3; k++)
+            Kokkos::atomic_add(&cursor(t[k]), 1u);
+        });
+    Kokkos::parallel_scan(
+        "Simplifier adjacency offsets", Kokkos::RangePolicy<ExecSpace>(0, n),
+        KOKKOS_LAMBDA(const uint32_t i, uint32_t &update, const bool final) {
+          const uint32_t valence = cursor(i);
+          if (final) {
+            offsets(i) = update;
+            cursor(i) = update;
+            if (i == n - 1)
+              offsets(n) = update + valence;
+          }
+          update += valence;
+        });
+    Kokkos::parallel_for(
+        "Simplifier adjacency", Kokkos::RangePolicy<ExecSpace>(0, count),
+        KOKKOS_LAMBDA(const uint32_t i) {
+          Triangle t = corners(i).get();
+          for (int k = 0; k < 3; k++)
+            adjacency(Kokkos::atomic_fetch_add(&cursor(t[k]), 1u)) = i;
+        });
+  }
+
+  // Locks both ends of the edges without exactly one opposite half-edge
+  void lockBorders() {
+    auto corners = this->corners;
+    auto offsets = this->offsets;
+    auto adjacency = this->adjacency;
+    auto locked = this->locked;
+    Kokkos::parallel_for(
+        "Simplifier borders", Kokkos::RangePolicy<ExecSpace>(0, count),
+        KOKKOS_LAMBDA(const uint32_t i) {
+          Triangle t = corners(i).get();
+          for (int k = 0; k < 3; k++) {
+            const uint32_t a = t[k], b = t[(k + 1) % 3];
+            int opposite = 0;
+            for (uint32_t j = offsets(b); j < offsets(b + 1); j++) {
+              Triangle s = corners(adjacency(j)).get();
+              for (int l = 0; l < 3; l++)
+                opposite += s[l] == b && s[(l + 1) % 3] == a;
+            }
+            if (opposite != 1) {
+              locked(a) = 1;
+              locked(b) = 1;
+            }
+          }
+        });
+  }
+
+  // Planes of the triangles, weighted by their area
+  void computeQuadrics() {
+    auto corners = this->corners;
+    auto positions = this->positions;
+    auto quadrics = this->quadrics;
+    Kokkos::parallel_for(
+        "Simplifier clear quadrics",
+        Kokkos::RangePolicy<ExecSpace>(0, quadrics.extent(0)),
+        KOKKOS_LAMBDA(const uint32_t i) { quadrics(i) = Quadric::zero(); });
+    Kokkos::parallel_for(
+        "Simplifier quadrics", Kokkos::RangePolicy<ExecSpace>(0, count),
+        KOKKOS_LAMBDA(const uint32_t i) {
+          Triangle t = corners(i).get();
+          const Vector3f p0 = positions(t.x()).get();
+          Vector3f n = (positions(t.y()).get() - p0)
+                           .cross(positions(t.z()).get() - p0);
+          const float length = n.norm();
+          if (length == 0.0f)
+            return;
+          n /= length;
+          Quadric q = Quadric::plane(n, -n.dot(p0), length * 0.5f);
+          for (int k = 0; k < 3; k++)
+            q.atomicAddTo(quadrics(t[k]));
+        });
+  }
+
+  // Collapsing u into v must neither fold a triangle over nor make the mesh
+  // non-manifold (the link condition: u and v have as many common neighbours
+  // as common triangles)
+  KOKKOS_INLINE_FUNCTION static bool
+  canCollapse(uint32_t u, uint32_t v, const TriangleView &corners,
+              const DeviceView<Vector3fW> &positions,
+              const DeviceView<uint32_t> &offsets,
+              const DeviceView<uint32_t> &adjacency) {
+    const Vector3f target = positions(v).get();
+    uint32_t shared = 0;
+    for (uint32_t i = offsets(u); i < offsets(u + 1); i++) {
+      Triangle t = corners(adjacency(i)).get();
+      if (contains(t, v)) {
+        shared++;
+        continue;
+      }
+      Vector3f p[3], q[3];
+      for (int k = 0; k < 3; k++) {
+        p[k] = positions(t[k]).get();
+        q[k] = t[k] == u ? target : p[k];
+      }
+      Vector3f before = (p[1] - p[0]).cross(p[2] - p[0]);
+      Vector3f after = (q[1] - q[0]).cross(q[2] - q[0]);
+      // Turned by more than ~80 degrees, or flattened
+      if (after.squaredNorm() == 0.0f ||
+          after.dot(before) < 0.2f * after.norm() * before.norm())
+        return false;
+    }
+
+    uint32_t common = 0;
+    for (uint32_t i = offsets(u); i < offsets(u + 1); i++) {
+      Triangle t = corners(adjacency(i)).get();
+      for (int k = 0; k < 3; k++) {
+        const uint32_t w = t[k];
+        if (w == u || w == v)
+          continue;
+        bool seen = false;
+        for (uint32_t j = offsets(u); j < i && !seen; j++)
+          seen = contains(corners(adjacency(j)).get(), w);
+        if (seen)
+          continue;
+        for (uint32_t j = offsets(v); j < offsets(v + 1); j++)
+          if (contains(corners(adjacency(j)).get(), w)) {
+            common++;
+            break;
+          }
+      }
+    }
+    return shared > 0 && common == shared;
+  }
+
+  // One round of independent collapses, at most wanted. Returns the amount
+  // of collapses made.
+  uint32_t pass(uint32_t wanted) {
+    const uint32_t n = positions.extent(0);
+    auto triangles = this->triangles;
+    auto corners = this->corners;
+    auto welded = this->welded;
+    auto positions = this->positions;
+    auto quadrics = this->quadrics;
+    auto locked = this->locked;
+    auto offsets = this->offsets;
+    auto adjacency = this->adjacency;
+    auto targets = this->targets;
+    auto keys = this->keys;
+    auto readClaims = this->readClaims;
+    auto writeClaims = this->writeClaims;
+    auto remap = this->remap;
+    auto histogram = this->histogram;
+    auto maxError = this->maxError;
+
+    // Cheapest valid collapse of every vertex
+    Kokkos::deep_copy(histogram, 0u);
+    uint32_t candidates = 0;
+    Kokkos::parallel_reduce(
+        "Simplifier candidates", Kokkos::RangePolicy<ExecSpace>(0, n),
+        KOKKOS_LAMBDA(const uint32_t u, uint32_t &sum) {
+          keys(u) = noCandidate;
+          remap(u) = u;
+          if (locked(u) || offsets(u) == offsets(u + 1))
+            return;
+          // Sorted by cost, then by vertex to be deterministic
+          float costs[maxCandidates];
+          uint32_t ends[maxCandidates];
+          int nb = 0;
+          for (uint32_t i = offsets(u); i < offsets(u + 1); i++) {
+            Triangle t = corners(adjacency(i)).get();
+            for (int k = 0; k < 3; k++) {
+              const uint32_t v = t[k];
+              bool seen = v == u;
+              for (int c = 0; c < nb && !seen; c++)
+                seen = ends[c] == v;
+              if (seen)
+                continue;
+              Quadric q = quadrics(u);
+              q += quadrics(v);
+              const float cost = q.eval(positions(v).get());
+              int c = nb < maxCandidates ? nb++ : maxCandidates;
+              while (c > 0 && (costs[c - 1] > cost ||
+                               (costs[c - 1] == cost && ends[c - 1] > v))) {
+                if (c < maxCandidates) {
+                  costs[c] = costs[c - 1];
+                  ends[c] = ends[c - 1];
+                }
+                c--;
+              }
+              if (c < maxCandidates) {
+                costs[c] = cost;
+                ends[c] = v;
+              }
+            }
+          }
+          for (int c = 0; c < nb; c++)
+            if (canCollapse(u, ends[c], corners, positions, offsets,
+                            adjacency)) {
+              targets(u) = ends[c];
+              keys(u) = makeKey(costs[c], u);
+              Kokkos::atomic_add(&histogram(keys(u) >> 32), 1u);
+              sum++;
+              return;
+            }
+        },
+        candidates);
+    if (candidates == 0)
+      return 0;
+
+    // Only the cheapest candidates compete, at most half of them so that the
+    // order of the collapses stays close to the one of a sequential greedy
+    // simplification. Few of them end up in the independent set, so there are
+    // more than wanted, which caps the collapses themselves.
+    uint32_t allowed = candidates / 2 > 0 ? candidates / 2 : 1;
+    if (wanted * expectedRatio < allowed)
+      allowed = wanted * expectedRatio;
+    auto hostHistogram =
+        Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), histogram);
+    uint64_t lastBucket = 0;
+    for (uint32_t sum = 0; lastBucket < nbBuckets; lastBucket++) {
+      sum += hostHistogram(lastBucket);
+      if (sum >= allowed)
+        break;
+    }
+    const uint64_t maxKey = ((lastBucket + 1) << 32) - 1;
+
+    // Luby-style rounds. Collapsing u into v writes the triangles around u,
+    // and reads the ones around v. Each candidate claims them, the ones with
+    // a smaller key than every other candidate writing what they read or
+    // reading what they write are applied, which drops the candidates they
+    // conflict with in the next round.
+    auto owners = this->owners;
+    auto applied = this->applied;
+    Kokkos::deep_copy(Kokkos::subview(owners, Kokkos::make_pair(0u, count)),
+                      (uint32_t)FREE);
+    Kokkos::deep_copy(applied, 0u);
+    uint32_t collapses = 0;
+    for (int round = 0; round < maxRounds; round++) {
+      Kokkos::deep_copy(
+          Kokkos::subview(readClaims, Kokkos::make_pair(0u, count)),
+          noCandidate);
+      Kokkos::deep_copy(
+          Kokkos::subview(writeClaims, Kokkos::make_pair(0u, count)),
+          noCandidate);
+      Kokkos::parallel_for(
+          "Simplifier claims", Kokkos::RangePolicy<ExecSpace>(0, n),
+          KOKKOS_LAMBDA(const uint32_t u) {
+            const uint64_t key = keys(u);
+            if (key > maxKey)
+              return;
+            const uint32_t v = targets(u);
+            bool free = true;
+            for (uint32_t i = offsets(u); i < offsets(u + 1); i++)
+              free &= owners(adjacency(i)) == FREE;
+            for (uint32_t i = offsets(v); i < offsets(v + 1); i++)
+              free &= owners(adjacency(i)) != WRITTEN;
+            if (!free) {
+              keys(u) = noCandidate;
+              return;
+            }
+            for (uint32_t i = offsets(u); i < offsets(u + 1); i++) {
+              Kokkos::atomic_fetch_min(&readClaims(adjacency(i)), key);
+              Kokkos::atomic_fetch_min(&writeClaims(adjacency(i)), key);
+            }
+            for (uint32_t i = offsets(v); i < offsets(v + 1); i++)
+              Kokkos::atomic_fetch_min(&readClaims(adjacency(i)), key);
+          });
+
+      // u has a single copy, it is replaced with the copy of v its triangles
+      // already use
+      Kokkos::parallel_for(
+          "Simplifier collapses", Kokkos::RangePolicy<ExecSpace>(0, n),
+          KOKKOS_LAMBDA(const uint32_t u) {
+            const uint64_t key = keys(u);
+            if (key > maxKey)
+              return;
+            const uint32_t v = targets(u);
+            bool won = true;
+            for (uint32_t i = offsets(u); i < offsets(u + 1); i++)
+              won &= readClaims(adjacency(i)) == key;
+            for (uint32_t i = offsets(v); i < offsets(v + 1); i++)
+              won &= writeClaims(adjacency(i)) >= key;
+            if (!won || Kokkos::atomic_fetch_add(&applied(), 1u) >= wanted)
+              return;
+            keys(u) = noCandidate;
+            for (uint32_t i = offsets(v); i < offsets(v + 1); i++)
+              owners(adjacency(i)) = READ;
+            for (uint32_t i = offsets(u); i < offsets(u + 1); i++) {
+              owners(adjacency(i)) = WRITTEN;
+              Triangle t = triangles(adjacency(i)).get();
+              Triangle c = corners(adjacency(i)).get();
+              for (int k = 0; k < 3; k++)
+                if (c[k] == v)
+                  remap(u) = t[k];
+            }
+            Quadric q = quadrics(v);
+            q += quadrics(u);
+            const float cost = q.eval(positions(v).get());
+            if (q.weight > 0.0f)
+              Kokkos::atomic_fetch_max(&maxError(), sqrtf(cost / q.weight));
+            quadrics(v) = q;
+          });
+      auto hostApplied =
+          Kokkos::create_mirror_view_and_copy(Kokkos::HostSpace(), applied);
+      const uint32_t total = hostApplied() < wanted ? hostApplied() : wanted;
+      const bool stalled = total == collapses;
+      collapses = total;
+      if (stalled || collapses == wanted)
+        break;
+    }
+
+    // Move the triangles to the vertices kept, and drop the degenerate ones
+    auto scratch = this->scratch;
+    auto cornersScratch = this->cornersScratch;
+    uint32_t left = 0;
+    Kokkos::parallel_scan(
+        "Simplifier compaction", Kokkos::RangePolicy<ExecSpace>(0, count),
+        KOKKOS_LAMBDA(const uint32_t i, uint32_t &update, const bool final) {
+          Triangle t = triangles(i).get();
+          Triangle c = corners(i).get();
+          for (int k = 0; k < 3; k++)
+            if (remap(t[k]) != t[k]) {
+              t[k] = remap(t[k]);
+              c[k] = welded(t[k]);
+            }
+          if (c.x() == c.y() || c.y() == c.z() || c.z() == c.x())
+            return;
+          if (final) {
+            scratch(update).get() = t;
+            cornersScratch(update).get() = c;
+          }
+          update++;
+        },
+        left);
+    std::swap(this->triangles, this->scratch);
+    std::swap(this->corners, this->cornersScratch);
+    count = left;
+    if (collapses > 0)
+      buildAdjacency();
+    return collapses;
+  }
+};
+
+} // namespace Flim
@@ -0,0 +1,25 @@
+#pragma once
+#include "api/bvh/bvh.hh"
+#include "kokkos/renderer_accesser.hh"
+
+#include <Kokkos_Core.hpp>
+
+namespace Flim {
+
+// Source for a BVH reading straight from Kokkos views, which must live in a
+// memory space the host can access (an OpenMP build, a host mirror...)
+template <typename MemorySpace = Kokkos::HostSpace> struct ViewSource {
+  static_assert(
+      Kokkos::SpaceAccessibility<Kokkos::DefaultHostExecutionSpace,
+                                 MemorySpace>::accessible,
+      "A BVH is built and traversed on the host");
+
+  Kokkos::View<VertexW *, MemorySpace> vertices;
+  Kokkos::View<Vector3uW *, MemorySpace> triangles;
+
+  uint32_t size() const { return triangles.extent(0); }
+  Triangle triangle(uint32_t i) const { return triangles(i).get(); }
+  Vector3f vertex(uint32_t i) const { return vertices(i).pos.get(); }
+};
+
+}; // namespace Flim
@@ -38,3 +38,10 @@
   }
 
 #endif
+
+// Functions shared between host code and device kernels
+#if defined(FLIM_HIP) || defined(FLIM_CUDA)
+#define FLIM_INLINE_FUNCTION __host__ __device__ inline
+#else
+#define FLIM_INLINE_FUNCTION inline
+#endif
@@ -0,0 +1,57 @@
+#include "change_tracker.hh"
+
+#include <algorithm>
+
+namespace Flim {
+
+// Unchanged elements between two ranges closer than that are written again
+// rather than splitting the writes
+static constexpr uint32_t mergeGap = 8;
+
+void ChangeTracker::reset(size_t count, int copies) {
+  this->count = count;
+  this->copies.assign(copies, Copy());
+  for (Copy &copy : this->copies)
+    copy.marked.assign(count, false);
+}
+
+void ChangeTracker::markChanged(uint32_t id) {
+  if (id >= count)
+    return;
+  for (Copy &copy : copies) {
+    if (copy.all || copy.marked[id])
+      continue;
+    copy.marked[id] = true;
+    copy.changed.push_back(id);
+  }
+}
+
+void ChangeTracker::markAllChanged() {
+  for (Copy &copy : copies)
+    copy.all = true;
+}
+
+std::vector<ChangeTracker::Range> ChangeTracker::take(int id) {
+  Copy &copy = copies[id];
+  std::vector<Range> ranges;
+  // Past a quarter, a single write is faster than sorting them
+  if (copy.all || copy.changed.size() > count / 4) {
+    if (count != 0)
+      ranges.emplace_back(0, count);
+  } else {
+    std::sort(copy.changed.begin(), copy.changed.end());
+    for (uint32_t changed : copy.changed) {
+      if (!ranges.empty() && changed <= ranges.back().second + mergeGap)
+        ranges.back().second = changed + 1;
+      else
+        ranges.emplace_back(changed, changed + 1);
+    }
+  }
+  for (uint32_t changed : copy.changed)
+    copy.marked[changed] = false;
+  copy.changed.clear();
+  copy.all = false;
+  return ranges;
+}
+
+}; // namespace Flim
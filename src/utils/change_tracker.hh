@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace Flim {
+
+/**
+ * Tracks the elements of an array changed since each of the copies of its
+ * buffer (one per frame in flight) was last written, so that only those are
+ * written again. Marking an element costs one flag per copy, and the changes
+ * are collected in the order they happened, without going over the whole
+ * array. Not thread safe.
+ */
+class ChangeTracker {
+public:
+  // [first, last) elements
+  using Range = std::pair<uint32_t, uint32_t>;
+
+  // Track count elements over copies buffers, every element being changed
+  void reset(size_t count, int copies);
+  void markChanged(uint32_t id);
+  void markAllChanged();
+
+  // The ranges to write into the copy, sorted, then forgotten for it. Close
+  // ranges are merged, and every element is given at once when most of them
+  // changed.
+  std::vector<Range> take(int copy);
+
+  size_t size() const { return count; }
+
+private:
+  struct Copy {
+    bool all = true;
+    std::vector<bool> marked;
+    std::vector<uint32_t> changed;
+  };
+
+  size_t count = 0;
+  std::vector<Copy> copies;
+};
+
+}; // namespace Flim
@@ -0,0 +1,35 @@
+#include "mapped_file.hh"
+#include "utils/checks.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Flim {
+
+MappedFile::MappedFile(const std::string &path) : ptr(nullptr), length(0) {
+  int fd = open(path.c_str(), O_RDONLY);
+  CHECK(fd != -1, "Could not open " + path);
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    CHECK(false, "Could not stat " + path);
+  }
+  length = st.st_size;
+  if (length > 0) {
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    CHECK(mapped != MAP_FAILED, "Could not map " + path);
+    ptr = (const uint8_t *)mapped;
+  } else {
+    close(fd);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (ptr != nullptr)
+    munmap((void *)ptr, length);
+}
+
+} // namespace Flim
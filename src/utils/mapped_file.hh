@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Flim {
+
+// Read-only memory mapping of a whole file, unmapped on destruction. Pages
+// are loaded lazily by the OS, so data can be used in place right away.
+class MappedFile {
+public:
+  MappedFile(const std::string &path);
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile();
+
+  const uint8_t *data() const { return ptr; }
+  size_t size() const { return length; }
+
+private:
+  const uint8_t *ptr;
+  size_t length;
+};
+
+}; // namespace Flim
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+namespace Flim {
+
+// IEEE 754 binary16, rounded to the nearest even
+inline uint16_t floatToHalf(float value) {
+  uint32_t bits = std::bit_cast<uint32_t>(value);
+  uint16_t sign = (bits >> 16) & 0x8000;
+  uint32_t abs = bits & 0x7FFFFFFF;
+  if (abs >= 0x7F800000) // inf or nan
+    return sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0);
+  if (abs >= 0x477FF000) // rounds past 65504
+    return sign | 0x7C00;
+  if (abs < 0x38800000) // subnormal, in steps of 2^-24
+    return sign | (uint16_t)std::lrint(std::bit_cast<float>(abs) * 0x1p24f);
+  // Rebias the exponent (127 -> 15) and round the dropped 13 mantissa bits
+  return sign | ((abs - 0x38000000 + 0xFFF + ((abs >> 13) & 1)) >> 13);
+}
+
+inline float halfToFloat(uint16_t half) {
+  uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1F;
+  uint32_t mantissa = half & 0x3FF;
+  if (exponent == 0) {
+    float value = std::ldexp((float)mantissa, -24);
+    return sign ? -value : value;
+  }
+  if (exponent == 31)
+    return std::bit_cast<float>(sign | 0x7F800000 | (mantissa << 13));
+  return std::bit_cast<float>(sign | ((exponent + 112) << 23) |
+                              (mantissa << 13));
+}
+
+// Same conventions as VK_FORMAT_R16_SNORM
+inline int16_t packSnorm16(float value) {
+  return (int16_t)std::lrint(std::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+inline float unpackSnorm16(int16_t value) {
+  return std::max(value / 32767.0f, -1.0f);
+}
+
+// Octahedral encoding of a unit vector into [-1, 1]^2 (Cigolle et al. 2014)
+inline Eigen::Vector2f octahedralEncode(const Eigen::Vector3f &n) {
+  float l1 = std::abs(n.x()) + std::abs(n.y()) + std::abs(n.z());
+  if (l1 == 0.0f)
+    return Eigen::Vector2f::Zero();
+  Eigen::Vector2f p(n.x() / l1, n.y() / l1);
+  if (n.z() < 0.0f) {
+    // Fold the lower hemisphere over the diagonals
+    Eigen::Vector2f folded(1.0f - std::abs(p.y()), 1.0f - std::abs(p.x()));
+    p.x() = p.x() >= 0.0f ? folded.x() : -folded.x();
+    p.y() = p.y() >= 0.0f ? folded.y() : -folded.y();
+  }
+  return p;
+}
+
+inline Eigen::Vector3f octahedralDecode(const Eigen::Vector2f &p) {
+  Eigen::Vector3f n(p.x(), p.y(), 1.0f - std::abs(p.x()) - std::abs(p.y()));
+  float t = std::max(-n.z(), 0.0f);
+  n.x() += n.x() >= 0.0f ? -t : t;
+  n.y() += n.y() >= 0.0f ? -t : t;
+  return n.normalized();
+}
+
+} // namespace Flim
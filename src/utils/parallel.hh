@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Flim {
+
+// Amount of threads to use when 0 is asked for: every core
+inline unsigned resolveThreadCount(unsigned nbThreads) {
+  if (nbThreads != 0)
+    return nbThreads;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Run f(i) for i in [0, n) on nbThreads threads (the caller being one of
+// them, 0 to use every core), rethrowing the first exception once they are
+// all done. Indices are handed out one at a time, so work items should not
+// be too small.
+template <typename F>
+void parallelFor(size_t n, unsigned nbThreads, const F &f) {
+  nbThreads = std::min<size_t>(resolveThreadCount(nbThreads), n);
+
+  std::atomic<size_t> next = 0;
+  std::exception_ptr error;
+  std::mutex errorMutex;
+  auto work = [&]() {
+    for (size_t i = next++; i < n; i = next++) {
+      try {
+        f(i);
+      } catch (...) {
+        std::lock_guard lock(errorMutex);
+        if (!error)
+          error = std::current_exception();
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < nbThreads; t++)
+    workers.emplace_back(work);
+  work();
+  for (auto &w : workers)
+    w.join();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+}; // namespace Flim
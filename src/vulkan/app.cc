@@ -78,6 +78,8 @@ void VulkanApplication::setupGraphics(Flim::Scene &scene) {
   }
   for (auto &c : scene.computers)
     c->setup();
+  // Every upload of the setup at once
+  context.staging.flush();
 }
 
 void VulkanApplication::recreateSwapChain() {
@@ -118,6 +120,9 @@ bool VulkanApplication::mainLoop(const std::function<void(float)> &renderMethod,
   for (auto computer : scene.computers) {
     command_pool_manager.recordCommandBuffer(*computer);
   }
+  for (auto &r : scene.renderers)
+    if (r.second->culler)
+      command_pool_manager.recordCommandBuffer(*r.second->culler);
 
   for (auto renderer : scene.renderers) {
     command_pool_manager.recordCommandBuffer(*renderer.second);
@@ -2,6 +2,7 @@
 #include "api/render/mesh.hh"
 #include "utils/checks.hh"
 #include "vulkan/buffers/descriptor_holder.hh"
+#include "vulkan/context.hh"
 #include <cassert>
 #include <cstdlib>
 #include <iostream>
@@ -11,8 +12,9 @@ namespace Flim {
 
 AttributeDescriptor::AttributeDescriptor(int binding, AttributeRate rate)
     : BufferHolder(), binding(binding), usesPreviousFrame(false), rate(rate),
-      size(0), updateFunction(nullptr), isSingleBuffered(false),
-      isComputeFriendly(false), isOnlySetup(false) {};
+      size(0), amount(0), updateFunction(nullptr), isSingleBuffered(false),
+      isComputeFriendly(false), isOnlySetup(false),
+      residencyPolicy(AttributeResidency::AUTO), extraUsageFlags(0) {};
 
 AttributeDescriptor &AttributeDescriptor::add(long offset, VkFormat format) {
   offsets.push_back(std::make_pair(offset, format));
@@ -58,37 +60,61 @@ inline int getAmount(const Mesh &m, AttributeRate &rate) {
   return 0;
 }
 
+VkMemoryPropertyFlags AttributeDescriptor::memoryProperties() const {
+  constexpr VkMemoryPropertyFlags host = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  AttributeResidency residency = residencyPolicy;
+  if (residency == AttributeResidency::AUTO)
+    residency = isOnlySetup ? AttributeResidency::DEVICE
+                            : AttributeResidency::MAPPABLE_DEVICE;
+  switch (residency) {
+  case AttributeResidency::DEVICE:
+    CHECK(isOnlySetup, "Only attributes that are only setup can be kept in "
+                       "device local memory");
+    return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  case AttributeResidency::MAPPABLE_DEVICE:
+    if (context.allocator.hasMappableDeviceMemory())
+      return host | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    return host;
+  default:
+    return host;
+  }
+}
+
 void AttributeDescriptor::setup() {
   CHECK(!offsets.empty(), "Please specify the offsets of the attribute");
   CHECK(size != 0, "please populate the attribute descriptor");
   assert(
-      getAttachedMesh() != nullptr &&
+      (amount != 0 || getAttachedMesh() != nullptr) &&
       "You cannot use an attribute without registering it"); // should be set by
                                                              // the renderer
   if (isSingleBuffered)
     redundancy = 1;
-  VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+  VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | extraUsageFlags;
   if (isOnlySetup)
     usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-  if (isComputeFriendly) {
-    assert(
-        isOnlySetup &&
-        "If the attribute is compute friendly, it also need to be only setup");
+  if (isComputeFriendly)
     usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-  }
-  size_t bufSize = getAmount(*getAttachedMesh(), rate) * size;
-  static auto memProp = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-  setupBuffers("attribute descriptor", bufSize, usage, memProp,
+  size_t bufSize =
+      (amount != 0 ? amount : getAmount(*getAttachedMesh(), rate)) * size;
+  setupBuffers("attribute descriptor", bufSize, usage, memoryProperties(),
                isComputeFriendly);
 
+  if (rangeFunction) {
+    CHECK(rate == AttributeRate::INSTANCE && getAttachedMesh() != nullptr,
+          "Only attributes of the instances of a mesh can be attached per "
+          "instance");
+    // Every instance is written into each buffer first
+    instanceChanges = std::make_shared<ChangeTracker>();
+    instanceChanges->reset(getAttachedMesh()->instances.size(), redundancy);
+    getAttachedMesh()->subscribeInstances(instanceChanges);
+  }
+
   for (auto b : getBuffers()) {
-    if (isOnlySetup) {
-      void *tmp = malloc(bufSize);
-      updateFunction(*getAttachedMesh(), tmp);
-      b->populate(tmp);
-      free(tmp);
-    } else
+    if (isOnlySetup)
+      b->populate(
+          [&](void *staging) { updateFunction(getAttachedMesh(), staging); });
+    else
       b->map();
   }
 }
@@ -128,10 +154,28 @@ AttributeDescriptor &AttributeDescriptor::singleBuffered(bool val) {
   return *this;
 }
 
+AttributeDescriptor &AttributeDescriptor::residency(AttributeResidency val) {
+  residencyPolicy = val;
+  return *this;
+}
+
+AttributeDescriptor &AttributeDescriptor::extraUsage(VkBufferUsageFlags usage) {
+  extraUsageFlags = usage;
+  return *this;
+}
+
 void AttributeDescriptor::update() {
   if (isOnlySetup)
     return;
-  updateFunction(*getAttachedMesh(), getBuffer()->getPtr());
+  if (!rangeFunction) {
+    updateFunction(getAttachedMesh(), getBuffer()->getPtr());
+    return;
+  }
+  // The buffer of the frame, as picked by getBuffer
+  Mesh *mesh = getAttachedMesh();
+  const int copy = context.currentImage % redundancy;
+  for (auto [first, last] : instanceChanges->take(copy))
+    rangeFunction(mesh, getBuffer()->getPtr(), first, last);
 }
 
 } // namespace Flim
@@ -13,6 +13,7 @@ class DescriptorHolder;
 class Renderer;
 
 class Mesh;
+class ChangeTracker;
 
 enum AttributeRate {
   VERTEX,
@@ -31,6 +32,20 @@ inline VkVertexInputRate attributeRateToInputRate(AttributeRate rate) {
   return VK_VERTEX_INPUT_RATE_VERTEX;
 }
 
+// Where the buffers of an attribute live
+enum class AttributeResidency {
+  // DEVICE when only setup, MAPPABLE_DEVICE otherwise
+  AUTO,
+  // Only written through the staging ring, read at full speed by the device
+  DEVICE,
+  // Host visible, for buffers the host writes every frame or reads back
+  HOST,
+  // Host visible device local memory when all of it is (resizable BAR,
+  // integrated GPUs), HOST otherwise. Written every frame without any copy,
+  // but slow to read from the host.
+  MAPPABLE_DEVICE,
+};
+
 /**
  * Handles a uniform value (mapped to a binding).
  * It inherits the BufferHolder which contains the underlying values.
@@ -55,15 +70,52 @@ public:
   AttributeDescriptor &
   attach(const std::function<void(const Mesh &m, T *)> &updateFn) {
     size = sizeof(T);
-    updateFunction = [updateFn](const Mesh &m, void *d) {
-      updateFn(m, (T *)d);
+    amount = 0;
+    updateFunction = [updateFn](const Mesh *m, void *d) {
+      updateFn(*m, (T *)d);
     };
+    rangeFunction = nullptr;
+    return *this;
+  }
+
+  // Per instance, only the instances whose transform changed are written
+  // again into the buffer of the frame (see Mesh::instanceChanged): updateFn
+  // writes the elements in [first, last), at their place in the buffer
+  template <typename T>
+  AttributeDescriptor &attachPerInstance(
+      const std::function<void(const Mesh &m, T *, uint32_t first,
+                               uint32_t last)> &updateFn) {
+    size = sizeof(T);
+    amount = 0;
+    rangeFunction = [updateFn](const Mesh *m, void *d, uint32_t first,
+                               uint32_t last) {
+      updateFn(*m, (T *)d, first, last);
+    };
+    updateFunction = [range = rangeFunction](const Mesh *m, void *d) {
+      range(m, d, 0, m->instances.size());
+    };
+    return *this;
+  }
+
+  // Attach a buffer of a fixed amount of elements, not tied to any mesh (e.g
+  // the inputs and outputs of a compute shader)
+  template <typename T>
+  AttributeDescriptor &attach(size_t amount,
+                              const std::function<void(T *)> &updateFn) {
+    size = sizeof(T);
+    this->amount = amount;
+    updateFunction = [updateFn](const Mesh *, void *d) { updateFn((T *)d); };
+    rangeFunction = nullptr;
     return *this;
   }
 
   AttributeDescriptor &onlySetup(bool val = true);
   AttributeDescriptor &computeFriendly(bool val = true);
   AttributeDescriptor &singleBuffered(bool val = true);
+  AttributeDescriptor &residency(AttributeResidency val);
+  // Other ways the buffer is used (e.g VK_BUFFER_USAGE_INDEX_BUFFER_BIT for an
+  // index buffer written by a compute shader)
+  AttributeDescriptor &extraUsage(VkBufferUsageFlags usage);
 
   template <typename T> AttributeDescriptor &attach() {
     return attach<T>([](const Mesh &, T *) {});
@@ -99,13 +151,25 @@ protected:
   // attribute (e.g 4 Vec4 for a Mat4)
   std::vector<std::pair<VkDeviceSize, VkFormat>> offsets;
   int size;
+  // Amount of elements when not following the attached mesh, 0 otherwise
+  size_t amount;
 
   bool isOnlySetup;
   bool isSingleBuffered;
   bool isComputeFriendly;
+  AttributeResidency residencyPolicy;
+  VkBufferUsageFlags extraUsageFlags;
   VkDescriptorBufferInfo storageBufferInfo;
 
-  std::function<void(const Mesh &m, void *)> updateFunction;
+  std::function<void(const Mesh *m, void *)> updateFunction;
+  // Only for the attributes attached per instance
+  std::function<void(const Mesh *m, void *, uint32_t, uint32_t)> rangeFunction;
+  // Subscribed to the instances of the mesh on setup
+  std::shared_ptr<ChangeTracker> instanceChanges;
+
+private:
+  // Of the buffers, following the residency policy
+  VkMemoryPropertyFlags memoryProperties() const;
 };
 
 } // namespace Flim
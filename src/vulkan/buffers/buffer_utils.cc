@@ -23,6 +23,19 @@ uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
   throw std::runtime_error("failed to find suitable memory type!");
 }
 
+void shareWithTransferQueue(VkSharingMode &mode, uint32_t &familyCount,
+                            const uint32_t *&families) {
+  const Queues &queues = context.queues;
+  if (queues.families[0] == queues.families[1]) {
+    mode = VK_SHARING_MODE_EXCLUSIVE;
+    return;
+  }
+  // Rather than transferring the ownership of each of them
+  mode = VK_SHARING_MODE_CONCURRENT;
+  familyCount = 2;
+  families = queues.families;
+}
+
 VkCommandBuffer beginSingleTimeCommands() {
   // Create the command buffer
   VkCommandBufferAllocateInfo allocInfo{};
@@ -67,15 +80,16 @@ void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
 // Buffer class related -----
 
 void Buffer::populate(void *data) const {
-  Buffer stagingBuffer("Populate staging buffer of " + name, size,
-                       VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                       false);
-  stagingBuffer.map();
-  memcpy(stagingBuffer.mappedPtr, data, (size_t)size);
-  stagingBuffer.unmap();
-  copy(stagingBuffer);
+  populate([&](void *staging) { memcpy(staging, data, (size_t)size); });
+}
+
+void Buffer::populate(const std::function<void(void *)> &fill) const {
+  context.staging.upload(*this, 0, size, fill);
+}
+
+UploadTicket
+Buffer::populateAsync(const std::function<void(void *)> &fill) const {
+  return context.staging.upload(*this, 0, size, fill, true);
 }
 
 void Buffer::copy(const Buffer &from) const {
@@ -92,18 +106,13 @@ void Buffer::copy(const Buffer &from) const {
   endSingleTimeCommands(commandBuffer);
 }
 
+// Host visible memory stays mapped by the allocator
 void Buffer::map() {
-  if (mappedPtr != nullptr)
-    return;
-  vkMapMemory(context.device, bufferMemory, 0, size, 0, &mappedPtr);
+  assert(memory.mapped != nullptr);
+  mappedPtr = memory.mapped;
 }
 
-void Buffer::unmap() {
-  if (mappedPtr == nullptr)
-    return;
-  vkUnmapMemory(context.device, bufferMemory);
-  mappedPtr = nullptr;
-}
+void Buffer::unmap() { mappedPtr = nullptr; }
 
 Buffer::~Buffer() {
   if (external) {
@@ -123,7 +132,7 @@ Buffer::~Buffer() {
   if (mappedPtr)
     unmap();
   vkDestroyBuffer(context.device, buffer, nullptr);
-  vkFreeMemory(context.device, bufferMemory, nullptr);
+  context.allocator.free(memory);
   // std::cout << "DESTROY BUF " << name << std::endl;
 }
 
@@ -154,6 +163,10 @@ void Buffer::create(VkBufferUsageFlags usage,
   bufferInfo.size = size;
   bufferInfo.usage = usage;
   bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+    shareWithTransferQueue(bufferInfo.sharingMode,
+                           bufferInfo.queueFamilyIndexCount,
+                           bufferInfo.pQueueFamilyIndices);
   bufferInfo.pNext = pNextBuf;
 
   if (vkCreateBuffer(context.device, &bufferInfo, nullptr, &buffer) !=
@@ -163,78 +176,70 @@ void Buffer::create(VkBufferUsageFlags usage,
 
   setDebugObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)buffer, name);
 
-  VkMemoryRequirements memRequirements;
-  vkGetBufferMemoryRequirements(context.device, buffer, &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex =
-      findMemoryType(memRequirements.memoryTypeBits, properties);
-  allocInfo.pNext = pNextMem;
-
-  if (vkAllocateMemory(context.device, &allocInfo, nullptr, &bufferMemory) !=
-      VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate buffer memory!");
+  if (!external) {
+    memory = context.allocator.allocateBuffer(buffer, properties);
+    return;
   }
 
-  vkBindBufferMemory(context.device, buffer, bufferMemory, 0);
-
-  if (external) {
+  // Exported memory cannot be shared with other buffers
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(context.device, buffer, &memRequirements);
+  memory =
+      context.allocator.allocateDedicated(memRequirements, properties, pNextMem);
+  vkBindBufferMemory(context.device, buffer, memory.memory, 0);
 
-    // Export the memory handle
-    VkMemoryGetFdInfoKHR getFdInfo = {};
-    getFdInfo.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
-    getFdInfo.memory = bufferMemory;
-    getFdInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+  // Export the memory handle
+  VkMemoryGetFdInfoKHR getFdInfo = {};
+  getFdInfo.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
+  getFdInfo.memory = memory.memory;
+  getFdInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
 
-    auto vkGetMemoryFdKHR = (PFN_vkGetMemoryFdKHR)vkGetInstanceProcAddr(
-        context.instance, "vkGetMemoryFdKHR");
+  auto vkGetMemoryFdKHR = (PFN_vkGetMemoryFdKHR)vkGetInstanceProcAddr(
+      context.instance, "vkGetMemoryFdKHR");
 
-    assert(vkGetMemoryFdKHR(context.device, &getFdInfo, &externalFd) ==
-           VK_SUCCESS);
+  assert(vkGetMemoryFdKHR(context.device, &getFdInfo, &externalFd) ==
+         VK_SUCCESS);
 #ifdef FLIM_HIP
-    HIP_CHECK(hipSetDevice(0));
+  HIP_CHECK(hipSetDevice(0));
 
-    // Import the memory handle into HIP
-    hipExternalMemoryHandleDesc extMemHandleDesc = {};
-    extMemHandleDesc.type = hipExternalMemoryHandleTypeOpaqueFd;
-    extMemHandleDesc.handle.fd = externalFd;
-    extMemHandleDesc.size = size;
+  // Import the memory handle into HIP
+  hipExternalMemoryHandleDesc extMemHandleDesc = {};
+  extMemHandleDesc.type = hipExternalMemoryHandleTypeOpaqueFd;
+  extMemHandleDesc.handle.fd = externalFd;
+  extMemHandleDesc.size = size;
 
-    HIP_CHECK(hipImportExternalMemory(&extMem, &extMemHandleDesc));
+  HIP_CHECK(hipImportExternalMemory(&extMem, &extMemHandleDesc));
 
-    // Map the external memory to a HIP buffer
-    hipExternalMemoryBufferDesc bufferDesc = {};
-    bufferDesc.offset = 0;
-    bufferDesc.size = size;
-    bufferDesc.flags = 0;
+  // Map the external memory to a HIP buffer
+  hipExternalMemoryBufferDesc bufferDesc = {};
+  bufferDesc.offset = 0;
+  bufferDesc.size = size;
+  bufferDesc.flags = 0;
 
-    HIP_CHECK(
-        hipExternalMemoryGetMappedBuffer(&externalPtr, extMem, &bufferDesc));
+  HIP_CHECK(
+      hipExternalMemoryGetMappedBuffer(&externalPtr, extMem, &bufferDesc));
 
 #elif defined(FLIM_CUDA)
-    // Set CUDA device
-    CUDA_CHECK(cudaSetDevice(0));
+  // Set CUDA device
+  CUDA_CHECK(cudaSetDevice(0));
 
-    // Import the memory handle into CUDA
-    cudaExternalMemoryHandleDesc extMemHandleDesc = {};
-    extMemHandleDesc.type = cudaExternalMemoryHandleTypeOpaqueFd;
-    extMemHandleDesc.handle.fd = externalFd;
-    extMemHandleDesc.size = size;
+  // Import the memory handle into CUDA
+  cudaExternalMemoryHandleDesc extMemHandleDesc = {};
+  extMemHandleDesc.type = cudaExternalMemoryHandleTypeOpaqueFd;
+  extMemHandleDesc.handle.fd = externalFd;
+  extMemHandleDesc.size = size;
 
-    CUDA_CHECK(cudaImportExternalMemory(&extMem, &extMemHandleDesc));
+  CUDA_CHECK(cudaImportExternalMemory(&extMem, &extMemHandleDesc));
 
-    // Map the external memory to a CUDA buffer
-    cudaExternalMemoryBufferDesc bufferDesc = {};
-    bufferDesc.offset = 0;
-    bufferDesc.size = size;
-    bufferDesc.flags = 0; // Must be 0 for now (reserved for future use)
+  // Map the external memory to a CUDA buffer
+  cudaExternalMemoryBufferDesc bufferDesc = {};
+  bufferDesc.offset = 0;
+  bufferDesc.size = size;
+  bufferDesc.flags = 0; // Must be 0 for now (reserved for future use)
 
-    CUDA_CHECK(
-        cudaExternalMemoryGetMappedBuffer(&externalPtr, extMem, &bufferDesc));
+  CUDA_CHECK(
+      cudaExternalMemoryGetMappedBuffer(&externalPtr, extMem, &bufferDesc));
 #endif
-  }
 }
 
 const void *Buffer::getExternalPtr() const {
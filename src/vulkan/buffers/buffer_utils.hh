@@ -1,20 +1,29 @@
 #pragma once
 
+#include <cstring>
 #include <fwd.hh>
+#include <functional>
 #include <vulkan/vulkan_core.h>
 
 #include "utils/backend.hh"
+#include "vulkan/buffers/memory_allocator.hh"
 namespace Flim {
 
+// Value the timeline semaphore of the uploads reaches once one is done (see
+// StagingRing)
+using UploadTicket = uint64_t;
+
 class Buffer {
 public:
+  // Host visible, written right away through its mapping
   Buffer(std::string name, void *ptr, int size, VkBufferUsageFlags usage = 0,
          VkMemoryPropertyFlags properties = 0, bool external = false)
-      : Buffer(name, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      : Buffer(name, size, usage,
                properties | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                external) {
-    populate(ptr);
+    map();
+    memcpy(mappedPtr, ptr, size);
   };
 
   Buffer(std::string name, int size,
@@ -25,7 +34,9 @@ public:
     create(usage, properties);
   };
 
-  const VkDeviceMemory &getVkBufferMemory() const { return bufferMemory; };
+  // Shared with other resources, the buffer is at getMemoryOffset in it
+  const VkDeviceMemory &getVkBufferMemory() const { return memory.memory; };
+  VkDeviceSize getMemoryOffset() const { return memory.offset; };
   const VkBuffer &getVkBuffer() const { return buffer; };
   void *getPtr() const { return mappedPtr; };
   int getSize() const { return size; };
@@ -33,8 +44,16 @@ public:
   void map();
   void unmap();
 
+  // Submitted on its own and waited for
   void copy(const Buffer &from) const;
+  // Batched with the other uploads (see StagingRing), the buffer must be kept
+  // until they are flushed
   void populate(void *value) const;
+  // Let fill write the content right into the staging ring
+  void populate(const std::function<void(void *)> &fill) const;
+  // Not waited for by the frames, the buffer can be used once the ticket is
+  // done
+  UploadTicket populateAsync(const std::function<void(void *)> &fill) const;
 
   ~Buffer();
 
@@ -44,7 +63,7 @@ public:
 private:
   void create(VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
   int size; // in bytes
-  VkDeviceMemory bufferMemory;
+  MemoryAllocation memory; // dedicated for external buffers
   VkBuffer buffer;
   void *mappedPtr;
 
@@ -61,6 +80,11 @@ private:
 
 uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
+// Resources written by the uploads are shared with the transfer queue family,
+// when it is not the graphics one
+void shareWithTransferQueue(VkSharingMode &mode, uint32_t &familyCount,
+                            const uint32_t *&families);
+
 VkCommandBuffer beginSingleTimeCommands();
 
 void endSingleTimeCommands(VkCommandBuffer commandBuffer);
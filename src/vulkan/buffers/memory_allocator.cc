@@ -0,0 +1,322 @@
+#include "memory_allocator.hh"
+
+#include "vulkan/buffers/buffer_utils.hh"
+#include "vulkan/context.hh"
+#include <algorithm>
+#include <bit>
+#include <iostream>
+#include <stdexcept>
+
+namespace Flim {
+
+// A device allocation split with a buddy allocator
+struct MemoryBlock {
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  void *mapped;
+  uint32_t memoryType;
+  uint32_t pool;
+  uint32_t allocations;
+  // Offsets of the free ranges of each order, of minRangeSize << order bytes
+  std::vector<std::set<VkDeviceSize>> freeRanges;
+
+  // Offset of a free range of the order, or size if there is none
+  VkDeviceSize take(uint32_t order) {
+    uint32_t from = order;
+    while (from < freeRanges.size() && freeRanges[from].empty())
+      from++;
+    if (from == freeRanges.size())
+      return size;
+    VkDeviceSize offset = *freeRanges[from].begin();
+    freeRanges[from].erase(freeRanges[from].begin());
+    // The upper halves of the splits are left free
+    while (from > order) {
+      from--;
+      freeRanges[from].insert(offset +
+                              (MemoryAllocator::minRangeSize << from));
+    }
+    allocations++;
+    return offset;
+  }
+
+  void give(VkDeviceSize offset, uint32_t order) {
+    // Merge with the buddies as long as they are free
+    while (order + 1 < freeRanges.size()) {
+      VkDeviceSize buddy = offset ^ (MemoryAllocator::minRangeSize << order);
+      if (freeRanges[order].erase(buddy) == 0)
+        break;
+      offset = std::min(offset, buddy);
+      order++;
+    }
+    freeRanges[order].insert(offset);
+    allocations--;
+  }
+};
+
+MemoryAllocator::~MemoryAllocator() = default;
+
+static uint32_t orderOf(VkDeviceSize size) {
+  VkDeviceSize ranges =
+      (std::max(size, MemoryAllocator::minRangeSize) +
+       MemoryAllocator::minRangeSize - 1) /
+      MemoryAllocator::minRangeSize;
+  return std::bit_width(ranges - 1);
+}
+
+VkDeviceSize MemoryAllocator::blockSize(uint32_t memoryType) {
+  // Small heaps (e.g the 256MB of device local host visible memory without
+  // resizable BAR) are not taken by a few blocks
+  const VkMemoryHeap &heap =
+      properties.memoryHeaps[properties.memoryTypes[memoryType].heapIndex];
+  return std::max(minRangeSize,
+                  std::bit_floor(std::min(defaultBlockSize, heap.size / 8)));
+}
+
+VkDeviceMemory MemoryAllocator::allocateMemory(VkDeviceSize size,
+                                               uint32_t memoryType,
+                                               const void *pNext,
+                                               void **mapped) {
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = memoryType;
+  allocInfo.pNext = pNext;
+
+  VkDeviceMemory memory;
+  if (vkAllocateMemory(context.device, &allocInfo, nullptr, &memory) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate device memory!");
+  }
+  *mapped = nullptr;
+  if ((properties.memoryTypes[memoryType].propertyFlags &
+       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+      vkMapMemory(context.device, memory, 0, size, 0, mapped) != VK_SUCCESS) {
+    vkFreeMemory(context.device, memory, nullptr);
+    throw std::runtime_error("failed to map device memory!");
+  }
+  stats[memoryType].deviceAllocations++;
+  stats[memoryType].reservedBytes += size;
+  return memory;
+}
+
+void MemoryAllocator::freeMemory(VkDeviceMemory memory, VkDeviceSize size,
+                                 uint32_t memoryType) {
+  // Unmapped along with it
+  vkFreeMemory(context.device, memory, nullptr);
+  stats[memoryType].deviceAllocations--;
+  stats[memoryType].reservedBytes -= size;
+}
+
+void MemoryAllocator::loadProperties() {
+  if (hasProperties)
+    return;
+  vkGetPhysicalDeviceMemoryProperties(context.physicalDevice, &properties);
+  hasProperties = true;
+}
+
+uint32_t MemoryAllocator::findType(uint32_t typeFilter,
+                                   VkMemoryPropertyFlags flags) {
+  loadProperties();
+  return findMemoryType(typeFilter, flags);
+}
+
+bool MemoryAllocator::hasMappableDeviceMemory() {
+  std::lock_guard lock(mutex);
+  loadProperties();
+  // The largest device local heap, the 256MB window of a BAR that cannot be
+  // resized being a smaller one
+  uint32_t largest = properties.memoryHeapCount;
+  for (uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+    const VkMemoryHeap &heap = properties.memoryHeaps[i];
+    if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) &&
+        (largest == properties.memoryHeapCount ||
+         heap.size > properties.memoryHeaps[largest].size))
+      largest = i;
+  }
+  constexpr VkMemoryPropertyFlags mappable =
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+    const VkMemoryType &type = properties.memoryTypes[i];
+    if ((type.propertyFlags & mappable) == mappable &&
+        type.heapIndex == largest)
+      return true;
+  }
+  return false;
+}
+
+MemoryAllocation
+MemoryAllocator::allocateDedicatedLocked(const VkMemoryRequirements &requirements,
+                                         uint32_t memoryType,
+                                         const void *pNext) {
+  MemoryAllocation allocation;
+  allocation.memory = allocateMemory(requirements.size, memoryType, pNext,
+                                     &allocation.mapped);
+  allocation.size = requirements.size;
+  allocation.memoryType = memoryType;
+  dedicated.insert({allocation.memory, memoryType});
+  stats[memoryType].dedicatedAllocations++;
+  stats[memoryType].allocations++;
+  stats[memoryType].usedBytes += requirements.size;
+  return allocation;
+}
+
+MemoryAllocation
+MemoryAllocator::allocate(const VkMemoryRequirements &requirements,
+                          VkMemoryPropertyFlags flags, bool optimalImage) {
+  std::lock_guard lock(mutex);
+  const uint32_t memoryType = findType(requirements.memoryTypeBits, flags);
+  const VkDeviceSize size = blockSize(memoryType);
+  // Ranges are aligned to their size
+  const uint32_t order =
+      orderOf(std::max(requirements.size, requirements.alignment));
+  if ((minRangeSize << order) > size / 2)
+    return allocateDedicatedLocked(requirements, memoryType, nullptr);
+
+  const uint32_t poolId = 2 * memoryType + optimalImage;
+  Pool &pool = pools[poolId];
+  MemoryAllocation allocation;
+  for (auto &block : pool.blocks) {
+    allocation.offset = block->take(order);
+    if (allocation.offset != block->size) {
+      allocation.block = block.get();
+      break;
+    }
+  }
+  if (allocation.block == nullptr) {
+    auto block = std::make_unique<MemoryBlock>();
+    block->size = size;
+    block->memoryType = memoryType;
+    block->pool = poolId;
+    block->allocations = 0;
+    block->memory = allocateMemory(size, memoryType, nullptr, &block->mapped);
+    block->freeRanges.resize(orderOf(size) + 1);
+    block->freeRanges.back().insert(0);
+    allocation.offset = block->take(order);
+    allocation.block = block.get();
+    pool.blocks.push_back(std::move(block));
+  }
+
+  MemoryBlock &block = *allocation.block;
+  allocation.memory = block.memory;
+  allocation.size = requirements.size;
+  allocation.memoryType = memoryType;
+  allocation.order = order;
+  if (block.mapped != nullptr)
+    allocation.mapped = (char *)block.mapped + allocation.offset;
+  stats[memoryType].allocations++;
+  stats[memoryType].usedBytes += requirements.size;
+  return allocation;
+}
+
+MemoryAllocation
+MemoryAllocator::allocateDedicated(const VkMemoryRequirements &requirements,
+                                   VkMemoryPropertyFlags flags,
+                                   const void *pNext) {
+  std::lock_guard lock(mutex);
+  return allocateDedicatedLocked(
+      requirements, findType(requirements.memoryTypeBits, flags), pNext);
+}
+
+MemoryAllocation MemoryAllocator::allocateBuffer(VkBuffer buffer,
+                                                 VkMemoryPropertyFlags flags) {
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(context.device, buffer, &requirements);
+  MemoryAllocation allocation = allocate(requirements, flags);
+  vkBindBufferMemory(context.device, buffer, allocation.memory,
+                     allocation.offset);
+  return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocateImage(VkImage image,
+                                                VkImageTiling tiling,
+                                                VkMemoryPropertyFlags flags) {
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(context.device, image, &requirements);
+  MemoryAllocation allocation =
+      allocate(requirements, flags, tiling == VK_IMAGE_TILING_OPTIMAL);
+  vkBindImageMemory(context.device, image, allocation.memory,
+                    allocation.offset);
+  return allocation;
+}
+
+void MemoryAllocator::free(MemoryAllocation &allocation) {
+  std::lock_guard lock(mutex);
+  if (destroyed || allocation.memory == VK_NULL_HANDLE)
+    return;
+  MemoryStats &typeStats = stats[allocation.memoryType];
+  typeStats.allocations--;
+  typeStats.usedBytes -= allocation.size;
+
+  if (allocation.block == nullptr) {
+    dedicated.erase({allocation.memory, allocation.memoryType});
+    typeStats.dedicatedAllocations--;
+    freeMemory(allocation.memory, allocation.size, allocation.memoryType);
+  } else {
+    MemoryBlock *block = allocation.block;
+    block->give(allocation.offset, allocation.order);
+    // Empty blocks are released, but for the last one of their pool
+    Pool &pool = pools[block->pool];
+    if (block->allocations == 0 && pool.blocks.size() > 1) {
+      freeMemory(block->memory, block->size, block->memoryType);
+      pool.blocks.erase(std::find_if(
+          pool.blocks.begin(), pool.blocks.end(),
+          [&](const auto &b) { return b.get() == block; }));
+    }
+  }
+  allocation = MemoryAllocation();
+}
+
+MemoryStats MemoryAllocator::getStats(uint32_t memoryType) const {
+  std::lock_guard lock(mutex);
+  return stats[memoryType];
+}
+
+MemoryStats MemoryAllocator::getStats() const {
+  std::lock_guard lock(mutex);
+  MemoryStats total;
+  for (const MemoryStats &s : stats) {
+    total.deviceAllocations += s.deviceAllocations;
+    total.dedicatedAllocations += s.dedicatedAllocations;
+    total.allocations += s.allocations;
+    total.reservedBytes += s.reservedBytes;
+    total.usedBytes += s.usedBytes;
+  }
+  return total;
+}
+
+void MemoryAllocator::printStats() const {
+  auto print = [](const MemoryStats &s) {
+    std::cout << s.allocations << " allocations in " << s.deviceAllocations
+              << " device allocations (" << s.dedicatedAllocations
+              << " dedicated), " << s.usedBytes / 1024 << " KB used out of "
+              << s.reservedBytes / 1024 << " KB" << std::endl;
+  };
+  for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+    MemoryStats s = getStats(i);
+    if (s.deviceAllocations == 0)
+      continue;
+    std::cout << "Memory type " << i << ": ";
+    print(s);
+  }
+  std::cout << "Total: ";
+  print(getStats());
+}
+
+void MemoryAllocator::destroy() {
+  std::lock_guard lock(mutex);
+  if (destroyed)
+    return;
+  for (Pool &pool : pools) {
+    for (auto &block : pool.blocks)
+      vkFreeMemory(context.device, block->memory, nullptr);
+    pool.blocks.clear();
+  }
+  for (auto &[memory, memoryType] : dedicated)
+    vkFreeMemory(context.device, memory, nullptr);
+  dedicated.clear();
+  destroyed = true;
+}
+
+} // namespace Flim
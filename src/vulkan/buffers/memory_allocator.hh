@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace Flim {
+
+struct MemoryBlock;
+
+// A range of device memory, either part of a block shared with other
+// resources or a dedicated VkDeviceMemory
+struct MemoryAllocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;  // as asked for
+  void *mapped = nullptr; // host visible memory stays mapped
+  uint32_t memoryType = 0;
+  MemoryBlock *block = nullptr; // nullptr when dedicated
+  uint32_t order = 0;           // of the range in its block
+};
+
+// Memory of one type, or of every type summed up
+struct MemoryStats {
+  uint32_t deviceAllocations = 0; // VkDeviceMemory objects
+  uint32_t dedicatedAllocations = 0;
+  uint32_t allocations = 0; // resources bound to the memory
+  VkDeviceSize reservedBytes = 0; // allocated from the device
+  VkDeviceSize usedBytes = 0;     // asked for by the resources
+};
+
+/**
+ * Sub-allocates the memory of buffers and images from large blocks, so that
+ * thousands of resources only take a few of the maxMemoryAllocationCount
+ * device allocations and pay for vkAllocateMemory once.
+ *
+ * Blocks are split with a buddy allocator: ranges are powers of two, aligned
+ * to their size, which covers any alignment smaller than them. Buffers and
+ * optimal images are kept in separate blocks to respect
+ * bufferImageGranularity. Resources bigger than half a block get a dedicated
+ * allocation, as do the ones that need their own (e.g exported memory).
+ * Host visible blocks are mapped once for all.
+ */
+class MemoryAllocator {
+public:
+  static constexpr VkDeviceSize defaultBlockSize = 64 << 20;
+  // Smallest range, all the others being a power of two times bigger
+  static constexpr VkDeviceSize minRangeSize = 256;
+
+  MemoryAllocator() = default;
+  MemoryAllocator(MemoryAllocator &) = delete;
+  ~MemoryAllocator();
+
+  // Allocate and bind memory for a resource, at the offset it is given
+  MemoryAllocation allocateBuffer(VkBuffer buffer,
+                                  VkMemoryPropertyFlags properties);
+  MemoryAllocation allocateImage(VkImage image, VkImageTiling tiling,
+                                 VkMemoryPropertyFlags properties);
+
+  MemoryAllocation allocate(const VkMemoryRequirements &requirements,
+                            VkMemoryPropertyFlags properties,
+                            bool optimalImage = false);
+  // A VkDeviceMemory of its own, pNext being chained to its
+  // VkMemoryAllocateInfo
+  MemoryAllocation allocateDedicated(const VkMemoryRequirements &requirements,
+                                     VkMemoryPropertyFlags properties,
+                                     const void *pNext = nullptr);
+  void free(MemoryAllocation &allocation);
+
+  // Whether the host can map the whole device local memory, through a
+  // resizable BAR or because the GPU is integrated
+  bool hasMappableDeviceMemory();
+
+  // Every memory type summed up
+  MemoryStats getStats() const;
+  MemoryStats getStats(uint32_t memoryType) const;
+  void printStats() const;
+
+  // Release every block, before the device is destroyed. Later frees are
+  // ignored.
+  void destroy();
+
+private:
+  struct Pool {
+    std::vector<std::unique_ptr<MemoryBlock>> blocks;
+  };
+
+  // The ones below expect the mutex to be locked
+  void loadProperties();
+  uint32_t findType(uint32_t typeFilter, VkMemoryPropertyFlags flags);
+  VkDeviceSize blockSize(uint32_t memoryType);
+  VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType,
+                                const void *pNext, void **mapped);
+  void freeMemory(VkDeviceMemory memory, VkDeviceSize size,
+                  uint32_t memoryType);
+  MemoryAllocation
+  allocateDedicatedLocked(const VkMemoryRequirements &requirements,
+                          uint32_t memoryType, const void *pNext);
+
+  mutable std::mutex mutex;
+  bool destroyed = false;
+  bool hasProperties = false;
+  VkPhysicalDeviceMemoryProperties properties;
+  // Indexed by memory type, twice: buffers and linear images, then optimal
+  // images
+  Pool pools[2 * VK_MAX_MEMORY_TYPES];
+  // Dedicated allocations, freed by destroy
+  std::set<std::pair<VkDeviceMemory, uint32_t>> dedicated;
+  MemoryStats stats[VK_MAX_MEMORY_TYPES];
+};
+
+} // namespace Flim
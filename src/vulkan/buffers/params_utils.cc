@@ -11,9 +11,12 @@ namespace Flim {
 AttributeDescriptor &
 ParamsUtils::createInstanceMatrixAttribute(RenderParams &params, int binding) {
   auto &attr = params.setAttribute(binding, AttributeRate::INSTANCE);
-  attr.attach<Matrix4f>([](const Mesh &m, Matrix4f *mats) {
-        for (size_t i = 0; i < m.instances.size(); i++) {
-          mats[i] = m.instances[i].transform.getViewMatrix();
+  // Only the instances that moved are written again
+  attr.attachPerInstance<Matrix4f>([](const Mesh &m, Matrix4f *mats,
+                                      uint32_t first, uint32_t last) {
+        for (uint32_t i = first; i < last; i++) {
+          size_t id = m.instanceOrder.empty() ? i : m.instanceOrder[i];
+          mats[i] = m.instances[id].transform.getViewMatrix();
         }
       })
       .add(0 * sizeof(Vector4f), VK_FORMAT_R32G32B32A32_SFLOAT)
@@ -48,6 +51,46 @@ AttributeDescriptor &ParamsUtils::createVerticesAttribute(RenderParams &params,
   return attr;
 }
 
+AttributeDescriptor &ParamsUtils::createPackedVerticesAttribute(
+    RenderParams &params, int binding, const VertexQuantization &quantization,
+    bool usesPos, bool usesNormal, bool usesUv) {
+  AttributeDescriptor &attr =
+      params.setAttribute(binding)
+          .attach<PackedVertex>(
+              [quantization](const Mesh &m, PackedVertex *vertices) {
+                quantization.pack(m, vertices);
+              })
+          .onlySetup(true)
+          .computeFriendly(true)
+          .singleBuffered(true);
+
+  if (usesPos)
+    attr.add(offsetof(PackedVertex, pos),
+             quantization.format == PositionFormat::HALF
+                 ? VK_FORMAT_R16G16B16A16_SFLOAT
+                 : VK_FORMAT_R16G16B16A16_SNORM);
+  if (usesNormal)
+    attr.add(offsetof(PackedVertex, normal), VK_FORMAT_R16G16_SNORM);
+  if (usesUv)
+    attr.add(offsetof(PackedVertex, uv), VK_FORMAT_R16G16_SFLOAT);
+
+  return attr;
+}
+
+UniformDescriptor &
+ParamsUtils::createQuantizationUniform(RenderParams &params, int binding,
+                                       const VertexQuantization &quantization) {
+  struct QuantizationUniform {
+    alignas(16) Vector3f offset;
+    alignas(16) Vector3f scale;
+  };
+  return params.setUniform(binding, VERTEX_SHADER_STAGE)
+      .attach<QuantizationUniform>([quantization](QuantizationUniform *uni) {
+        uni->offset = quantization.offset;
+        uni->scale = quantization.scale;
+      });
+}
+
 UniformDescriptor &ParamsUtils::createViewMatrixUniform(RenderParams &params,
                                                         int binding,
                                                         const Mesh &m,
@@ -1,5 +1,6 @@
 #pragma once
 #include "api/parameters/render_params.hh"
+#include "api/render/vertex_packing.hh"
 #include "api/tree/camera.hh"
 #include "vulkan/buffers/attribute_descriptors.hh"
 #include "vulkan/buffers/uniform_descriptors.hh"
@@ -18,6 +19,18 @@ public:
                                                       bool usesNormal = true,
                                                       bool usesUv = true);
 
+  // Vertices packed to 16 bytes (see PackedVertex), along with the uniform
+  // used to decode their positions
+  static AttributeDescriptor &
+  createPackedVerticesAttribute(RenderParams &params, int binding,
+                                const VertexQuantization &quantization,
+                                bool usesPos = true, bool usesNormal = true,
+                                bool usesUv = true);
+
+  static UniformDescriptor &
+  createQuantizationUniform(RenderParams &params, int binding,
+                            const VertexQuantization &quantization);
+
   static UniformDescriptor &createViewMatrixUniform(RenderParams &params,
                                                     int binding, const Mesh &m,
                                                     const Camera &cam);
@@ -0,0 +1,246 @@
+#include "staging_ring.hh"
+
+#include "vulkan/buffers/texture_utils.hh"
+#include "vulkan/context.hh"
+#include <stdexcept>
+
+namespace Flim {
+
+StagingRing::~StagingRing() = default;
+
+std::pair<const Buffer *, VkDeviceSize>
+StagingRing::reserve(VkDeviceSize bytes) {
+  if (bytes > size) {
+    auto staging = std::make_unique<Buffer>(
+        "Oversized staging buffer", bytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    staging->map();
+    current.oversized.push_back(std::move(staging));
+    return {current.oversized.back().get(), 0};
+  }
+  if (!ring) {
+    ring = std::make_unique<Buffer>("Staging ring", size,
+                                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    ring->map();
+  }
+
+  VkDeviceSize offset, padding;
+  while (true) {
+    if (used == 0)
+      head = 0;
+    offset = (head + alignment - 1) / alignment * alignment;
+    padding = offset - head;
+    if (offset + bytes > size) {
+      // The end of the ring is skipped
+      offset = 0;
+      padding = size - head;
+    }
+    if (used + padding + bytes <= size)
+      break;
+    // Every range in use is in the current batch
+    if (batches.empty())
+      flush();
+    reclaim(true);
+  }
+  head = offset + bytes;
+  used += padding + bytes;
+  current.bytes += padding + bytes;
+  return {ring.get(), offset};
+}
+
+// The host waits for the device to reach the ticket
+static void waitFor(VkSemaphore semaphore, UploadTicket ticket) {
+  VkSemaphoreWaitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &semaphore;
+  waitInfo.pValues = &ticket;
+  vkWaitSemaphores(context.device, &waitInfo, UINT64_MAX);
+}
+
+VkCommandBuffer StagingRing::record(bool async) {
+  current.required |= !async;
+  if (current.commandBuffer != VK_NULL_HANDLE)
+    return current.commandBuffer;
+  if (pool == VK_NULL_HANDLE) {
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+                     VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = context.queues.families[1];
+    if (vkCreateCommandPool(context.device, &poolInfo, nullptr, &pool) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create upload command pool!");
+    }
+
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = submitted;
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+    if (vkCreateSemaphore(context.device, &semaphoreInfo, nullptr,
+                          &semaphore) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create upload semaphore!");
+    }
+  }
+  if (freeCommandBuffers.empty()) {
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = pool;
+    allocInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(context.device, &allocInfo,
+                                 &current.commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate upload command buffer!");
+    }
+  } else {
+    current.commandBuffer = freeCommandBuffers.back();
+    freeCommandBuffers.pop_back();
+  }
+  // Batches are submitted in order
+  current.ticket = submitted + 1;
+
+  // Implicitly reset, the pool allowing it
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(current.commandBuffer, &beginInfo);
+  return current.commandBuffer;
+}
+
+UploadTicket StagingRing::upload(const Buffer &dst, VkDeviceSize dstOffset,
+                                 VkDeviceSize bytes,
+                                 const std::function<void(void *)> &fill,
+                                 bool async) {
+  if (bytes == 0)
+    return submitted;
+  auto [staging, offset] = reserve(bytes);
+  fill((char *)staging->getPtr() + offset);
+
+  VkBufferCopy copyRegion{};
+  copyRegion.srcOffset = offset;
+  copyRegion.dstOffset = dstOffset;
+  copyRegion.size = bytes;
+  vkCmdCopyBuffer(record(async), staging->getVkBuffer(), dst.getVkBuffer(), 1,
+                  &copyRegion);
+  return current.ticket;
+}
+
+UploadTicket StagingRing::upload(Image &image, VkDeviceSize bytes,
+                                 const std::function<void(void *)> &fill,
+                                 bool async) {
+  auto [staging, offset] = reserve(bytes);
+  fill((char *)staging->getPtr() + offset);
+
+  VkCommandBuffer commandBuffer = record(async);
+  recordLayoutTransition(commandBuffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  recordCopyBufferToImage(commandBuffer, staging->getVkBuffer(), offset, image);
+
+  // The transfer queue has no shader stage to wait for: the frames reading
+  // the image wait for the semaphore
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout = image.layout;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image.textureImage;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = 0;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  image.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  return current.ticket;
+}
+
+UploadTicket StagingRing::flush() {
+  if (current.commandBuffer == VK_NULL_HANDLE)
+    return submitted;
+  vkEndCommandBuffer(current.commandBuffer);
+
+  // Signaled once every copy is done and visible
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.signalSemaphoreValueCount = 1;
+  timelineInfo.pSignalSemaphoreValues = &current.ticket;
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &current.commandBuffer;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &semaphore;
+  if (vkQueueSubmit(context.queues.transferQueue, 1, &submitInfo,
+                    VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit uploads!");
+  }
+  submitted = current.ticket;
+  if (current.required)
+    required = submitted;
+  batches.push_back(std::move(current));
+  current = Batch();
+  reclaim(false);
+  return submitted;
+}
+
+bool StagingRing::isDone(UploadTicket ticket) const {
+  if (ticket == 0)
+    return true;
+  if (ticket > submitted)
+    return false;
+  uint64_t value;
+  vkGetSemaphoreCounterValue(context.device, semaphore, &value);
+  return value >= ticket;
+}
+
+void StagingRing::reclaim(bool waitOldest) {
+  if (batches.empty())
+    return;
+  if (waitOldest)
+    waitFor(semaphore, batches.front().ticket);
+  uint64_t value;
+  vkGetSemaphoreCounterValue(context.device, semaphore, &value);
+  while (!batches.empty() && batches.front().ticket <= value) {
+    Batch &batch = batches.front();
+    used -= batch.bytes;
+    freeCommandBuffers.push_back(batch.commandBuffer);
+    batches.pop_front(); // releasing its oversized staging buffers
+  }
+}
+
+void StagingRing::wait(UploadTicket ticket) {
+  if (ticket > submitted)
+    flush();
+  if (ticket == 0)
+    return;
+  waitFor(semaphore, ticket);
+  reclaim(false);
+}
+
+void StagingRing::wait() { wait(current.ticket ? current.ticket : submitted); }
+
+void StagingRing::destroy() {
+  wait();
+  // Along with its command buffers
+  if (pool != VK_NULL_HANDLE)
+    vkDestroyCommandPool(context.device, pool, nullptr);
+  pool = VK_NULL_HANDLE;
+  freeCommandBuffers.clear();
+  if (semaphore != VK_NULL_HANDLE)
+    vkDestroySemaphore(context.device, semaphore, nullptr);
+  semaphore = VK_NULL_HANDLE;
+  ring.reset();
+  head = used = 0;
+  submitted = required = 0;
+}
+
+} // namespace Flim
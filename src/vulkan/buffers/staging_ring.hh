@@ -0,0 +1,103 @@
+#pragma once
+
+#include "vulkan/buffers/buffer_utils.hh"
+#include <deque>
+#include <functional>
+#include <fwd.hh>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace Flim {
+
+/**
+ * Uploads data to device buffers and images through one persistent host
+ * visible buffer, used as a ring.
+ *
+ * Uploads are written straight into the ring and their copies are recorded in
+ * a batch, submitted at once by flush (after the setup, and before every
+ * frame) to the transfer queue. Each batch signals the next value of a
+ * timeline semaphore, its ticket: the frames wait for the ones holding
+ * uploads that are not async on the device, and the part of the ring a batch
+ * used is reclaimed once its value is reached, so that the host only waits
+ * when more than the ring is in flight. Uploads bigger than the ring get a
+ * staging buffer of their own, released along with their batch.
+ *
+ * The destinations must outlive the flush of their upload. Only to be used
+ * from the thread recording the frames.
+ */
+class StagingRing {
+public:
+  static constexpr VkDeviceSize defaultSize = 64 << 20;
+  // Of the ranges of the ring, enough for any texel size
+  static constexpr VkDeviceSize alignment = 16;
+
+  StagingRing() = default;
+  StagingRing(StagingRing &) = delete;
+  ~StagingRing();
+
+  // Let fill write size bytes, copied to dst at dstOffset. Frames wait for
+  // the copy, unless it is async: dst can then only be used once its ticket is
+  // done.
+  UploadTicket upload(const Buffer &dst, VkDeviceSize dstOffset,
+                      VkDeviceSize size,
+                      const std::function<void(void *)> &fill,
+                      bool async = false);
+  // Let fill write the pixels of the whole image, which is left ready to be
+  // sampled
+  UploadTicket upload(Image &image, VkDeviceSize size,
+                      const std::function<void(void *)> &fill,
+                      bool async = false);
+
+  // Submit the copies recorded so far, the ticket of the last batch
+  UploadTicket flush();
+  bool isDone(UploadTicket ticket) const;
+  // Flush if needed and wait on the host for the ticket
+  void wait(UploadTicket ticket);
+  // For every copy
+  void wait();
+  // Wait and release everything, before the device is destroyed
+  void destroy();
+
+  // To be waited on by the frames, up to getRequired (0 when there is
+  // nothing to wait for)
+  VkSemaphore getSemaphore() const { return semaphore; }
+  UploadTicket getRequired() const { return required; }
+  // Batches submitted and not reclaimed yet
+  size_t inFlight() const { return batches.size(); }
+
+private:
+  struct Batch {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    UploadTicket ticket = 0;
+    bool required = false;  // holds uploads that are not async
+    VkDeviceSize bytes = 0; // of the ring, padding included
+    std::vector<std::unique_ptr<Buffer>> oversized;
+  };
+
+  // Room for size bytes, flushing and waiting for older batches if needed:
+  // the buffer to write to (the ring, or a staging buffer of its own when it
+  // does not fit) and the offset in it
+  std::pair<const Buffer *, VkDeviceSize> reserve(VkDeviceSize size);
+  // The command buffer of the current batch, begun if needed, the upload
+  // being async or not
+  VkCommandBuffer record(bool async);
+  // Release the batches that are done, after waiting for the oldest one
+  void reclaim(bool waitOldest);
+
+  VkDeviceSize size = defaultSize;
+  std::unique_ptr<Buffer> ring;
+  VkDeviceSize head = 0; // where the next range starts
+  VkDeviceSize used = 0; // the ranges in use end at head
+  // Of the transfer queue family
+  VkCommandPool pool = VK_NULL_HANDLE;
+  VkSemaphore semaphore = VK_NULL_HANDLE; // timeline
+  UploadTicket submitted = 0;
+  UploadTicket required = 0;
+  Batch current;
+  std::deque<Batch> batches; // in flight, oldest first
+  // Of reclaimed batches, reused
+  std::vector<VkCommandBuffer> freeCommandBuffers;
+};
+
+} // namespace Flim
@@ -33,8 +33,12 @@ void createImage(Image &image, VkFormat format, VkImageTiling tiling,
   // only relevant for images that will be used as attachments
   imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 
-  // only used by graphic queue
+  // only used by graphic queue, but for the uploads
   imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+    shareWithTransferQueue(imageInfo.sharingMode,
+                           imageInfo.queueFamilyIndexCount,
+                           imageInfo.pQueueFamilyIndices);
   imageInfo.flags = 0; // Optional, used for sparsed images
 
   if (vkCreateImage(context.device, &imageInfo, nullptr, &image.textureImage) !=
@@ -42,31 +46,23 @@ void createImage(Image &image, VkFormat format, VkImageTiling tiling,
     throw std::runtime_error("failed to create image!");
   }
 
-  VkMemoryRequirements memRequirements;
-  vkGetImageMemoryRequirements(context.device, image.textureImage,
-                               &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex =
-      findMemoryType(memRequirements.memoryTypeBits, properties);
-
-  if (vkAllocateMemory(context.device, &allocInfo, nullptr,
-                       &image.textureImageMemory) != VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate image memory!");
-  }
+  image.textureImageMemory =
+      context.allocator.allocateImage(image.textureImage, tiling, properties);
 
   image.format = format;
   image.layout = VK_IMAGE_LAYOUT_UNDEFINED;
-  vkBindImageMemory(context.device, image.textureImage,
-                    image.textureImageMemory, 0);
 }
 
 void copyBufferToImage(VkBuffer buffer, Image &image) {
   VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+  recordCopyBufferToImage(commandBuffer, buffer, 0, image);
+  endSingleTimeCommands(commandBuffer);
+}
+
+void recordCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer,
+                             VkDeviceSize offset, Image &image) {
   VkBufferImageCopy region{};
-  region.bufferOffset = 0;
+  region.bufferOffset = offset;
   region.bufferRowLength = 0;
   region.bufferImageHeight = 0;
 
@@ -80,12 +76,16 @@ void copyBufferToImage(VkBuffer buffer, Image &image) {
                         static_cast<uint32_t>(image.height), 1};
   vkCmdCopyBufferToImage(commandBuffer, buffer, image.textureImage,
                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-  endSingleTimeCommands(commandBuffer);
 }
 
 void transitionImageLayout(Image &image, VkImageLayout newLayout) {
   VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+  recordLayoutTransition(commandBuffer, image, newLayout);
+  endSingleTimeCommands(commandBuffer);
+}
 
+void recordLayoutTransition(VkCommandBuffer commandBuffer, Image &image,
+                            VkImageLayout newLayout) {
   VkImageMemoryBarrier barrier{};
   barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
   barrier.oldLayout = image.layout;
@@ -160,7 +160,6 @@ void transitionImageLayout(Image &image, VkImageLayout newLayout) {
   vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0,
                        nullptr, 0, nullptr, 1, &barrier);
   image.layout = newLayout;
-  endSingleTimeCommands(commandBuffer);
 }
 
 void createImageView(Image &image, VkImageAspectFlags aspectFlags) {
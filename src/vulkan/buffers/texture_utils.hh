@@ -11,10 +11,17 @@ static bool hasStencilComponent(VkFormat format);
 void createImage(Image &image, VkFormat format, VkImageTiling tiling,
                  VkImageUsageFlags usage, VkMemoryPropertyFlags properties);
 
+// Submitted on their own and waited for
 void copyBufferToImage(VkBuffer buffer, Image &image);
-
 void transitionImageLayout(Image &image, VkImageLayout newLayout);
 
+// Recorded in a command buffer, the layout of the image being the one it will
+// have once it is executed
+void recordCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer,
+                             VkDeviceSize offset, Image &image);
+void recordLayoutTransition(VkCommandBuffer commandBuffer, Image &image,
+                            VkImageLayout newLayout);
+
 void createImageView(Image &image, VkImageAspectFlags aspectFlags);
 
 } // namespace Flim
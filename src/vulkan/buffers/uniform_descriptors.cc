@@ -40,24 +40,21 @@ void ImageUniDesc::setup() {
                 << std::endl;
   }
   VkDeviceSize imageSize = texWidth * texHeight * 4;
-  {
-    Buffer staging = Buffer("staging pixel buffer", pixels, imageSize);
-    if (loaded)
-      stbi_image_free(pixels);
-    else
-      delete[] pixels;
-
-    image.width = texWidth;
-    image.height = texHeight;
-    // VK_IMAGE_USAGE_TRANSFER_DST_BIT to be able to copy
-    // VK_IMAGE_USAGE_SAMPLED_BIT to be able to use it in shader
-    createImage(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-                VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    transitionImageLayout(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    copyBufferToImage(staging.getVkBuffer(), image);
-    transitionImageLayout(image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-  }
+  image.width = texWidth;
+  image.height = texHeight;
+  // VK_IMAGE_USAGE_TRANSFER_DST_BIT to be able to copy
+  // VK_IMAGE_USAGE_SAMPLED_BIT to be able to use it in shader
+  createImage(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
+              VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  // Transitions included
+  context.staging.upload(image, imageSize, [&](void *staging) {
+    memcpy(staging, pixels, imageSize);
+  });
+  if (loaded)
+    stbi_image_free(pixels);
+  else
+    delete[] pixels;
   // Image view
   createImageView(image, VK_IMAGE_ASPECT_COLOR_BIT);
   // Sampler
@@ -119,7 +116,7 @@ ImageUniDesc::~ImageUniDesc() {
   vkDestroySampler(context.device, image.sampler, nullptr);
   vkDestroyImageView(context.device, image.view, nullptr);
   vkDestroyImage(context.device, image.textureImage, nullptr);
-  vkFreeMemory(context.device, image.textureImageMemory, nullptr);
+  context.allocator.free(image.textureImageMemory);
   imageSetup = false;
 }
 
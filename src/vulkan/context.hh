@@ -4,6 +4,9 @@
 #include <fwd.hh>
 #include <vulkan/vulkan_core.h>
 
+#include "vulkan/buffers/memory_allocator.hh"
+#include "vulkan/buffers/staging_ring.hh"
+
 namespace Flim {
 
 class RenderParams;
@@ -20,6 +23,8 @@ public:
   CommandPool commandPool;
   SwapChain swapChain;
   Image depthImage;
+  MemoryAllocator allocator; // of every buffer and image
+  StagingRing staging;       // what is uploaded to them goes through it
 } extern context;
 
 }; // namespace Flim
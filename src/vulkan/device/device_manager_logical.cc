@@ -16,6 +16,14 @@ static void setupQueues(VulkanContext &context, QueueFamilyIndices &indices) {
                    &context.queues.presentQueue);
   vkGetDeviceQueue(context.device, indices.presentFamily.value(), 0,
                    &context.queues.computeQueue);
+
+  const uint32_t graphicsFamily = indices.graphicsAndComputeFamily.value();
+  const uint32_t transferFamily =
+      indices.transferFamily.value_or(graphicsFamily);
+  vkGetDeviceQueue(context.device, transferFamily, 0,
+                   &context.queues.transferQueue);
+  context.queues.families[0] = graphicsFamily;
+  context.queues.families[1] = transferFamily;
 }
 
 void DeviceManager::createLogicalDevice() {
@@ -25,6 +33,8 @@ void DeviceManager::createLogicalDevice() {
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
   std::set<uint32_t> uniqueQueueFamilies = {
       indices.graphicsAndComputeFamily.value(), indices.presentFamily.value()};
+  if (indices.transferFamily.has_value())
+    uniqueQueueFamilies.insert(indices.transferFamily.value());
 
   float queuePriority = 1.0f;
   for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -42,6 +52,13 @@ void DeviceManager::createLogicalDevice() {
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
   dynamicRenderingFeature.dynamicRendering = VK_TRUE;
 
+  // specify timeline semaphores, used to wait for the uploads
+  VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeature{};
+  timelineSemaphoreFeature.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+  timelineSemaphoreFeature.timelineSemaphore = VK_TRUE;
+  dynamicRenderingFeature.pNext = &timelineSemaphoreFeature;
+
   // specify device address feature
   VkPhysicalDeviceBufferDeviceAddressFeatures bufferDeviceAddressFeat = {};
   bufferDeviceAddressFeat.sType =
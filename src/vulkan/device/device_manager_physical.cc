@@ -65,12 +65,19 @@ bool DeviceManager::isDeviceSuitable(VkPhysicalDevice device) {
                                       !swapChainSupport.presentModes.empty();
   }
 
-  VkPhysicalDeviceFeatures supportedFeatures;
-  vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
+  VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+  timelineFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &timelineFeatures;
+  vkGetPhysicalDeviceFeatures2(device, &features);
+  const VkPhysicalDeviceFeatures &supportedFeatures = features.features;
   return indices.isComplete() && extensionsSupported &&
          swapChainAdeQuaternionfernionfe &&
          supportedFeatures.samplerAnisotropy && supportedFeatures.wideLines &&
-         supportedFeatures.fillModeNonSolid;
+         supportedFeatures.fillModeNonSolid &&
+         timelineFeatures.timelineSemaphore;
 }
 
 void DeviceManager::pickPhysicalDevice() {
@@ -102,6 +109,8 @@ void DeviceManager::pickPhysicalDevice() {
 }
 
 DeviceManager::~DeviceManager() {
+  context.staging.destroy();
+  context.allocator.destroy();
   vkDestroyDevice(context.device, nullptr);
   vkDestroySurfaceKHR(context.instance, context.surface, nullptr);
   vkDestroyInstance(context.instance, nullptr);
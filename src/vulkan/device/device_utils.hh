@@ -10,6 +10,9 @@ namespace Flim {
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphicsAndComputeFamily;
   std::optional<uint32_t> presentFamily;
+  // Optional, a family only able to transfer (the copy engines of discrete
+  // GPUs), so that uploads do not stall the graphics queue
+  std::optional<uint32_t> transferFamily;
   bool isComplete() {
     return graphicsAndComputeFamily.has_value() && presentFamily.has_value();
   }
@@ -44,6 +47,15 @@ inline QueueFamilyIndices findQueueFamilies(VulkanContext &context,
     i++;
   }
 
+  for (uint32_t j = 0; j < queueFamilyCount; j++) {
+    VkQueueFlags flags = queueFamilies[j].queueFlags;
+    if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+        !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+      indices.transferFamily = j;
+      break;
+    }
+  }
+
   return indices;
 }
 } // namespace Flim
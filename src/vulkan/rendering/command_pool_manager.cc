@@ -8,6 +8,7 @@
 #include "vulkan/rendering/renderer.hh"
 #include "vulkan/rendering/utils.hh"
 
+#include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <optional>
@@ -108,6 +109,30 @@ void CommandPoolManager::recordCommandBuffer(const Computer &computer) {
                 computer.dispatchAmount.y(), computer.dispatchAmount.z());
 }
 
+void CommandPoolManager::recordCommandBuffer(const MeshletCuller &culler) {
+  VkCommandBuffer computeBuffer =
+      commandPool.computeBuffers[context.currentImage];
+  // Every meshlet kept adds its indices to the count, the other fields are
+  // written once at setup
+  VkBuffer drawCommand = culler.getDrawCommandBuffer().getVkBuffer();
+  vkCmdFillBuffer(computeBuffer, drawCommand,
+                  offsetof(VkDrawIndexedIndirectCommand, indexCount),
+                  sizeof(uint32_t), 0);
+  vkCmdFillBuffer(computeBuffer, drawCommand,
+                  offsetof(VkDrawIndexedIndirectCommand, instanceCount),
+                  sizeof(uint32_t),
+                  static_cast<uint32_t>(culler.mesh.instances.size()));
+
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(computeBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+  recordCommandBuffer(culler.getComputer());
+}
+
 void CommandPoolManager::recordCommandBuffer(const Renderer &renderer) {
   VkCommandBuffer graphicBuffer =
       commandPool.graphicBuffers[context.currentImage];
@@ -125,15 +150,18 @@ void CommandPoolManager::recordCommandBuffer(const Renderer &renderer) {
                            &attr.second->getBuffer()->getVkBuffer(), &offset);
   }
 
-  vkCmdBindIndexBuffer(graphicBuffer, renderer.indexBuffer.getVkBuffer(), 0,
-                       VK_INDEX_TYPE_UINT32);
+  vkCmdBindIndexBuffer(graphicBuffer, renderer.getIndexBuffer().getVkBuffer(),
+                       0, renderer.getIndexType());
   vkCmdBindDescriptorSets(graphicBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                           renderer.pipeline->pipelineLayout, 0, 1,
                           &renderer.descriptorSets[context.currentImage], 0,
                           nullptr);
-  vkCmdDrawIndexedIndirect(graphicBuffer,
-                           renderer.getDrawCommandBuffer().getVkBuffer(), 0, 1,
-                           sizeof(VkDrawIndirectCommand));
+  // One draw per command, multiDrawIndirect not being required
+  const VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+  for (uint32_t i = 0; i < renderer.getDrawCount(); i++)
+    vkCmdDrawIndexedIndirect(graphicBuffer,
+                             renderer.getDrawCommandBuffer().getVkBuffer(),
+                             i * stride, 1, stride);
 }
 
 void CommandPoolManager::createCommandBuffer(
@@ -318,15 +346,32 @@ static void endCmdBuffer(
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
   // TODO handle that in parameters
-  VkPipelineStageFlags waitStages[] = {
+  std::vector<VkPipelineStageFlags> waitStages = {
       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-      VK_PIPELINE_STAGE_VERTEX_INPUT_BIT};
-  if (waitSemaphore.has_value()) {
-    auto &wsems = waitSemaphore.value();
-    submitInfo.waitSemaphoreCount = wsems.size();
-    submitInfo.pWaitSemaphores = wsems.data();
-    submitInfo.pWaitDstStageMask = waitStages;
+      // Compute shaders can write the indirect draw commands
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT};
+  std::vector<VkSemaphore> wsems = waitSemaphore.value_or(
+      std::vector<VkSemaphore>());
+  waitStages.resize(wsems.size());
+  // Ignored for the binary semaphores
+  std::vector<uint64_t> waitValues(wsems.size(), 0);
+
+  // The uploads on the transfer queue the frame may read
+  const UploadTicket uploads = context.staging.getRequired();
+  if (uploads != 0) {
+    wsems.push_back(context.staging.getSemaphore());
+    waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    waitValues.push_back(uploads);
   }
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = waitValues.size();
+  timelineInfo.pWaitSemaphoreValues = waitValues.data();
+  submitInfo.pNext = &timelineInfo;
+
+  submitInfo.waitSemaphoreCount = wsems.size();
+  submitInfo.pWaitSemaphores = wsems.data();
+  submitInfo.pWaitDstStageMask = waitStages.data();
   submitInfo.commandBufferCount = 1;
   submitInfo.pCommandBuffers = &cmdBuffer;
 
@@ -351,6 +396,9 @@ bool CommandPoolManager::submitFrame(bool framebufferResized) {
   auto &computeInFlightFences = commandPool.computeInFlightFences;
   auto &computeBuffer = commandPool.computeBuffers[context.currentImage];
 
+  // Uploads of the frame first, waited for by its submits
+  context.staging.flush();
+
   // COMPUTE QUEUE
   endCmdBuffer(computeBuffer, context.queues.computeQueue, std::nullopt,
                computeFinishedSemaphores[context.currentImage],
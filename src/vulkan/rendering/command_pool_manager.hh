@@ -18,6 +18,8 @@ public:
                        // adeQuaternionfernionfe
   void recordCommandBuffer(const Renderer &renderer);
   void recordCommandBuffer(const Computer &computer);
+  // Resets the draw command of the frame then culls into it
+  void recordCommandBuffer(const MeshletCuller &culler);
   bool submitFrame(bool framebufferResized); // return if the swap chain is no
                                              // longer adeQuaternionfernionfe
 private:
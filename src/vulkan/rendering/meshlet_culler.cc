@@ -0,0 +1,121 @@
+#include "meshlet_culler.hh"
+#include "utils/checks.hh"
+#include "vulkan/context.hh"
+#include <algorithm>
+#include <cstring>
+#include <vulkan/vulkan_core.h>
+
+namespace Flim {
+
+// Flags of the culling uniform, as in the shader
+static constexpr uint32_t cullFrustum = 1;
+static constexpr uint32_t cullCone = 2;
+
+enum CullingBinding {
+  MESHLETS = 0,
+  INDICES,
+  CULLED_INDICES,
+  DRAW_COMMAND,
+  CULLING_UNIFORM,
+};
+
+MeshletCuller::MeshletCuller(const Mesh &mesh, const RenderParams &renderParams,
+                             const Camera &camera,
+                             std::vector<Meshlet> meshlets)
+    : mesh(mesh), renderParams(renderParams), camera(camera),
+      meshlets(std::move(meshlets)), params(renderParams.name + " culling") {
+  CHECK(!this->meshlets.empty(), "Cannot cull a mesh without any triangle");
+  params.shader = Shader("shaders/meshlet_culling.comp.spv");
+  const size_t nbIndices = mesh.triangles.size() * 3;
+
+  params.setAttribute(MESHLETS)
+      .attach<Meshlet>(this->meshlets.size(),
+                       [this](Meshlet *data) {
+                         memcpy((void *)data, this->meshlets.data(),
+                                this->meshlets.size() * sizeof(Meshlet));
+                       })
+      .add(0, VK_FORMAT_R32G32B32A32_SFLOAT)
+      .onlySetup(true)
+      .computeFriendly(true)
+      .singleBuffered(true);
+  params.setAttribute(INDICES)
+      .attach<uint32_t>(nbIndices,
+                        [this](uint32_t *data) {
+                          memcpy((void *)data, this->mesh.triangles.data(),
+                                 this->mesh.triangles.size() * sizeof(Triangle));
+                        })
+      .add(0, VK_FORMAT_R32_UINT)
+      .onlySetup(true)
+      .computeFriendly(true)
+      .singleBuffered(true);
+  // One copy of the outputs per frame in flight, so that culling a frame
+  // never writes what the previous one is still drawing
+  params.setAttribute(CULLED_INDICES)
+      .attach<uint32_t>(nbIndices, [](uint32_t *) {})
+      .add(0, VK_FORMAT_R32_UINT)
+      .onlySetup(true)
+      .computeFriendly(true)
+      .extraUsage(VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+  // Its counts are reset on the GPU ahead of each dispatch, see
+  // CommandPoolManager::recordCommandBuffer
+  params.setAttribute(DRAW_COMMAND)
+      .attach<VkDrawIndexedIndirectCommand>(
+          1, [](VkDrawIndexedIndirectCommand *cmd) { *cmd = {}; })
+      .add(0, VK_FORMAT_R32_UINT)
+      .onlySetup(true)
+      .computeFriendly(true)
+      .extraUsage(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+
+  // Laid out as in std140
+  struct CullingUniform {
+    alignas(16) Matrix4f viewProj;
+    alignas(16) Vector4f camera;
+    alignas(16) uint32_t instanceCount;
+    uint32_t flags;
+    alignas(16) Matrix4f models[maxInstances];
+  };
+  params.setUniform(CULLING_UNIFORM, COMPUTE_SHADER_STAGE)
+      .attach<CullingUniform>([this](CullingUniform *uni) {
+        const auto &extent = context.swapChain.swapChainExtent;
+        uni->viewProj = this->camera.getProjMat(extent.width /
+                                                (float)extent.height) *
+                        this->camera.getViewMat();
+        uni->camera.head<3>() = this->camera.transform.getPosition();
+        uni->camera.w() = 1.0f;
+        const auto &instances = this->mesh.instances;
+        uni->instanceCount = std::min<size_t>(instances.size(), maxInstances);
+        uni->flags = 0;
+        if (instances.size() > (size_t)maxInstances)
+          return;
+        uni->flags = cullFrustum;
+        // Only what is not drawn anyway can be dropped
+        if (this->renderParams.useBackfaceCulling && !this->camera.is2D)
+          uni->flags |= cullCone;
+        const Matrix4f model = this->mesh.transform.getViewMatrix();
+        for (size_t i = 0; i < instances.size(); i++)
+          uni->models[i] = model * instances[i].transform.getViewMatrix();
+      });
+
+  // One workgroup per meshlet, spread over y past the smallest guaranteed
+  // limit of x
+  constexpr int maxGroups = 65535;
+  int nbGroups = this->meshlets.size();
+  computer = std::make_unique<Computer>(
+      Vector3i(std::min(nbGroups, maxGroups),
+               (nbGroups + maxGroups - 1) / maxGroups, 1),
+      params);
+}
+
+void MeshletCuller::setup() { computer->setup(); }
+
+void MeshletCuller::update() { computer->update(); }
+
+const Buffer &MeshletCuller::getIndexBuffer() const {
+  return *params.getAttributeDescriptors().at(CULLED_INDICES)->getBuffer();
+}
+
+const Buffer &MeshletCuller::getDrawCommandBuffer() const {
+  return *params.getAttributeDescriptors().at(DRAW_COMMAND)->getBuffer();
+}
+
+} // namespace Flim
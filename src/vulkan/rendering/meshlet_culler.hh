@@ -0,0 +1,50 @@
+#pragma once
+
+#include "api/parameters/compute_params.hh"
+#include "api/parameters/render_params.hh"
+#include "api/render/mesh_utils.hh"
+#include "api/tree/camera.hh"
+#include "vulkan/computing/computer.hh"
+#include <memory>
+#include <vector>
+
+namespace Flim {
+
+// Culls the meshlets of a mesh on the GPU every frame, against the camera
+// frustum and their normal cone (when back faces are culled), for each of its
+// instances. The indices of the meshlets left are compacted in an index buffer
+// and counted in an indirect draw command, both written by
+// shaders/meshlet_culling.comp and drawn by the renderer instead of its own.
+class MeshletCuller {
+public:
+  // Invocations per workgroup, each workgroup copying one meshlet
+  static constexpr int groupSize = 64;
+  // Instances culled against, with more every meshlet is kept
+  static constexpr int maxInstances = 64;
+
+  MeshletCuller(const Mesh &mesh, const RenderParams &renderParams,
+                const Camera &camera, std::vector<Meshlet> meshlets);
+  MeshletCuller(MeshletCuller &) = delete;
+
+  void setup();
+  // Updates the camera
+  void update();
+
+  const Computer &getComputer() const { return *computer; }
+  // Of the current frame
+  const Buffer &getIndexBuffer() const;
+  const Buffer &getDrawCommandBuffer() const;
+
+private:
+  const Mesh &mesh;
+  const RenderParams &renderParams;
+  const Camera &camera;
+  std::vector<Meshlet> meshlets;
+
+  ComputeParams params;
+  std::unique_ptr<Computer> computer;
+
+  friend class CommandPoolManager;
+};
+
+} // namespace Flim
@@ -2,9 +2,14 @@
 
 #include "api/parameters/render_params.hh"
 #include "api/render/mesh.hh"
+#include "api/render/mesh_optimizer.hh"
+#include "api/render/mesh_utils.hh"
 #include "api/tree/instance.hh"
 #include "vulkan/context.hh"
 #include <Eigen/src/Core/Matrix.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include <vulkan/vulkan_core.h>
@@ -13,8 +18,90 @@ namespace Flim {
 void Renderer::setup() {
   assert(mesh.vertices.size() > 0);
   assert(mesh.triangles.size() > 0);
+  // No instance can be added from now on
+  for (size_t i = 0; i < mesh.instances.size(); i++)
+    mesh.instances[i].transform.track(&mesh, i);
   setupDescriptors();
   pipeline->create();
+  if (culler) {
+    culler->setup();
+    return;
+  }
+  const size_t nbCommands = std::max<size_t>(mesh.lods.size(), 1);
+  for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    drawCmdBuffers[i] = std::make_unique<Buffer>(
+        "Draw command buffer mesh id " + std::to_string(mesh.id) + " frame " +
+            std::to_string(i),
+        nbCommands * sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    drawCmdBuffers[i]->map();
+  }
+}
+
+Renderer::Renderer(Mesh &mesh, RenderParams &params)
+    : DescriptorHolder(params, false), params(params), version(0),
+      drawCount(1), mesh(mesh),
+      indexType(prepareIndices()),
+      indexBuffer("Index buffer",
+                  mesh.triangles.size() * 3 *
+                      (indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t)
+                                                         : sizeof(uint32_t)),
+                  VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  // Only written through the staging ring
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true),
+      pipeline(std::make_unique<Pipeline>(*this)) {
+  indexBuffer.populate([&](void *data) {
+    if (indexType == VK_INDEX_TYPE_UINT32) {
+      memcpy(data, mesh.triangles.data(),
+             mesh.triangles.size() * sizeof(Triangle));
+      return;
+    }
+    uint16_t *indices = (uint16_t *)data;
+    for (const Triangle &t : mesh.triangles)
+      for (uint32_t v : t)
+        *indices++ = v;
+  });
+  Vector3f min = mesh.vertices[0].pos, max = min;
+  for (const Vertex &v : mesh.vertices) {
+    min = min.cwiseMin(v.pos);
+    max = max.cwiseMax(v.pos);
+  }
+  const Vector3f center = (min + max) * 0.5f;
+  float radius = 0.0f;
+  for (const Vertex &v : mesh.vertices)
+    radius = std::max(radius, (v.pos - center).norm());
+  lodSphere << center, radius;
+  for (auto &attr : this->params.getAttributeDescriptors()) {
+    CHECK(attr.second->getAttachedMesh() == nullptr,
+          "You cannot reuse a render param for a mesh, please clone it first");
+    bufferManager.attachMesh(attr.second->bufferId, &mesh);
+  }
+}
+
+VkIndexType Renderer::prepareIndices() {
+  CHECK(!mesh.vertices.empty(), "Cannot render a mesh without any vertex");
+  for (const MeshLOD &lod : mesh.lods)
+    CHECK(lod.firstTriangle + lod.triangleCount <= mesh.triangles.size(),
+          "A level of detail goes past the triangles of its mesh");
+  // Both reorder the triangles of the whole mesh, mixing up the levels
+  CHECK(mesh.lods.empty() ||
+            (!params.optimizeMesh && params.cullingCamera == nullptr),
+        "A mesh with levels of detail can neither be optimized nor have its "
+        "meshlets culled, optimize it before building them");
+  if (params.optimizeMesh) {
+    auto report = MeshOptimizer::optimize(mesh);
+    std::cout << "Optimized mesh " << mesh.id << ": ACMR "
+              << report.acmrBefore << " -> " << report.acmrAfter << std::endl;
+  }
+  if (params.cullingCamera != nullptr)
+    culler = std::make_unique<MeshletCuller>(mesh, params, *params.cullingCamera,
+                                             MeshUtils::buildMeshlets(mesh));
+  if (params.compactIndices && mesh.vertices.size() <= UINT16_MAX + 1)
+    return VK_INDEX_TYPE_UINT16;
+  return VK_INDEX_TYPE_UINT32;
 }
 
 const std::vector<Flim::Instance> &Renderer::getInstances() {
@@ -22,6 +109,8 @@ const std::vector<Flim::Instance> &Renderer::getInstances() {
 }
 
 void Renderer::update() {
+  // Before the instances are uploaded, in the order of their levels
+  std::vector<VkDrawIndexedIndirectCommand> cmds = buildDrawCommands();
   for (auto desc : params.getUniformDescriptors()) {
     desc.second->update();
   }
@@ -35,17 +124,128 @@ void Renderer::update() {
     std::cout << "RECREATED " << std::endl;
     version = params.version;
   }
-  VkDrawIndexedIndirectCommand cmd{
-      .indexCount = static_cast<uint32_t>(mesh.triangles.size() * 3),
-      .instanceCount = static_cast<uint32_t>(mesh.instances.size()),
-      .firstIndex = 0,
-      .vertexOffset = 0,
-      .firstInstance = 0,
+  if (culler) {
+    culler->update();
+    return;
+  }
+  // Only the buffer of this frame, the previous one may still be drawing
+  const Buffer &buffer = *drawCmdBuffers[context.currentImage];
+  CHECK(cmds.size() * sizeof(VkDrawIndexedIndirectCommand) <=
+            (size_t)buffer.getSize(),
+        "The levels of detail of a mesh cannot change once it is registered");
+  drawCount = cmds.size();
+  memcpy(buffer.getPtr(), cmds.data(),
+         cmds.size() * sizeof(VkDrawIndexedIndirectCommand));
+}
+
+std::vector<VkDrawIndexedIndirectCommand> Renderer::buildDrawCommands() {
+  const uint32_t nbInstances = mesh.instances.size();
+  if (mesh.lods.empty() || params.lodCamera == nullptr) {
+    // Back to the order of the instances
+    mesh.setInstanceOrder({});
+    const MeshLOD finest =
+        mesh.lods.empty()
+            ? MeshLOD{0, static_cast<uint32_t>(mesh.triangles.size()), 0.0f}
+            : mesh.lods[0];
+    return {{
+        .indexCount = finest.triangleCount * 3,
+        .instanceCount = nbInstances,
+        .firstIndex = finest.firstTriangle * 3,
+        .vertexOffset = 0,
+        .firstInstance = 0,
+    }};
+  }
+
+  const Camera &cam = *params.lodCamera;
+  const auto &extent = context.swapChain.swapChainExtent;
+  // Pixels covered by a unit at a distance of 1, or at any distance in 2D
+  const float pixels =
+      std::abs(cam.getProjMat(extent.width / (float)extent.height)(1, 1)) *
+      extent.height * 0.5f;
+  const Matrix4f model = mesh.transform.getViewMatrix();
+  const uint32_t nbLods = mesh.lods.size();
+  std::vector<uint32_t> levels(nbInstances);
+  std::vector<uint32_t> counts(nbLods, 0);
+  for (uint32_t i = 0; i < nbInstances; i++) {
+    const Matrix4f world = model * mesh.instances[i].transform.getViewMatrix();
+    const float scale = world.block<3, 3>(0, 0).colwise().norm().maxCoeff();
+    float perUnit = pixels * scale;
+    if (!cam.is2D) {
+      // From the closest point of the bounding sphere
+      const Vector3f center = (world * Vector4f(lodSphere.x(), lodSphere.y(),
+                                                lodSphere.z(), 1.0f))
+                                  .head<3>();
+      const float distance = (center - cam.transform.getPosition()).norm() -
+                             lodSphere.w() * scale;
+      perUnit /= std::max(distance, cam.near);
+    }
+    // The coarsest level that is precise enough, errors only grow
+    uint32_t level = 0;
+    while (level + 1 < nbLods &&
+           mesh.lods[level + 1].error * perUnit <= params.lodPixelError)
+      level++;
+    levels[i] = level;
+    counts[level]++;
+  }
+
+  // Each level is drawn from a range of the instances
+  std::vector<VkDrawIndexedIndirectCommand> cmds;
+  std::vector<uint32_t> offsets(nbLods);
+  uint32_t offset = 0;
+  for (uint32_t l = 0; l < nbLods; l++) {
+    offsets[l] = offset;
+    if (counts[l] > 0)
+      cmds.push_back({
+          .indexCount = mesh.lods[l].triangleCount * 3,
+          .instanceCount = counts[l],
+          .firstIndex = mesh.lods[l].firstTriangle * 3,
+          .vertexOffset = 0,
+          .firstInstance = offset,
+      });
+    offset += counts[l];
+  }
+  // The instances keep their slot of the previous frame while it is in the
+  // range of their level, the others fill the free slots of theirs. Only the
+  // slots whose instance changed are then written again.
+  const std::vector<uint32_t> &previous = mesh.instanceOrder;
+  auto previousAt = [&](uint32_t slot) {
+    return previous.empty() ? slot : previous[slot];
   };
-  drawCmdBuffer = std::make_unique<Buffer>(
-      "Draw command buffer mesh id " + std::to_string(mesh.id), &cmd,
-      sizeof(cmd), VK_BUFFER_USAGE_2_INDIRECT_BUFFER_BIT);
+  std::vector<uint32_t> order(nbInstances, UINT32_MAX);
+  std::vector<bool> placed(nbInstances, false);
+  if (previous.empty() || previous.size() == nbInstances)
+    for (uint32_t l = 0; l < nbLods; l++)
+      for (uint32_t slot = offsets[l]; slot < offsets[l] + counts[l]; slot++)
+        if (levels[previousAt(slot)] == l) {
+          order[slot] = previousAt(slot);
+          placed[order[slot]] = true;
+        }
+  for (uint32_t i = 0; i < nbInstances; i++) {
+    if (placed[i])
+      continue;
+    uint32_t &slot = offsets[levels[i]];
+    while (order[slot] != UINT32_MAX)
+      slot++;
+    order[slot++] = i;
+  }
+  mesh.setInstanceOrder(std::move(order));
+  if (cmds.empty())
+    cmds.push_back({}); // nothing to draw
+  return cmds;
 }
 
-const Buffer &Renderer::getDrawCommandBuffer() const { return *drawCmdBuffer; }
+const Buffer &Renderer::getDrawCommandBuffer() const {
+  return culler ? culler->getDrawCommandBuffer()
+                : *drawCmdBuffers[context.currentImage];
+}
+
+const Buffer &Renderer::getIndexBuffer() const {
+  return culler ? culler->getIndexBuffer() : indexBuffer;
+}
+
+uint32_t Renderer::getDrawCount() const { return culler ? 1 : drawCount; }
+
+VkIndexType Renderer::getIndexType() const {
+  return culler ? VK_INDEX_TYPE_UINT32 : indexType;
+}
 }; // namespace Flim
@@ -7,8 +7,11 @@
 #include "vulkan/buffers/buffer_manager.hh"
 #include "vulkan/buffers/descriptor_holder.hh"
 #include "vulkan/context.hh"
+#include "vulkan/rendering/meshlet_culler.hh"
 #include "vulkan/rendering/pipeline.hh"
+#include "consts.hh"
 #include <Eigen/src/Core/Matrix.h>
+#include <array>
 #include <sys/types.h>
 #include <vector>
 #include <vulkan/vulkan_core.h>
@@ -27,6 +30,11 @@ public:
   void setup();
 
   const Buffer &getDrawCommandBuffer() const;
+  // Commands in the draw command buffer, one per level of detail drawn
+  uint32_t getDrawCount() const;
+  // What is drawn, the culled indices when meshlets are culled
+  const Buffer &getIndexBuffer() const;
+  VkIndexType getIndexType() const;
 
   void setupUniforms();
   void updateUniforms(const Instance &obj, const Camera &cam);
@@ -34,25 +42,27 @@ public:
   const std::vector<Instance> &getInstances();
   Mesh &mesh;
   RenderParams &params;
+  std::unique_ptr<MeshletCuller> culler; // when params.cullingCamera is set
+  // 16 bits when every vertex can be indexed with it
+  VkIndexType indexType;
   Buffer indexBuffer;
   std::unique_ptr<Pipeline> pipeline;
 
-  Renderer(Mesh &mesh, RenderParams &params)
-      : DescriptorHolder(params, false), params(params), version(0), mesh(mesh),
-        indexBuffer("Index buffer", mesh.triangles.data(),
-                    mesh.triangles.size() * sizeof(Triangle),
-                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 0, true),
-        pipeline(std::make_unique<Pipeline>(*this)) {
-    for (auto &attr : this->params.getAttributeDescriptors()) {
-      CHECK(
-          attr.second->getAttachedMesh() == nullptr,
-          "You cannot reuse a render param for a mesh, please clone it first");
-      bufferManager.attachMesh(attr.second->bufferId, &mesh);
-    }
-  };
+  Renderer(Mesh &mesh, RenderParams &params);
 
 private:
+  // Optimizes the mesh and splits it in meshlets first if asked to, and picks
+  // the index type
+  VkIndexType prepareIndices();
+  // Picks the level of detail of every instance for params.lodCamera, and
+  // groups them by level in mesh.instanceOrder to draw each level at once
+  std::vector<VkDrawIndexedIndirectCommand> buildDrawCommands();
   int version;
-  std::unique_ptr<Buffer> drawCmdBuffer;
+  // Host visible, one per frame in flight so that the commands of a frame are
+  // only rewritten once it is over. Sized for a command per level of detail.
+  std::array<std::unique_ptr<Buffer>, MAX_FRAMES_IN_FLIGHT> drawCmdBuffers;
+  uint32_t drawCount;
+  // Bounding sphere of the vertices (center, radius)
+  Vector4f lodSphere;
 };
 }; // namespace Flim
@@ -84,7 +84,7 @@ VkExtent2D SwapChainManager::chooseSwapExtent(
 void SwapChainManager::destroySwapChain() {
   vkDestroyImageView(context.device, context.depthImage.view, nullptr);
   vkDestroyImage(context.device, context.depthImage.textureImage, nullptr);
-  vkFreeMemory(context.device, context.depthImage.textureImageMemory, nullptr);
+  context.allocator.free(context.depthImage.textureImageMemory);
 
   /* for (size_t i = 0; i < swapChain.swapChainFramebuffers.size(); i++) { */
   /*   vkDestroyFramebuffer(context.device, swapChain.swapChainFramebuffers[i],